@@ -6,512 +6,1058 @@
  * @date 07/25/2010
  */
 
+#include "tagfs_arena.h"
+#include "tagfs_cache.h"
 #include "tagfs_common.h"
+#include "tagfs_cooccur.h"
 #include "tagfs_db.h"
 #include "tagfs_debug.h"
+#include "tagfs_dict.h"
+#include "tagfs_folders.h"
+#include "tagfs_handle.h"
+#include "tagfs_index.h"
+#include "tagfs_inode.h"
+#include "tagfs_path.h"
+#include "tagfs_stats.h"
 
 #include <assert.h>
 #include <errno.h>
-#include <fuse.h>
+#include <fcntl.h>
+#include <fuse_lowlevel.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-/*
- * Get file attributes.
+struct tagfs_state *tagfs_data = NULL;
+
+/**
+ * Attributes of the reserved directory and the statistics file in it, which
+ * are not in the database.
  *
- * Similar to stat(). The 'st_dev' and 'st_blksize' fields are ignored. The
- * 'st_ino' field is ignored except if the 'use_ino' mount option is given.
+ * @param path A path for which stats_path() holds.
+ * @param statbuf OUT: The attributes.
+ * @return 0 on success, or a negated errno value.
  */
-int tagfs_getattr(const char *path, struct stat *statbuf) {
-	char *file_location = NULL;
-	int file_id = 0;
-	int retstat = 0;
-
-	DEBUG(ENTRY);
-	INFO("Retrieving attributes for %s", path);
+static int virtual_getattr(const char *path, struct stat *statbuf) {
+	memset(statbuf, 0, sizeof(*statbuf));
+
+	if(strcmp(path, STATS_DIR) == 0) {
+		statbuf->st_ino = INODE_STATS_DIR;
+		statbuf->st_mode = S_IFDIR | 0555;
+		statbuf->st_nlink = 2;
+	} else if(strcmp(path, STATS_FILE) == 0) {
+		statbuf->st_ino = INODE_STATS_FILE;
+		statbuf->st_mode = S_IFREG | 0444; /* size left at 0 as in /proc, the file is opened with direct_io */
+		statbuf->st_nlink = 1;
+	} else {
+		return -ENOENT;
+	}
 
-	if (valid_path_to_file(path)) {
-		file_id = file_id_from_path(path);
-		file_location = get_file_location(file_id);
+	statbuf->st_uid = getuid();
+	statbuf->st_gid = getgid();
 
-		/* read information from actual file */
-		retstat = stat(file_location, statbuf);
+	return 0;
+} /* virtual_getattr */
 
-		if(retstat < 0) {
-			WARN("Reading information from file %s failed", file_location);
-			delete_file(file_id);
-		}
+/**
+ * Open the statistics file. The statistics are rendered once into an unlinked
+ * temporary file, so every read of the open sees the same snapshot, and read,
+ * getattr and release treat it like any backing file.
+ *
+ * @param path A path for which stats_path() holds.
+ * @param fi The open flags in, the handle out.
+ * @return 0 on success, or a negated errno value.
+ */
+static int virtual_open(const char *path, struct fuse_file_info *fi) {
+	char *snapshot_path = NULL;
+	char *text = NULL;
+	int fd = -1;
+	int length = 0;
+	int retstat = 0;
+	int written = 0;
+	struct file_handle *handle = NULL;
 
-		free_single_ptr((void **)&file_location);
+	if(strcmp(path, STATS_FILE) != 0) {
+		return strcmp(path, STATS_DIR) == 0 ? -EISDIR : -ENOENT;
 	}
-	else if(valid_path_to_folder(path)) {
-		statbuf->st_mode = S_IFDIR | 0755; /* TODO: Set hard links, etc. */
-	}
-	else {
-		retstat = -ENOENT;
+
+	if((fi->flags & O_ACCMODE) != O_RDONLY) {
+		return -EACCES;
 	}
 
-	DEBUG(EXIT);
-	return retstat;
-} /* tagfs_getattr */
+	length = stats_render(&text);
 
-int tagfs_mknod(const char *path, mode_t mode, dev_t dev) {
-	int retstat = 0;
+	snapshot_path = malloc(strlen(TAGFS_DATA->exec_dir) + strlen("/.stats.XXXXXX") + 1);
+	assert(snapshot_path != NULL);
+	sprintf(snapshot_path, "%s/.stats.XXXXXX", TAGFS_DATA->exec_dir);
 
-	DEBUG(ENTRY);
+	fd = mkstemp(snapshot_path);
+
+	if(fd < 0) {
+		retstat = -errno;
+		WARN("Unable to create a statistics snapshot in %s", TAGFS_DATA->exec_dir);
+	} else {
+		unlink(snapshot_path);
 
-	ERROR("TODO: %s", __FUNCTION__);
+		while(retstat == 0 && written < length) {
+			retstat = write(fd, text + written, length - written);
 
-	DEBUG(EXIT);
-	return retstat;
-}
+			if(retstat < 0) {
+				retstat = -errno;
+				WARN("Writing the statistics snapshot failed");
+			} else {
+				written += retstat;
+				retstat = 0;
+			}
+		}
 
-int tagfs_mkdir(const char *path, mode_t mode) {
-	int retstat = 0;
+		if(retstat == 0) {
+			retstat = handle_adopt(fd, O_RDONLY, &handle);
+		} else {
+			close(fd);
+		}
+	}
 
-	DEBUG(ENTRY);
+	if(retstat == 0) {
+		fi->fh = HANDLE_TO_FH(handle);
+		fi->direct_io = 1; /* the size in getattr is 0, so let the kernel read until EOF */
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	free_single_ptr((void **)&snapshot_path);
+	free(text);
 
-	DEBUG(EXIT);
 	return retstat;
-}
+} /* virtual_open */
 
-/*
- * Remove a file.
+/**
+ * Build the path of an entry of a folder, to resolve it like any other path.
+ * Must be called with the tag lock held.
+ *
+ * @param parent The inode number of the folder.
+ * @param name The name of the entry.
+ * @return The path of the entry, allocated from the request arena, or NULL if the parent is not a folder the kernel looked up.
+ */
+static char *child_path(fuse_ino_t parent, const char *name) {
+	char *parent_path = NULL;
+	char *path = NULL;
+	int length = 0;
+
+	if(parent == INODE_STATS_DIR) {
+		parent_path = STATS_DIR;
+	} else {
+		parent_path = inode_folder_path(parent);
+	}
+
+	if(parent_path != NULL) {
+		length = strlen(parent_path) + strlen("/") + strlen(name);
+		path = arena_alloc(length + 1);
+		snprintf(path, length + 1, "%s/%s", strcmp(parent_path, "/") == 0 ? "" : parent_path, name);
+	}
+
+	return path;
+} /* child_path */
+
+/**
+ * Attributes of a folder. A folder has no backing directory, so only its inode
+ * number, type and permissions are filled in.
+ *
+ * @param ino The inode number of the folder.
+ * @param statbuf OUT: The attributes.
+ */
+static void folder_getattr(fuse_ino_t ino, struct stat *statbuf) {
+	memset(statbuf, 0, sizeof(*statbuf));
+	statbuf->st_ino = ino;
+	statbuf->st_mode = S_IFDIR | 0755; /* TODO: Set hard links, etc. */
+	statbuf->st_nlink = 2;
+} /* folder_getattr */
+
+/**
+ * Attributes of a file, read from its backing file, under the inode number of
+ * the file rather than of the backing file. A file whose backing file cannot be
+ * read is deleted from the TagFS. Must be called without the tag lock held.
+ *
+ * @param file_id The ID of the file.
+ * @param statbuf OUT: The attributes.
+ * @return 0 on success, or a negated errno value.
  */
-int tagfs_unlink(const char *path) {
+static int file_getattr(int file_id, struct stat *statbuf) {
+	char *file_location = NULL;
 	int retstat = 0;
-	int file_id = 0;
 
-	DEBUG(ENTRY);
-	INFO("Deleting %s", path);
+	tag_read_lock();
+	file_location = get_file_location(file_id);
+	tag_unlock();
+
+	if(file_location == NULL) {
+		return -ENOENT;
+	}
 
-	file_id = file_id_from_path(path);
+	if(stat(file_location, statbuf) < 0) {
+		retstat = -errno;
+		WARN("Reading information from file %s failed", file_location);
 
-	if(strcmp(dirname(path), "/") == 0) {
-		remove_file(file_id);
+		tag_write_lock();
+		delete_file(file_id);
+		tag_unlock();
 	} else {
-		remove_tags(file_id);
+		statbuf->st_ino = inode_of_file(file_id);
 	}
 
-	DEBUG(EXIT);
+	free_single_ptr((void **)&file_location);
+
 	return retstat;
-}
+} /* file_getattr */
 
-int tagfs_rmdir(const char *path) {
+/**
+ * Attributes of anything the kernel has an inode number for. Files are read
+ * straight from their file ID, folders are checked to still hold files.
+ *
+ * @param ino The inode number.
+ * @param statbuf OUT: The attributes.
+ * @return 0 on success, or a negated errno value.
+ */
+static int inode_getattr(fuse_ino_t ino, struct stat *statbuf) {
+	char *path = NULL;
+	int file_id = inode_file_id(ino);
 	int retstat = 0;
 
-	DEBUG(ENTRY);
+	if(ino == INODE_STATS_DIR) {
+		retstat = virtual_getattr(STATS_DIR, statbuf);
+	} else if(ino == INODE_STATS_FILE) {
+		retstat = virtual_getattr(STATS_FILE, statbuf);
+	} else if(file_id > 0) {
+		retstat = file_getattr(file_id, statbuf);
+	} else {
+		tag_read_lock();
+		path = inode_folder_path(ino);
 
-	ERROR("TODO: %s", __FUNCTION__);
+		if(path != NULL && valid_path_to_folder(path)) {
+			folder_getattr(ino, statbuf);
+		} else {
+			retstat = -ENOENT;
+		}
+
+		tag_unlock();
+	}
 
-	DEBUG(EXIT);
 	return retstat;
-}
+} /* inode_getattr */
 
-int tagfs_rename(const char *path, const char *newpath) {
-	char **tag_array = NULL;
+/*
+ * Look up a directory entry by name and get its attributes
+ *
+ * The kernel keeps the entry for entry_timeout seconds and the attributes for
+ * attr_timeout seconds. A missing name is remembered for negative_timeout
+ * seconds. Every folder handed out is counted in the inode table until the
+ * kernel forgets it.
+ */
+void tagfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+	char *path = NULL;
 	int file_id = 0;
-	int i = 0;
-	int num_tags = 0;
 	int retstat = 0;
+	struct fuse_entry_param entry;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
-	INFO("Moving %s to %s", path, newpath);
 
-	file_id = file_id_from_path(path);
-	remove_tags(file_id);
+	memset(&entry, 0, sizeof(entry));
 
-	if(strcmp(dirname(newpath), "/") != 0) { /* deleting will put the file at root. Nothing to add */
-		num_tags = path_to_array(dirname(newpath), &tag_array);
+	arena_begin();
 
-		for(i = 0; i < num_tags; i++) {
-			add_tag_to_file(tag_id_from_tag_name(tag_array[i]), file_id);
+	tag_read_lock();
+
+	path = child_path(parent, name);
+
+	if(path == NULL) {
+		retstat = -ENOENT;
+	} else if(stats_path(path)) {
+		retstat = virtual_getattr(path, &entry.attr);
+	} else {
+		file_id = file_id_from_path(path);
+
+		if(file_id <= 0) {
+			if(valid_path_to_folder(path)) {
+				folder_getattr(inode_folder_lookup(path), &entry.attr);
+			} else {
+				retstat = -ENOENT;
+			}
 		}
+	}
+
+	tag_unlock();
 
-		free_double_ptr((void ***)&tag_array, num_tags);
+	if(file_id > 0) {
+		retstat = file_getattr(file_id, &entry.attr);
 	}
 
+	INFO("Looked up %s with result %d", path != NULL ? path : name, retstat);
+
+	arena_end();
+
+	if(retstat == 0) {
+		entry.ino = entry.attr.st_ino;
+		entry.attr_timeout = TAGFS_DATA->attr_timeout;
+		entry.entry_timeout = TAGFS_DATA->entry_timeout;
+		fuse_reply_entry(req, &entry);
+	} else if(retstat == -ENOENT && TAGFS_DATA->negative_timeout > 0) {
+		entry.ino = 0; /* a negative entry, cached like any other */
+		entry.entry_timeout = TAGFS_DATA->negative_timeout;
+		fuse_reply_entry(req, &entry);
+	} else {
+		fuse_reply_err(req, -retstat);
+	}
+
+	stats_record(STATS_LOOKUP, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_lookup */
 
-int tagfs_link(const char *path, const char *newpath) {
-	int retstat = 0;
+/*
+ * Forget about an inode
+ *
+ * The kernel takes back nlookup lookups of the inode, once it dropped the inode
+ * from its caches.
+ */
+void tagfs_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	inode_forget(ino, nlookup);
+	fuse_reply_none(req);
 
+	stats_record(STATS_FORGET, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_forget */
 
-int tagfs_chmod(const char *path, mode_t mode) {
+/*
+ * Get file attributes
+ *
+ * fi is for future use, currently always NULL.
+ */
+void tagfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	int retstat = 0;
+	struct stat statbuf;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	INFO("Retrieving attributes for inode %lu", ino);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	arena_begin();
+	retstat = inode_getattr(ino, &statbuf);
+	arena_end();
 
+	if(retstat == 0) {
+		fuse_reply_attr(req, &statbuf, TAGFS_DATA->attr_timeout);
+	} else {
+		fuse_reply_err(req, -retstat);
+	}
+
+	stats_record(STATS_GETATTR, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_getattr */
 
-int tagfs_chown(const char *path, uid_t uid, gid_t gid) {
+/**
+ * Apply changed attributes to the backing file of a file: permissions, owner,
+ * size and times, in that order, as setattr hands them in. Stops at the first
+ * change which fails.
+ *
+ * @param fd The backing file descriptor of an open file, or -1 to change the file by its location.
+ * @param file_location The location of the backing file, used when fd is -1.
+ * @param attr The new attributes.
+ * @param to_set The FUSE_SET_ATTR_ flags of the attributes to change.
+ * @return 0 on success, or a negated errno value.
+ */
+static int file_setattr(int fd, const char *file_location, const struct stat *attr, int to_set) {
+	gid_t gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1;
 	int retstat = 0;
+	struct timespec times[2] = { { 0, UTIME_OMIT }, { 0, UTIME_OMIT } };
+	uid_t uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1;
 
-	DEBUG(ENTRY);
+	if(to_set & FUSE_SET_ATTR_MODE) {
+		retstat = fd >= 0 ? fchmod(fd, attr->st_mode & 07777) : chmod(file_location, attr->st_mode & 07777);
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	if(retstat == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+		retstat = fd >= 0 ? fchown(fd, uid, gid) : chown(file_location, uid, gid);
+	}
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	if(retstat == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+		retstat = fd >= 0 ? ftruncate(fd, attr->st_size) : truncate(file_location, attr->st_size);
+	}
 
-int tagfs_truncate(const char *path, off_t newsize) {
-	int retstat = 0;
+	if(to_set & FUSE_SET_ATTR_ATIME) {
+		times[0] = attr->st_atim;
+	}
 
-	DEBUG(ENTRY);
+	if(to_set & FUSE_SET_ATTR_ATIME_NOW) {
+		times[0].tv_nsec = UTIME_NOW;
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	if(to_set & FUSE_SET_ATTR_MTIME) {
+		times[1] = attr->st_mtim;
+	}
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	if(to_set & FUSE_SET_ATTR_MTIME_NOW) {
+		times[1].tv_nsec = UTIME_NOW;
+	}
+
+	if(retstat == 0 && (times[0].tv_nsec != UTIME_OMIT || times[1].tv_nsec != UTIME_OMIT)) {
+		retstat = fd >= 0 ? futimens(fd, times) : utimensat(AT_FDCWD, file_location, times, 0);
+	}
+
+	return retstat < 0 ? -errno : 0;
+} /* file_setattr */
 
-int tagfs_utime(const char *path, struct utimbuf *ubuf) {
+/*
+ * Set file attributes
+ *
+ * The permissions, owner, size and times of a file are changed on its backing
+ * file. fi is set when an open file is changed, e.g. by ftruncate() or
+ * fchmod(). If an application opens a file with O_TRUNC, the kernel first
+ * changes its size and then opens it. Folders have no backing directory, and
+ * the statistics are read-only, so their attributes cannot be changed.
+ */
+void tagfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi) {
+	char *file_location = NULL;
+	int file_id = inode_file_id(ino);
 	int retstat = 0;
+	struct stat statbuf;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	INFO("Setting attributes %#x of inode %lu", to_set, ino);
+
+	arena_begin();
+
+	if(to_set == 0) {
+		/* nothing to change, reply with the current attributes */
+	} else if(ino == INODE_STATS_DIR || ino == INODE_STATS_FILE) {
+		retstat = -EACCES;
+	} else if(file_id <= 0) {
+		retstat = (to_set & FUSE_SET_ATTR_SIZE) ? -EISDIR : -EPERM;
+	} else if(fi != NULL) {
+		retstat = file_setattr(HANDLE_FROM_FH(fi->fh)->fd, NULL, attr, to_set);
+
+		if(retstat < 0) {
+			WARN("Setting attributes of open file ID %d failed", file_id);
+		}
+	} else {
+		tag_read_lock();
+		file_location = get_file_location(file_id);
+		tag_unlock();
+
+		if(file_location == NULL) {
+			retstat = -ENOENT;
+		} else {
+			retstat = file_setattr(-1, file_location, attr, to_set);
+
+			if(retstat < 0) {
+				WARN("Setting attributes of file %s failed", file_location);
+			}
+
+			free_single_ptr((void **)&file_location);
+		}
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	if(retstat == 0) {
+		retstat = inode_getattr(ino, &statbuf);
+	}
+
+	arena_end();
 
+	if(retstat == 0) {
+		fuse_reply_attr(req, &statbuf, TAGFS_DATA->attr_timeout);
+	} else {
+		fuse_reply_err(req, -retstat);
+	}
+
+	stats_record(STATS_SETATTR, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_setattr */
 
 /*
- * File open operation
+ * Remove a file
  *
- * No creation (O_CREAT, O_EXCL) and by default also no truncation (O_TRUNC)
- * flags will be passed to open(). If an application specifies O_TRUNC,
- * fuse first calls truncate() and then open(). Only if 'atomic_o_trunc' has
- * been specified and kernel version is 2.6.24 or later, O_TRUNC is passed on
- * to open.
- *
- * Unless the 'default_permissions' mount option is given, open should check if
- * the operation is permitted for the given flags. Optionally open may also
- * return an arbitrary filehandle in the fuse_file_info structure, which will
- * be passed to all file operations.
- *
- * Changed in version 2.2
+ * Removing a file from a folder takes its tags away. Removing it at the root
+ * deletes it, along with the backing file TagFS created for it, if any. Open
+ * handles keep reading and writing the unlinked backing file until released.
  */
-int tagfs_open(const char *path, struct fuse_file_info *fi) {
-	char *file_location = NULL;
-	int fd = 0;
+void tagfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+	char *backing_file = NULL;
+	char *path = NULL;
 	int file_id = 0;
 	int retstat = 0;
+	struct db_batch *batch = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
-	INFO("Opening file: %s", path);
 
-	file_id = file_id_from_path(path);
-	file_location = get_file_location(file_id);
+	arena_begin();
 
-	fd = open(file_location, fi->flags);
+	tag_write_lock();
 
-	if(fd < 0) {
-		WARN("Opening file %s failed", file_location);
-		retstat = -errno;
+	path = child_path(parent, name);
+
+	if(path == NULL) {
+		retstat = -ENOENT;
+	} else if(stats_path(path)) {
+		retstat = -EACCES;
+	} else {
+		INFO("Deleting %s", path);
+		file_id = file_id_from_path(path);
+
+		if(file_id > 0) {
+			batch = db_batch_begin();
+
+			if(parent == INODE_ROOT) {
+				backing_file = db_get_backing_file(file_id); /* while its row is still there */
+				remove_file(batch, file_id);
+			} else if(remove_tags(batch, file_id)) {
+				db_batch_delete_empty_tags(batch);
+			}
+
+			if(!db_batch_commit(&batch)) {
+				retstat = -EIO;
+			} else if(backing_file != NULL && unlink(backing_file) < 0) {
+				WARN("Unable to delete backing file %s", backing_file);
+			}
+
+			if(backing_file != NULL) {
+				free_single_ptr((void **)&backing_file);
+			}
+		} else {
+			retstat = -ENOENT;
+		}
 	}
 
-	free_single_ptr((void **)&file_location);
-	fi->fh = fd;
+	tag_unlock();
+
+	arena_end();
 
+	fuse_reply_err(req, -retstat);
+
+	stats_record(STATS_UNLINK, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_unlink */
 
 /*
- * Read data from an open file
- *
- * Read should return exactly the number of bytes requested except on EOF or
- * error, otherwise the rest of the data will be substituted with zeroes. An
- * exception to this is when the 'direct_io' mount option is specified, in
- * which case the return value of the read system call will reflect the return
- * value of this operation.
+ * Rename a file
  *
- * Changed in version 2.2
+ * The file loses all of its tags and takes on the tags of the new folder.
  */
-int tagfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-	char *file_location = NULL;
-	int fd = 0;
+void tagfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname) {
+	bool emptied = false;
+	char *newpath = NULL;
+	char *path = NULL;
+	int *tags = NULL;
 	int file_id = 0;
+	int i = 0;
+	int num_tags = 0;
 	int retstat = 0;
+	struct db_batch *batch = NULL;
+	struct path_view new_view;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
-	INFO("Reading %s", path);
 
-	file_id = file_id_from_path(path);
-	file_location = get_file_location(file_id);
-	fd = open(file_location, O_RDONLY);
-	free_single_ptr((void **)&file_location);
-	retstat = pread(fd, buf, size, offset);
+	arena_begin();
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	tag_write_lock();
 
-int tagfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-	int retstat = 0;
+	path = child_path(parent, name);
+	newpath = child_path(newparent, newname);
 
-	DEBUG(ENTRY);
+	if(path == NULL || newpath == NULL) {
+		retstat = -ENOENT;
+	} else if(stats_path(path) || stats_path(newpath)) {
+		retstat = -EACCES;
+	} else {
+		INFO("Moving %s to %s", path, newpath);
 
-	ERROR("TODO: %s", __FUNCTION__);
+		file_id = file_id_from_path(path);
+		num_tags = path_split(newpath, &new_view);
+		num_tags -= num_tags > 0; /* the last element is the file name */
 
-	DEBUG(EXIT);
-	return retstat;
-}
+		if(num_tags > 0) { /* deleting will put the file at root. Nothing to add */
+			tags = arena_alloc(num_tags * sizeof(*tags));
 
-int tagfs_statfs(const char *path, struct statvfs *statv) {
-	int retstat = 0;
+			/* resolve every tag first, so that a bad destination changes nothing */
+			for(i = 0; i < num_tags; i++) {
+				tags[i] = dict_tag_id_slice(path_tag(&new_view, i), path_tag_length(&new_view, i));
 
-	DEBUG(ENTRY);
+				if(tags[i] <= 0) {
+					retstat = -ENOENT;
+				}
+			}
+		}
 
-	ERROR("TODO: %s", __FUNCTION__);
+		if(file_id <= 0) {
+			retstat = -ENOENT;
+		}
+	}
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	if(retstat == 0) {
+		batch = db_batch_begin();
+		emptied = remove_tags(batch, file_id);
 
-int tagfs_flush(const char *path, struct fuse_file_info *fi) {
-	int retstat = 0;
+		for(i = 0; i < num_tags; i++) {
+			add_tag_to_file(batch, tags[i], file_id);
+		}
 
-	DEBUG(ENTRY);
+		if(emptied) { /* after the new tags, which may include the emptied one */
+			db_batch_delete_empty_tags(batch);
+		}
+
+		if(!db_batch_commit(&batch)) {
+			retstat = -EIO;
+		}
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	tag_unlock();
 
+	arena_end();
+
+	fuse_reply_err(req, -retstat);
+
+	stats_record(STATS_RENAME, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_rename */
 
-int tagfs_release(const char *path, struct fuse_file_info *fi) {
+/*
+ * File open operation
+ *
+ * No creation (O_CREAT, O_EXCL) and by default also no truncation (O_TRUNC)
+ * flags will be passed to open(), see tagfs_setattr(). The handle stored in
+ * fi->fh is passed to all file operations.
+ */
+void tagfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	char *file_location = NULL;
+	int file_id = inode_file_id(ino);
 	int retstat = 0;
+	struct file_handle *handle = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	INFO("Opening inode %lu", ino);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	arena_begin();
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	if(ino == INODE_STATS_FILE) {
+		retstat = virtual_open(STATS_FILE, fi);
+	} else if(file_id <= 0) {
+		retstat = -EISDIR;
+	} else {
+		tag_read_lock();
+		file_location = get_file_location(file_id);
+		tag_unlock();
 
-int tagfs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
-	int retstat = 0;
+		if(file_location == NULL) {
+			retstat = -ENOENT;
+		} else {
+			retstat = handle_open(file_id, file_location, fi->flags, &handle);
+			free_single_ptr((void **)&file_location);
+		}
 
-	DEBUG(ENTRY);
+		if(retstat == 0) {
+			fi->fh = HANDLE_TO_FH(handle);
+		}
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	arena_end();
 
+	if(retstat != 0) {
+		fuse_reply_err(req, -retstat);
+	} else if(fuse_reply_open(req, fi) != 0) { /* the open was interrupted, no release will follow */
+		handle_release(HANDLE_FROM_FH(fi->fh));
+	}
+
+	stats_record(STATS_OPEN, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_open */
 
-int tagfs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
-	int retstat = 0;
+/*
+ * Read data from an open file
+ *
+ * The reply describes the backing file descriptor and offset rather than
+ * holding the data, so libfuse can splice the pages from the backing file to
+ * the kernel without copying them through this process. Where splicing is not
+ * possible, libfuse reads the data itself.
+ */
+void tagfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi) {
+	struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	DEBUG("Reading %zu bytes from inode %lu at offset %lld", size, ino, (long long)offset);
+
+	src.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	src.buf[0].fd = HANDLE_FROM_FH(fi->fh)->fd;
+	src.buf[0].pos = offset;
 
-	ERROR("TODO: %s", __FUNCTION__);
+	fuse_reply_data(req, &src, FUSE_BUF_SPLICE_MOVE);
 
+	stats_record(STATS_READ, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_read */
 
-int tagfs_getxattr(const char *path, const char *name, char *value, size_t size) {
+/*
+ * Write data to an open file
+ *
+ * Write should return exactly the number of bytes requested except on error.
+ */
+void tagfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
 	int retstat = 0;
+	ssize_t written = 0;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	DEBUG("Writing %zu bytes to inode %lu at offset %lld", size, ino, (long long)offset);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	written = pwrite(HANDLE_FROM_FH(fi->fh)->fd, buf, size, offset);
 
+	if(written < 0) {
+		retstat = -errno; /* before logging, which may change errno */
+		WARN("Writing to inode %lu failed", ino);
+		fuse_reply_err(req, -retstat);
+	} else {
+		fuse_reply_write(req, written);
+	}
+
+	stats_record(STATS_WRITE, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_write */
 
-int tagfs_listxattr(const char *path, char *list, size_t size) {
-	int retstat = 0;
+/*
+ * Possibly flush cached data
+ *
+ * Called on each close() of a file descriptor, so it may be called several
+ * times per open.
+ */
+void tagfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	/* reads and writes go straight to the backing file, so there is nothing buffered to flush */
+	fuse_reply_err(req, 0);
 
+	stats_record(STATS_FLUSH, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_flush */
 
-int tagfs_removexattr(const char *path, const char *name) {
+/*
+ * Release an open file
+ *
+ * Release is called when there are no more references to an open file: all
+ * file descriptors are closed and all memory mappings are unmapped.
+ */
+void tagfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	int retstat = 0;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	INFO("Releasing inode %lu", ino);
+
+	retstat = handle_release(HANDLE_FROM_FH(fi->fh));
+	fi->fh = 0;
 
-	ERROR("TODO: %s", __FUNCTION__);
+	fuse_reply_err(req, -retstat);
 
+	stats_record(STATS_RELEASE, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_release */
 
-int tagfs_opendir(const char *path, struct fuse_file_info *fi) {
+/*
+ * Synchronize file contents
+ *
+ * If the datasync parameter is non-zero, then only the user data should be
+ * flushed, not the meta data.
+ */
+void tagfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+	int fd = HANDLE_FROM_FH(fi->fh)->fd;
 	int retstat = 0;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	INFO("Synchronizing inode %lu", ino);
+
+	retstat = datasync ? fdatasync(fd) : fsync(fd);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	if(retstat < 0) {
+		retstat = -errno;
+		WARN("Synchronizing inode %lu failed", ino);
+	}
 
+	fuse_reply_err(req, -retstat);
+
+	stats_record(STATS_FSYNC, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_fsync */
 
 /**
- * Read directory
- *
- * This supersedes the old getdir() interface. New applications should use this.
- *
- * The filesystem may choose between two modes of operation:
+ * A directory listing, built once by opendir and handed out piece by piece by
+ * readdir, so the kernel sees one consistent listing however many readdir
+ * calls it takes.
+ */
+struct dir_listing {
+	char *entries; /* laid out by fuse_add_direntry() */
+	size_t size; /* bytes of entries in use */
+	size_t capacity; /* bytes of entries allocated */
+};
+
+#define LISTING_TO_FH(listing) ((uint64_t)(uintptr_t)(listing))
+#define LISTING_FROM_FH(fh) ((struct dir_listing *)(uintptr_t)(fh))
+
+/**
+ * Append an entry to a directory listing. Only the inode number and the type
+ * of an entry are passed to the kernel.
  *
- * 1) The readdir implementation ignores the offset parameter, and passes zero 
- * to the filler function's offset. The filler function will not return '1' 
- * (unless an error happens), so the whole directory is read in a single readdir * operation. This works just like the old getdir() method.
+ * @param req The request the listing is built for.
+ * @param listing The listing.
+ * @param name The name of the entry.
+ * @param ino The inode number of the entry.
+ * @param type S_IFDIR or S_IFREG.
+ */
+static void listing_add(fuse_req_t req, struct dir_listing *listing, const char *name, fuse_ino_t ino, mode_t type) {
+	size_t size = 0;
+	struct stat statbuf;
+
+	memset(&statbuf, 0, sizeof(statbuf));
+	statbuf.st_ino = ino;
+	statbuf.st_mode = type;
+
+	size = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+
+	if(listing->size + size > listing->capacity) {
+		listing->capacity = listing->capacity > 0 ? listing->capacity * 2 : 4096;
+
+		if(listing->capacity < listing->size + size) {
+			listing->capacity = listing->size + size;
+		}
+
+		listing->entries = realloc(listing->entries, listing->capacity);
+		assert(listing->entries != NULL);
+	}
+
+	/* the offset of an entry is where the next one starts */
+	fuse_add_direntry(req, listing->entries + listing->size, size, name, &statbuf, listing->size + size);
+	listing->size += size;
+} /* listing_add */
+
+/**
+ * What readdir_fill() needs to add names to a directory listing.
+ */
+struct readdir_state {
+	fuse_req_t req;
+	struct dir_listing *listing;
+	char **path_array; /* names to leave out of the listing */
+	int path_count;
+	bool folders; /* true while adding folders, false while adding files */
+	uint64_t folder_key; /* of the folder being listed, see inode_folder_key() */
+};
+
+/**
+ * Add a name read by a batched name lookup to a directory listing.
  *
- * 2) The readdir implementation keeps track of the offsets of the directory 
- * entries. It uses the offset parameter and always passes non-zero offset to 
- * the filler function. When the buffer is full (or an error happens) the filler * function will return '1'.
+ * @param data The struct readdir_state of the listing.
+ * @param id The ID of the file or tag, from which the inode number of the entry is derived.
+ * @param name The name to add.
+ * @return 0, to continue with the next name.
+ */
+static int readdir_fill(void *data, int id, const char *name) {
+	struct readdir_state *state = data;
+
+	if(array_contains_string((const char **)state->path_array, name, state->path_count)) {
+		return 0;
+	}
+
+	if(state->folders) {
+		listing_add(state->req, state->listing, name, inode_of_folder(inode_folder_key_add(state->folder_key, id)), S_IFDIR);
+	} else {
+		listing_add(state->req, state->listing, name, inode_of_file(id), S_IFREG);
+	}
+
+	return 0;
+} /* readdir_fill */
+
+/**
+ * List a folder: the files carrying all of its tags, then the tags to narrow
+ * it down further. Must be called with the tag lock held.
  *
- * Introduced in version 2.3
- */ 
-int tagfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
-	char **path_array = NULL;
-	char *file_name = NULL;
-	char *folder_name = NULL;
+ * @param req The request the listing is built for.
+ * @param ino The inode number of the folder.
+ * @param path The path of the folder.
+ * @param listing The listing to add the entries to.
+ */
+static void folder_listing(fuse_req_t req, fuse_ino_t ino, const char *path, struct dir_listing *listing) {
 	int *files = NULL;
 	int *folders = NULL;
-	int file_id = 0;
-	int filler_ret = 0;
-	int i = 0;
 	int num_files = 0;
 	int num_folders = 0;
-	int path_count = 0;
-	int retstat = 0;
-	int tag_id = 0;
+	struct readdir_state state;
 
-	DEBUG(ENTRY);
-	INFO("Reading directory %s", path);
+	listing_add(req, listing, ".", ino, S_IFDIR);
+	listing_add(req, listing, "..", INODE_ROOT, S_IFDIR); /* a folder is reached from many folders, so this is only a placeholder */
 
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
+	if(ino == INODE_ROOT) {
+		listing_add(req, listing, STATS_DIR_NAME, INODE_STATS_DIR, S_IFDIR);
+	}
+
+	state.req = req;
+	state.listing = listing;
+	state.path_array = NULL;
+	state.path_count = 0;
+	state.folders = false;
+	state.folder_key = 0;
 
 	/* add files */
 	num_files = files_at_location(path, &files);
+	db_file_names_from_ids(files, num_files, readdir_fill, &state);
 
-	if(num_files > 0) {
-		for(i = 0; i < num_files; i++) {
-			file_id = files[i];
-			file_name = file_name_from_id(file_id);
+	/* if there are files at the requested location, or we are at root, show folders */
+	if(num_files > 0 || ino == INODE_ROOT) {
+		/* add folders */
+		num_folders = folders_at_location(path, files, num_files, &folders);
 
-			filler_ret = filler(buf, file_name, NULL, 0);
-			if(filler_ret != 0) {
-				DEBUG("filler returned %d", filler_ret);
-				WARN("An error occured while loading files. Out of memory?");
-				retstat = -ENOMEM;
-			}
+		if(num_folders > 0) {
+			state.path_count = path_to_array(path, &state.path_array); /* tags in the path are filtered out */
+			state.folders = true;
+			state.folder_key = inode_folder_key(path);
+			dict_tag_names_from_ids(folders, num_folders, readdir_fill, &state);
 
-			free_single_ptr((void **)&file_name);
+			free_single_ptr((void **)&folders);
 		}
 	}
 
-	/* if there are files at the requested location, or we are at root, show folders */
-	if(num_files > 0 || strcmp("/", path) == 0) {
-		/* add folders */
-		num_folders = folders_at_location(path, files, num_files, &folders);
+	if(files != NULL) /* if at root with no files */ {
+		free_single_ptr((void **)&files);
+	}
+} /* folder_listing */
 
-		if(files != NULL) /* if at root with no files */ {
-			free_single_ptr((void **)&files);
-		}
+/*
+ * Open directory
+ *
+ * The whole listing is built here and kept in fi->fh until releasedir.
+ */
+void tagfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	char *path = NULL;
+	int retstat = 0;
+	struct dir_listing *listing = NULL;
+	uint64_t started = stats_now();
 
-		if(num_folders > 0) {
-			path_count = path_to_array(path, &path_array);
+	DEBUG(ENTRY);
+	INFO("Opening directory inode %lu", ino);
 
-			for(i = 0; i < num_folders; i++) {
-				tag_id = folders[i];
-				folder_name = tag_name_from_tag_id(tag_id);
+	listing = calloc(1, sizeof(*listing));
+	assert(listing != NULL);
 
-				/* filter tags out of path */
-				if(!array_contains_string((const char **)path_array, folder_name, path_count)) {
-					filler_ret = filler(buf, folder_name, NULL, 0);
-				}
+	if(ino == INODE_STATS_FILE || inode_file_id(ino) > 0) {
+		retstat = -ENOTDIR;
+	} else if(ino == INODE_STATS_DIR) {
+		listing_add(req, listing, ".", INODE_STATS_DIR, S_IFDIR);
+		listing_add(req, listing, "..", INODE_ROOT, S_IFDIR);
+		listing_add(req, listing, STATS_FILE_NAME, INODE_STATS_FILE, S_IFREG);
+	} else {
+		arena_begin();
 
-				free_single_ptr((void **)&folder_name);
+		tag_read_lock();
 
-				if(filler_ret != 0) {
-					DEBUG("filler returned %d", filler_ret);
-					WARN("An error occured while loading tags. Out of memory?");
-					retstat = -ENOMEM;
-				}
-			}
+		path = inode_folder_path(ino);
 
-			free_single_ptr((void **)&folders);
+		if(path != NULL && valid_path_to_folder(path)) {
+			folder_listing(req, ino, path, listing);
+		} else {
+			retstat = -ENOENT;
+		}
 
-			if(path_array != NULL) {
-				free_double_ptr((void ***)&path_array, path_count);
-			}
+		tag_unlock();
+
+		arena_end();
+	}
+
+	if(retstat == 0) {
+		fi->fh = LISTING_TO_FH(listing);
+	}
+
+	if(retstat != 0 || fuse_reply_open(req, fi) != 0) {
+		if(retstat != 0) {
+			fuse_reply_err(req, -retstat);
 		}
+
+		free(listing->entries);
+		free(listing);
 	}
 
+	stats_record(STATS_OPENDIR, started);
 	DEBUG(EXIT);
-	return retstat;
-} /* tagfs_readdir */
+} /* tagfs_opendir */
 
-int tagfs_releasedir(const char *path, struct fuse_file_info *fi) {
-	int retstat = 0;
+/*
+ * Read directory
+ *
+ * Hands out the part of the listing built by opendir which starts at offset.
+ * The kernel keeps the entries which fit in size bytes, and asks again from
+ * the offset of the first one which did not.
+ */
+void tagfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi) {
+	struct dir_listing *listing = LISTING_FROM_FH(fi->fh);
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
+	DEBUG("Reading directory inode %lu from offset %lld", ino, (long long)offset);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	if(offset < 0 || (size_t)offset >= listing->size) {
+		fuse_reply_buf(req, NULL, 0);
+	} else {
+		fuse_reply_buf(req, listing->entries + offset, listing->size - offset < size ? listing->size - offset : size);
+	}
 
+	stats_record(STATS_READDIR, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_readdir */
 
-int tagfs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi) {
-	int retstat = 0;
+/*
+ * Release an open directory
+ */
+void tagfs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	struct dir_listing *listing = LISTING_FROM_FH(fi->fh);
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	free(listing->entries);
+	free(listing);
+	fi->fh = 0;
 
+	fuse_reply_err(req, 0);
+
+	stats_record(STATS_RELEASEDIR, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_releasedir */
 
 /*
  * Initialize filesystem
  *
- * The return value will passed in the private_data field of fuse_context to all
- * file operations and as a parameter to the destroy() method.
- *
- * Introduced in version 2.3 Changed in version 2.6
+ * userdata is the filesystem state passed to fuse_lowlevel_new(). From here on
+ * it is reached through TAGFS_DATA.
  */
-void *tagfs_init(struct fuse_conn_info *conn) {
+void tagfs_init(void *userdata, struct fuse_conn_info *conn) {
 	const char *db_name = "tagfs.sl3";
+	const char *files_name = "Files";
 	const char *log_name = "log_file.txt";
 	const char *log_path = NULL;
 	int db_dir_length = 0;
 	int dir_length = 0;
+	int files_dir_length = 0;
 	int log_dir_length = 0;
 	int written = 0; /* number of characters written by snprintf */
 
+	tagfs_data = userdata;
+
 	/* get directory length */
 	dir_length = strlen(TAGFS_DATA->exec_dir) + strlen("/");
 
@@ -526,129 +1072,356 @@ void *tagfs_init(struct fuse_conn_info *conn) {
 	printf("Opening log file: %s\n", log_path);
 	TAGFS_DATA->log_file = fopen(log_path, "w");
 
+	if(TAGFS_DATA->log_file != NULL) {
+		debug_start(TAGFS_DATA->log_file);
+	} else {
+		fprintf(stderr, "Unable to open %s, nothing will be logged\n", log_path);
+	}
+
 	DEBUG(ENTRY);
 
+	/* set the directory new files are created in */
+	files_dir_length = strlen(files_name) + dir_length;
+	TAGFS_DATA->files_dir = malloc(files_dir_length * sizeof(*TAGFS_DATA->files_dir) + 1);
+	written = snprintf((char *)TAGFS_DATA->files_dir, files_dir_length + 1, "%s/%s", TAGFS_DATA->exec_dir, files_name);
+	assert(written == files_dir_length);
+
+	if(mkdir(TAGFS_DATA->files_dir, 0755) < 0 && errno != EEXIST) {
+		WARN("Unable to create %s. Files cannot be created until it exists.", TAGFS_DATA->files_dir);
+	}
+
 	/* set database path */
 	db_dir_length = strlen(db_name) + dir_length;
 	TAGFS_DATA->db_path = malloc(db_dir_length * sizeof(*TAGFS_DATA->db_path) + 1);
 	written = snprintf((char *)TAGFS_DATA->db_path, db_dir_length + 1, "%s/%s", TAGFS_DATA->exec_dir, db_name);
 	assert(written == db_dir_length);
-	
+
 	free_single_ptr((void **)&log_path);
 
+	/* let libfuse splice read replies from the backing files to the kernel */
+	conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
+	stats_init();
+	arena_init();
+	tag_lock_init();
+	db_init();
+	dict_init();
+	folder_cache_init();
+	index_init();
+	cooccur_init();
+	path_cache_init();
+	handle_table_init();
+	inode_table_init();
+
 	DEBUG(EXIT);
-	return TAGFS_DATA;
 } /* tagfs_init */
 
 /*
  * Clean up filesystem
  *
  * Called on filesystem exit.
- *
- * Introduced in version 2.3
  */
- void tagfs_destroy(void *userdata) {
+void tagfs_destroy(void *userdata) {
 	struct tagfs_state *tagfs_data = (struct tagfs_state *)userdata;
 
 	DEBUG(ENTRY);
 	INFO("Finalizing data...");
 
+	inode_table_destroy();
+	handle_table_destroy();
+	path_cache_destroy();
+	cooccur_destroy();
+	index_destroy();
+	folder_cache_destroy();
+	dict_destroy();
+	db_destroy();
+	tag_lock_destroy();
+	arena_destroy();
+	stats_destroy();
 	free_single_ptr((void **)&tagfs_data->exec_dir);
 	free_single_ptr((void **)&tagfs_data->db_path);
+	free_single_ptr((void **)&tagfs_data->files_dir);
 
 	DEBUG(EXIT);
 
-	assert(tagfs_data->log_file != NULL);
-	fclose(tagfs_data->log_file);
-	tagfs_data->log_file = NULL;
+	debug_stop();
+
+	if(tagfs_data->log_file != NULL) {
+		fclose(tagfs_data->log_file);
+		tagfs_data->log_file = NULL;
+	}
 } /* tagfs_destroy */
 
-int tagfs_access(const char *path, int mask) {
+/*
+ * Create and open a file
+ *
+ * If the file does not exist, first create it with the specified mode, and
+ * then open it. The file is tagged with the tags of the folder it is created
+ * in.
+ */
+void tagfs_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi) {
+	char *file_location = NULL;
+	char *path = NULL;
+	int *tags = NULL;
+	int file_id = 0;
+	int file_location_length = 0;
+	int i = 0;
+	int num_tags = 0;
+	int num_tokens = 0;
 	int retstat = 0;
+	int tag_id = 0;
+	int written = 0; /* number of characters written by snprintf */
+	struct file_handle *handle = NULL;
+	struct fuse_entry_param entry;
+	struct path_view view;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	ERROR("TODO: %s", __FUNCTION__);
+	memset(&entry, 0, sizeof(entry));
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	arena_begin();
 
-int tagfs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
-	int retstat = 0;
+	/* new files are kept flat in the files directory, under a unique name, since files under different tags may share a name */
+	file_location_length = strlen(TAGFS_DATA->files_dir) + strlen("/" TAGFS_BACKING_TEMPLATE);
+	file_location = arena_alloc(file_location_length * sizeof(*file_location) + 1);
+	written = snprintf(file_location, file_location_length + 1, "%s/%s", TAGFS_DATA->files_dir, TAGFS_BACKING_TEMPLATE);
+	assert(written == file_location_length);
 
-	DEBUG(ENTRY);
+	tag_write_lock();
 
-	ERROR("TODO: %s", __FUNCTION__);
+	path = child_path(parent, name);
 
-	DEBUG(EXIT);
-	return retstat;
-}
+	if(path == NULL) {
+		retstat = -ENOENT;
+	} else if(stats_path(path)) {
+		retstat = -EACCES;
+	} else {
+		INFO("Creating %s", path);
 
-int tagfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
-	int retstat = 0;
+		num_tokens = path_split(path, &view);
+		num_tokens -= num_tokens > 0; /* the last element is the file name */
+		tags = arena_alloc((num_tokens > 0 ? num_tokens : 1) * sizeof(*tags));
 
-	DEBUG(ENTRY);
+		/* the file is tagged with every tag of the folder it is created in */
+		path_distinct_tags(&view);
 
-	ERROR("TODO: %s", __FUNCTION__);
+		for(i = 0; i < num_tokens && retstat == 0; i++) {
+			if(view.repeated[i]) { /* tagged once, however often the tag repeats */
+				continue;
+			}
 
-	DEBUG(EXIT);
-	return retstat;
-}
+			tag_id = dict_tag_id_slice(path_tag(&view, i), path_tag_length(&view, i));
 
-int tagfs_fgetattr(const char *path, struct stat *statbuf, struct fuse_file_info *fi) {
-	int retstat = 0;
+			if(tag_id > 0) {
+				tags[num_tags++] = tag_id;
+			} else {
+				retstat = -ENOENT;
+			}
+		}
+	}
 
-	DEBUG(ENTRY);
+	if(retstat == 0) {
+		retstat = handle_create(file_location, fi->flags, mode, &handle);
+	}
 
-	ERROR("TODO: %s", __FUNCTION__);
+	if(retstat == 0) {
+		file_id = db_create_file(TAGFS_DATA->files_dir, name, file_location + strlen(TAGFS_DATA->files_dir) + 1, tags, num_tags);
+
+		if(file_id > 0) {
+			handle->file_id = file_id;
+			fi->fh = HANDLE_TO_FH(handle);
+		} else {
+			WARN("Unable to add %s to the database", path);
+			handle_release(handle);
+			unlink(file_location);
+			retstat = -EIO;
+		}
+	}
 
+	tag_unlock();
+
+	if(retstat == 0 && fstat(handle->fd, &entry.attr) < 0) {
+		retstat = -errno;
+		WARN("Reading information from new file %s failed", file_location);
+		handle_release(handle);
+	}
+
+	arena_end();
+
+	if(retstat == 0) {
+		entry.ino = inode_of_file(file_id);
+		entry.attr.st_ino = entry.ino;
+		entry.attr_timeout = TAGFS_DATA->attr_timeout;
+		entry.entry_timeout = TAGFS_DATA->entry_timeout;
+
+		if(fuse_reply_create(req, &entry, fi) != 0) { /* the create was interrupted, no release will follow */
+			handle_release(handle);
+		}
+	} else {
+		fuse_reply_err(req, -retstat);
+	}
+
+	stats_record(STATS_CREATE, started);
 	DEBUG(EXIT);
-	return retstat;
-}
+} /* tagfs_create */
 
-/* TODO: Implement these */
-struct fuse_operations tagfs_oper = {
+/* TODO: Implement mknod, mkdir, rmdir, link, statfs, the xattr operations and
+ * access. libfuse answers them with ENOSYS, or a default. */
+struct fuse_lowlevel_ops tagfs_oper = {
+	.init = tagfs_init,
+	.destroy = tagfs_destroy,
+	.lookup = tagfs_lookup,
+	.forget = tagfs_forget,
 	.getattr = tagfs_getattr,
-	.mknod = tagfs_mknod,
-	.mkdir = tagfs_mkdir,
+	.setattr = tagfs_setattr,
 	.unlink = tagfs_unlink,
-	.rmdir = tagfs_rmdir,
 	.rename = tagfs_rename,
-	.link = tagfs_link,
-	.chmod = tagfs_chmod,
-	.chown = tagfs_chown,
-	.truncate = tagfs_truncate,
-	.utime = tagfs_utime,
 	.open = tagfs_open,
 	.read = tagfs_read,
 	.write = tagfs_write,
-	.statfs = tagfs_statfs,
 	.flush = tagfs_flush,
 	.release = tagfs_release,
 	.fsync = tagfs_fsync,
-	.setxattr = tagfs_setxattr,
-	.getxattr = tagfs_getxattr,
-	.listxattr = tagfs_listxattr,
-	.removexattr = tagfs_removexattr,
 	.opendir = tagfs_opendir,
 	.readdir = tagfs_readdir,
 	.releasedir = tagfs_releasedir,
-	.fsyncdir = tagfs_fsyncdir,
-	.init = tagfs_init,
-	.destroy = tagfs_destroy,
-	.access = tagfs_access,
-	.create = tagfs_create,
-	.ftruncate = tagfs_ftruncate,
-	.fgetattr = tagfs_fgetattr
+	.create = tagfs_create
 };
 
+/* the benchmark drives tagfs_oper itself, see tagfs_bench.c */
+#ifndef TAGFS_BENCH
+
+/**
+ * Mount options, e.g. -o journal_mode=DELETE,log_level=debug. See struct
+ * tagfs_db_options and the README.
+ */
+#define TAGFS_OPT(templ, field) { templ, offsetof(struct tagfs_state, field), 0 }
+
+static const struct fuse_opt tagfs_opts[] = {
+	TAGFS_OPT("journal_mode=%s", db_options.journal_mode),
+	TAGFS_OPT("synchronous=%s", db_options.synchronous),
+	TAGFS_OPT("temp_store=%s", db_options.temp_store),
+	TAGFS_OPT("mmap_size=%lli", db_options.mmap_size),
+	TAGFS_OPT("cache_size=%i", db_options.cache_size),
+	TAGFS_OPT("log_level=%s", log_level),
+	TAGFS_OPT("entry_timeout=%lf", entry_timeout),
+	TAGFS_OPT("attr_timeout=%lf", attr_timeout),
+	TAGFS_OPT("negative_timeout=%lf", negative_timeout),
+	FUSE_OPT_END
+};
+
+static const char *journal_modes[] = { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF", NULL };
+static const char *synchronous_levels[] = { "OFF", "NORMAL", "FULL", "EXTRA", NULL };
+static const char *temp_stores[] = { "DEFAULT", "FILE", "MEMORY", NULL };
+
+/**
+ * Checks a mount option against the values it accepts. The value ends up in a
+ * PRAGMA statement, so nothing else may pass.
+ *
+ * @param name The name of the option, for the error message.
+ * @param value The value given.
+ * @param values The accepted values, terminated by NULL.
+ * @return True, if the value is accepted. False, otherwise.
+ */
+static bool valid_option(const char *name, const char *value, const char **values) {
+	int i = 0;
+
+	for(i = 0; values[i] != NULL; i++) {
+		if(strcasecmp(value, values[i]) == 0) {
+			return true;
+		}
+	}
+
+	fprintf(stderr, "tagfs: invalid value for %s: %s\n", name, value);
+	return false;
+} /* valid_option */
+
 int main(int argc, char *argv[]) {
-	struct tagfs_state tagfs_data;
+	char *mountpoint = NULL;
+	int foreground = 0;
+	int log_level = 0;
+	int multithreaded = 0;
+	int retstat = 1;
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_chan *chan = NULL;
+	struct fuse_session *session = NULL;
+	struct tagfs_state state;
 
 	debug_init();
-	sem_init(&sem, 0, 1);
-	tagfs_data.exec_dir = get_exec_dir(argv[0]);
+	state.exec_dir = get_exec_dir(argv[0]);
+
+	state.db_options.journal_mode = TAGFS_DB_JOURNAL_MODE;
+	state.db_options.synchronous = TAGFS_DB_SYNCHRONOUS;
+	state.db_options.temp_store = TAGFS_DB_TEMP_STORE;
+	state.db_options.mmap_size = TAGFS_DB_MMAP_SIZE;
+	state.db_options.cache_size = TAGFS_DB_CACHE_SIZE;
+	state.log_level = TAGFS_LOG_LEVEL;
+	state.entry_timeout = TAGFS_ENTRY_TIMEOUT;
+	state.attr_timeout = TAGFS_ATTR_TIMEOUT;
+	state.negative_timeout = TAGFS_NEGATIVE_TIMEOUT;
+
+	/* take out the tagfs options, and leave the rest to libfuse */
+	if(fuse_opt_parse(&args, &state, tagfs_opts, NULL) == -1) {
+		return 1;
+	}
+
+	if(!valid_option("journal_mode", state.db_options.journal_mode, journal_modes) ||
+			!valid_option("synchronous", state.db_options.synchronous, synchronous_levels) ||
+			!valid_option("temp_store", state.db_options.temp_store, temp_stores)) {
+		fuse_opt_free_args(&args);
+		return 1;
+	}
+
+	log_level = debug_level_from_name(state.log_level);
+
+	if(log_level < 0) {
+		fprintf(stderr, "tagfs: invalid value for log_level: %s\n", state.log_level);
+		fuse_opt_free_args(&args);
+		return 1;
+	}
+
+	debug_set_level(log_level);
+
+	if(fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1) {
+		fuse_opt_free_args(&args);
+		return 1;
+	}
+
+	if(mountpoint == NULL) {
+		fprintf(stderr, "tagfs: no mountpoint given\n");
+		fuse_opt_free_args(&args);
+		return 1;
+	}
+
+	chan = fuse_mount(mountpoint, &args);
 
-	return fuse_main(argc, argv, &tagfs_oper, &tagfs_data);
+	if(chan != NULL) {
+		session = fuse_lowlevel_new(&args, &tagfs_oper, sizeof(tagfs_oper), &state);
+
+		if(session != NULL) {
+			if(fuse_set_signal_handlers(session) != -1) {
+				fuse_session_add_chan(session, chan);
+
+				if(fuse_daemonize(foreground) != -1) {
+					retstat = multithreaded ? fuse_session_loop_mt(session) : fuse_session_loop(session);
+					retstat = retstat == -1 ? 1 : 0;
+				}
+
+				fuse_remove_signal_handlers(session);
+				fuse_session_remove_chan(chan);
+			}
+
+			fuse_session_destroy(session);
+		}
+
+		fuse_unmount(mountpoint, chan);
+	}
+
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+
+	return retstat;
 } /* main */
+
+#endif
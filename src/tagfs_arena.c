@@ -0,0 +1,167 @@
+#include "tagfs_arena.h"
+#include "tagfs_debug.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE 16384 /* bytes per chunk, enough for the temporaries of most requests */
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+/**
+ * Chunk of an arena. Allocations are carved from data in order.
+ */
+struct arena_chunk {
+	struct arena_chunk *next; /* the chunk filled before this one */
+	size_t used;
+	size_t size;
+	alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+/**
+ * Arena of one thread.
+ */
+struct arena {
+	struct arena_chunk *chunks; /* the chunk being filled first */
+	int depth; /* number of requests begun and not yet ended */
+};
+
+static pthread_key_t arena_key; /* struct arena of the calling thread */
+
+/**
+ * Free an arena and all of its chunks.
+ *
+ * @param data The struct arena of a thread.
+ */
+static void arena_free(void *data) {
+	struct arena *arena = data;
+	struct arena_chunk *next = NULL;
+
+	while(arena->chunks != NULL) {
+		next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+
+	free(arena);
+} /* arena_free */
+
+/**
+ * Returns the arena of the calling thread, creating it on first use.
+ *
+ * @return The arena.
+ */
+static struct arena *arena_thread() {
+	struct arena *arena = pthread_getspecific(arena_key);
+
+	if(arena == NULL) {
+		arena = calloc(1, sizeof(*arena));
+		assert(arena != NULL);
+		pthread_setspecific(arena_key, arena);
+	}
+
+	return arena;
+} /* arena_thread */
+
+void arena_init() {
+	DEBUG(ENTRY);
+
+	if(pthread_key_create(&arena_key, arena_free) != 0) {
+		ERROR("Unable to create the arena thread key");
+	}
+
+	DEBUG(EXIT);
+} /* arena_init */
+
+void arena_destroy() {
+	struct arena *arena = NULL;
+
+	DEBUG(ENTRY);
+
+	arena = pthread_getspecific(arena_key);
+
+	if(arena != NULL) {
+		pthread_setspecific(arena_key, NULL);
+		arena_free(arena);
+	}
+
+	pthread_key_delete(arena_key);
+
+	DEBUG(EXIT);
+} /* arena_destroy */
+
+void arena_begin() {
+	arena_thread()->depth++;
+} /* arena_begin */
+
+void arena_end() {
+	struct arena *arena = arena_thread();
+	struct arena_chunk *chunk = NULL;
+	struct arena_chunk *keep = NULL;
+	struct arena_chunk *next = NULL;
+
+	assert(arena->depth > 0);
+
+	if(--arena->depth > 0 || arena->chunks == NULL) {
+		return;
+	}
+
+	/* keep the largest chunk, so a thread serving big requests stops allocating */
+	for(keep = chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		keep = chunk->size > keep->size ? chunk : keep;
+	}
+
+	for(chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+
+		if(chunk != keep) {
+			free(chunk);
+		}
+	}
+
+	keep->next = NULL;
+	keep->used = 0;
+	arena->chunks = keep;
+} /* arena_end */
+
+void *arena_alloc(size_t size) {
+	size_t chunk_size = ARENA_CHUNK_SIZE;
+	struct arena *arena = arena_thread();
+	struct arena_chunk *chunk = arena->chunks;
+	void *memory = NULL;
+
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+	if(chunk == NULL || chunk->size - chunk->used < size) {
+		while(chunk_size < size) {
+			chunk_size *= 2;
+		}
+
+		chunk = malloc(sizeof(*chunk) + chunk_size);
+		assert(chunk != NULL);
+		chunk->next = arena->chunks;
+		chunk->used = 0;
+		chunk->size = chunk_size;
+		arena->chunks = chunk;
+	}
+
+	memory = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return memory;
+} /* arena_alloc */
+
+char *arena_strdup(const char *string) {
+	char *copy = NULL;
+	size_t length = 0;
+
+	assert(string != NULL);
+
+	length = strlen(string) + 1;
+	copy = arena_alloc(length);
+	memcpy(copy, string, length);
+
+	return copy;
+} /* arena_strdup */
@@ -0,0 +1,64 @@
+/**
+ * Per-request arena allocator. Every thread bump-allocates the temporaries of
+ * the request it is serving (split paths, directory and file names, tag ID
+ * arrays) from its own arena, and the whole arena is released in one step
+ * when the request is done, instead of every temporary being malloc'd and
+ * free'd on its own.
+ *
+ * A FUSE callback brackets its work with arena_begin() and arena_end().
+ * Memory from arena_alloc() stays valid until the outermost arena_end() of
+ * the thread, and must never be free'd. Anything which has to outlive the
+ * request, like a cache entry, must be copied out of the arena.
+ *
+ * @file tagfs_arena.h
+ * @author Keith Woelke
+ * @date 10/18/2026
+ */
+
+#ifndef TAGFS_ARENA_H
+#define TAGFS_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Set up the per-thread arenas. Must be called once from tagfs_init, before
+ * any request is served.
+ */
+void arena_init();
+
+/**
+ * Free the arena of the calling thread. Must be called once from
+ * tagfs_destroy. Arenas of other threads are free'd when the threads exit.
+ */
+void arena_destroy();
+
+/**
+ * Start a request on the calling thread. Requests may nest; only the
+ * outermost one releases the arena.
+ */
+void arena_begin();
+
+/**
+ * End a request on the calling thread. Ending the outermost request releases
+ * everything allocated from the arena since it began, keeping one chunk for
+ * the next request.
+ */
+void arena_end();
+
+/**
+ * Allocate memory from the arena of the calling thread. Never fails.
+ *
+ * @param size The number of bytes needed.
+ * @return The memory, aligned for any type.
+ */
+void *arena_alloc(size_t size);
+
+/**
+ * Copy a string into the arena of the calling thread.
+ *
+ * @param string The string to copy.
+ * @return The copy.
+ */
+char *arena_strdup(const char *string);
+
+#endif
@@ -0,0 +1,1080 @@
+/**
+ * Offline benchmark. Generates a tagfs.sl3 database of synthetic files and
+ * tags, mounts it in-process by calling the low-level tagfs_oper directly,
+ * without FUSE or a kernel mount, and reports throughput, heap allocations and latency
+ * percentiles per operation.
+ *
+ * Build and run with make bench, or make tagfs_bench and ./tagfs_bench -h for
+ * the options.
+ *
+ * @file tagfs_bench.c
+ * @author Keith Woelke
+ * @date 10/18/2026
+ */
+
+#include "tagfs_arena.h"
+#include "tagfs_bitmap.h"
+#include "tagfs_common.h"
+#include "tagfs_db.h"
+#include "tagfs_debug.h"
+#include "tagfs_index.h"
+#include "tagfs_inode.h"
+#include "tagfs_stats.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse_lowlevel.h>
+#include <math.h>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_MAX_DEPTH 64 /* elements of a generated path, the tags and the file name */
+
+extern struct fuse_lowlevel_ops tagfs_oper;
+
+/**
+ * How the tags of a generated file are drawn.
+ */
+enum bench_distribution {
+	BENCH_UNIFORM, /* every tag equally likely */
+	BENCH_ZIPF /* the tag of rank r drawn with weight 1 / r^s, as in real libraries */
+};
+
+/**
+ * Settings of a run, see bench_usage().
+ */
+struct bench_options {
+	const char *dir;
+	enum bench_distribution distribution;
+	double zipf_exponent;
+	int num_files;
+	int num_tags;
+	int tags_per_file; /* mean, each file gets between 1 and twice this minus one */
+	int file_size;
+	int ops;
+	unsigned long long seed;
+	bool verbose;
+};
+
+/**
+ * The generated library, kept to build paths that exist.
+ */
+struct bench_library {
+	int **file_tags; /* file index -> tag numbers, 1 based */
+	int *num_file_tags;
+	double *zipf_cdf; /* tag rank -> cumulative probability */
+};
+
+/**
+ * Latencies of one operation.
+ */
+struct bench_result {
+	const char *name;
+	uint64_t *latencies; /* nanoseconds */
+	int count;
+	uint64_t elapsed; /* wall time of the whole phase, nanoseconds */
+	uint64_t allocations; /* heap allocations made by tagfs code during the phase */
+};
+
+/**
+ * One operation, run for the i-th time. Returns its latency in nanoseconds, so
+ * setup around the timed call is not counted.
+ */
+typedef uint64_t (*bench_op)(const struct bench_options *options, const struct bench_library *library, int i);
+
+/**
+ * What an operation replied, as the kernel would have received it. The
+ * benchmark is not linked against libfuse, so the fuse_reply_ functions below
+ * fill this in instead.
+ */
+struct fuse_req {
+	int error; /* positive errno value, 0 on success */
+	struct fuse_entry_param entry;
+	struct stat attr;
+	struct fuse_file_info fi;
+	size_t size; /* bytes of data, written or listed */
+};
+
+static unsigned long long bench_rng_state;
+static uint64_t bench_allocations; /* changed atomically, the log writer thread allocates too */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *string);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+/*
+ * The benchmark is linked with -Wl,--wrap for each allocation function, so
+ * every call from the tagfs sources lands in the __wrap_ version first and is
+ * counted. Allocations inside SQLite, glib and libc are not counted.
+ */
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+} /* __wrap_malloc */
+
+void *__wrap_calloc(size_t count, size_t size) {
+	__atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+	return __real_calloc(count, size);
+} /* __wrap_calloc */
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	__atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+} /* __wrap_realloc */
+
+char *__wrap_strdup(const char *string) {
+	__atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+	return __real_strdup(string);
+} /* __wrap_strdup */
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size) {
+	__atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+	return __real_posix_memalign(ptr, alignment, size);
+} /* __wrap_posix_memalign */
+
+int fuse_reply_err(fuse_req_t req, int err) {
+	req->error = err;
+	return 0;
+} /* fuse_reply_err */
+
+void fuse_reply_none(fuse_req_t req) {
+	req->error = 0;
+} /* fuse_reply_none */
+
+int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *entry) {
+	req->error = entry->ino != 0 ? 0 : ENOENT; /* a negative entry */
+	req->entry = *entry;
+	return 0;
+} /* fuse_reply_entry */
+
+int fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *entry, const struct fuse_file_info *fi) {
+	req->error = 0;
+	req->entry = *entry;
+	req->fi = *fi;
+	return 0;
+} /* fuse_reply_create */
+
+int fuse_reply_attr(fuse_req_t req, const struct stat *attr, double attr_timeout) {
+	req->error = 0;
+	req->attr = *attr;
+	return 0;
+} /* fuse_reply_attr */
+
+int fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi) {
+	req->error = 0;
+	req->fi = *fi;
+	return 0;
+} /* fuse_reply_open */
+
+int fuse_reply_write(fuse_req_t req, size_t count) {
+	req->error = 0;
+	req->size = count;
+	return 0;
+} /* fuse_reply_write */
+
+int fuse_reply_buf(fuse_req_t req, const char *buf, size_t size) {
+	req->error = 0;
+	req->size = size;
+	return 0;
+} /* fuse_reply_buf */
+
+/*
+ * The data is left in the backing file, as when libfuse splices it to the
+ * kernel, so a read is timed up to the reply and not the copy.
+ */
+int fuse_reply_data(fuse_req_t req, struct fuse_bufvec *bufv, enum fuse_buf_copy_flags flags) {
+	req->error = 0;
+	req->size = bufv->buf[0].size;
+	return 0;
+} /* fuse_reply_data */
+
+/*
+ * Entries take as much room as in libfuse, so listings grow the same way, but
+ * only the name is kept.
+ */
+size_t fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize, const char *name, const struct stat *stbuf, off_t off) {
+	size_t size = (24 + strlen(name) + 7) & ~(size_t)7;
+
+	if(buf != NULL && size <= bufsize) {
+		memcpy(buf, name, strlen(name));
+	}
+
+	return size;
+} /* fuse_add_direntry */
+
+/**
+ * Returns the next number of a xorshift64* generator, so runs with the same
+ * seed generate the same library and the same operations.
+ *
+ * @return A pseudo-random 64-bit number.
+ */
+static uint64_t bench_random() {
+	bench_rng_state ^= bench_rng_state >> 12;
+	bench_rng_state ^= bench_rng_state << 25;
+	bench_rng_state ^= bench_rng_state >> 27;
+
+	return bench_rng_state * 2685821657736338717ULL;
+} /* bench_random */
+
+/**
+ * Returns a pseudo-random number below a bound.
+ *
+ * @param bound The bound.
+ * @return A number from 0 to bound - 1.
+ */
+static int bench_random_below(int bound) {
+	return (int)(bench_random() % (uint64_t)bound);
+} /* bench_random_below */
+
+/**
+ * Draw a tag number from the distribution of the run.
+ *
+ * @param options The settings of the run.
+ * @param library The library, holding the Zipf distribution.
+ * @return A tag number, 1 based.
+ */
+static int bench_random_tag(const struct bench_options *options, const struct bench_library *library) {
+	double u = 0;
+	int high = options->num_tags - 1;
+	int low = 0;
+	int middle = 0;
+
+	if(options->distribution == BENCH_UNIFORM) {
+		return bench_random_below(options->num_tags) + 1;
+	}
+
+	u = (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+
+	while(low < high) {
+		middle = low + (high - low) / 2;
+
+		if(library->zipf_cdf[middle] < u) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low + 1;
+} /* bench_random_tag */
+
+/**
+ * Returns the current time.
+ *
+ * @return Nanoseconds on the monotonic clock.
+ */
+static uint64_t bench_now() {
+	return stats_now();
+} /* bench_now */
+
+/**
+ * Returns the path of a generated file under its tags.
+ *
+ * @param library The library.
+ * @param file The file index.
+ * @param buf OUT: The path.
+ * @param size The size of buf.
+ */
+static void bench_file_path(const struct bench_library *library, int file, char *buf, size_t size) {
+	int i = 0;
+	size_t length = 0;
+
+	for(i = 0; i < library->num_file_tags[file]; i++) {
+		length += snprintf(buf + length, size - length, "/tag%d", library->file_tags[file][i]);
+	}
+
+	snprintf(buf + length, size - length, "/file%d.dat", file + 1);
+} /* bench_file_path */
+
+/**
+ * Returns a directory which holds files: one or two tags of a random file.
+ *
+ * @param library The library.
+ * @param num_files The number of files in the library.
+ * @param buf OUT: The path.
+ * @param size The size of buf.
+ */
+static void bench_folder_path(const struct bench_library *library, int num_files, char *buf, size_t size) {
+	int file = bench_random_below(num_files);
+	int *tags = library->file_tags[file];
+
+	if(library->num_file_tags[file] >= 2 && bench_random_below(2) == 0) {
+		snprintf(buf, size, "/tag%d/tag%d", tags[0], tags[1]);
+	} else {
+		snprintf(buf, size, "/tag%d", tags[bench_random_below(library->num_file_tags[file])]);
+	}
+} /* bench_folder_path */
+
+/**
+ * Fill the database and the files directory with a synthetic library.
+ *
+ * @param options The settings of the run.
+ * @param library OUT: The tags of every file.
+ */
+static void bench_generate(const struct bench_options *options, struct bench_library *library) {
+	char *buf = NULL;
+	char *db_path = NULL;
+	char *file_path = NULL;
+	char *files_dir = NULL;
+	double total = 0;
+	int fd = -1;
+	int i = 0;
+	int j = 0;
+	int k = 0;
+	int num_tags = 0;
+	int tag = 0;
+	sqlite3 *conn = NULL;
+	sqlite3_stmt *add_file = NULL;
+	sqlite3_stmt *add_tag = NULL;
+	sqlite3_stmt *add_file_tag = NULL;
+
+	/* the Zipf distribution over tag ranks */
+	library->zipf_cdf = malloc(options->num_tags * sizeof(*library->zipf_cdf));
+	assert(library->zipf_cdf != NULL);
+
+	for(i = 0; i < options->num_tags; i++) {
+		total += 1.0 / pow(i + 1, options->zipf_exponent);
+		library->zipf_cdf[i] = total;
+	}
+
+	for(i = 0; i < options->num_tags; i++) {
+		library->zipf_cdf[i] /= total;
+	}
+
+	/* the tags of every file, distinct within a file */
+	library->file_tags = malloc(options->num_files * sizeof(*library->file_tags));
+	library->num_file_tags = malloc(options->num_files * sizeof(*library->num_file_tags));
+	assert(library->file_tags != NULL && library->num_file_tags != NULL);
+
+	for(i = 0; i < options->num_files; i++) {
+		num_tags = 1 + bench_random_below(2 * options->tags_per_file - 1);
+		num_tags = num_tags < options->num_tags ? num_tags : options->num_tags;
+		library->file_tags[i] = malloc(num_tags * sizeof(**library->file_tags));
+		assert(library->file_tags[i] != NULL);
+
+		for(j = 0; j < num_tags; j++) {
+			do {
+				tag = bench_random_tag(options, library);
+
+				for(k = 0; k < j && library->file_tags[i][k] != tag; k++);
+			} while(k < j);
+
+			library->file_tags[i][j] = tag;
+		}
+
+		library->num_file_tags[i] = num_tags;
+	}
+
+	/* backing files, all of the same size */
+	files_dir = sqlite3_mprintf("%s/Files", options->dir);
+	db_path = sqlite3_mprintf("%s/tagfs.sl3", options->dir);
+
+	if(mkdir(files_dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n", files_dir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	buf = calloc(1, options->file_size > 0 ? options->file_size : 1);
+	assert(buf != NULL);
+
+	for(i = 0; i < options->num_files; i++) {
+		file_path = sqlite3_mprintf("%s/file%d.dat", files_dir, i + 1);
+		fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if(fd < 0 || write(fd, buf, options->file_size) != options->file_size) {
+			fprintf(stderr, "Unable to write %s: %s\n", file_path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		close(fd);
+		sqlite3_free(file_path);
+	}
+
+	free(buf);
+
+	/* rows, into the schema tagfs_init left behind */
+	if(sqlite3_open(db_path, &conn) != SQLITE_OK) {
+		fprintf(stderr, "Unable to open %s: %s\n", db_path, sqlite3_errmsg(conn));
+		exit(EXIT_FAILURE);
+	}
+
+	sqlite3_exec(conn, "PRAGMA synchronous = OFF; BEGIN", NULL, NULL, NULL);
+	sqlite3_exec(conn, "DELETE FROM file_has_tag; DELETE FROM files; DELETE FROM tags; DELETE FROM sqlite_sequence", NULL, NULL, NULL);
+	sqlite3_prepare_v2(conn, "INSERT INTO tags(tag_id, tag_name) VALUES(?1, 'tag' || ?1)", -1, &add_tag, NULL);
+	sqlite3_prepare_v2(conn, "INSERT INTO files(file_id, file_location, file_name) VALUES(?1, ?2, 'file' || ?1 || '.dat')", -1, &add_file, NULL);
+	sqlite3_prepare_v2(conn, "INSERT INTO file_has_tag VALUES(?1, ?2)", -1, &add_file_tag, NULL);
+	assert(add_tag != NULL && add_file != NULL && add_file_tag != NULL);
+
+	for(i = 1; i <= options->num_tags; i++) {
+		sqlite3_bind_int(add_tag, 1, i);
+		sqlite3_step(add_tag);
+		sqlite3_reset(add_tag);
+	}
+
+	for(i = 0; i < options->num_files; i++) {
+		sqlite3_bind_int(add_file, 1, i + 1);
+		sqlite3_bind_text(add_file, 2, files_dir, -1, SQLITE_STATIC);
+		sqlite3_step(add_file);
+		sqlite3_reset(add_file);
+
+		for(j = 0; j < library->num_file_tags[i]; j++) {
+			sqlite3_bind_int(add_file_tag, 1, i + 1);
+			sqlite3_bind_int(add_file_tag, 2, library->file_tags[i][j]);
+			sqlite3_step(add_file_tag);
+			sqlite3_reset(add_file_tag);
+		}
+	}
+
+	sqlite3_finalize(add_tag);
+	sqlite3_finalize(add_file);
+	sqlite3_finalize(add_file_tag);
+
+	if(sqlite3_exec(conn, "COMMIT; ANALYZE", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Unable to fill %s: %s\n", db_path, sqlite3_errmsg(conn));
+		exit(EXIT_FAILURE);
+	}
+
+	sqlite3_close(conn);
+	sqlite3_free(files_dir);
+	sqlite3_free(db_path);
+} /* bench_generate */
+
+/**
+ * Mount the library in-process.
+ *
+ * @param options The settings of the run.
+ * @param state The filesystem state to hand to the operations.
+ * @return The time tagfs_init took, in nanoseconds.
+ */
+static uint64_t bench_mount(const struct bench_options *options, struct tagfs_state *state) {
+	struct fuse_conn_info conn;
+	uint64_t started = 0;
+
+	memset(&conn, 0, sizeof(conn));
+
+	state->exec_dir = strdup(options->dir); /* free'd by tagfs_destroy */
+	state->db_options.journal_mode = TAGFS_DB_JOURNAL_MODE;
+	state->db_options.synchronous = TAGFS_DB_SYNCHRONOUS;
+	state->db_options.temp_store = TAGFS_DB_TEMP_STORE;
+	state->db_options.mmap_size = TAGFS_DB_MMAP_SIZE;
+	state->db_options.cache_size = TAGFS_DB_CACHE_SIZE;
+	state->entry_timeout = TAGFS_ENTRY_TIMEOUT;
+	state->attr_timeout = TAGFS_ATTR_TIMEOUT;
+	state->negative_timeout = TAGFS_NEGATIVE_TIMEOUT;
+
+	started = bench_now();
+	tagfs_oper.init(state, &conn);
+
+	return bench_now() - started;
+} /* bench_mount */
+
+/**
+ * Resolve a path the way the kernel does: one lookup per element, starting at
+ * the root. The inode numbers looked up must be given back with bench_forget().
+ *
+ * @param path The path.
+ * @param inodes OUT: The inode numbers looked up, the last one that of the path. At least BENCH_MAX_DEPTH long.
+ * @return The number of inode numbers looked up, or -1 if an element is missing. Nothing needs to be forgotten then.
+ */
+static int bench_lookup(const char *path, fuse_ino_t *inodes) {
+	char name[4096];
+	const char *end = NULL;
+	fuse_ino_t parent = INODE_ROOT;
+	int count = 0;
+	struct fuse_req req;
+
+	while(*path != '\0') {
+		path += strspn(path, "/");
+		end = path + strcspn(path, "/");
+
+		if(end == path) {
+			break;
+		}
+
+		assert(count < BENCH_MAX_DEPTH && end - path < (int)sizeof(name));
+		memcpy(name, path, end - path);
+		name[end - path] = '\0';
+
+		memset(&req, 0, sizeof(req));
+		tagfs_oper.lookup(&req, parent, name);
+
+		if(req.error != 0) {
+			while(count > 0) {
+				memset(&req, 0, sizeof(req));
+				tagfs_oper.forget(&req, inodes[--count], 1);
+			}
+
+			return -1;
+		}
+
+		parent = inodes[count++] = req.entry.ino;
+		path = end;
+	}
+
+	if(count == 0) { /* the root, which is never looked up */
+		inodes[count++] = INODE_ROOT;
+	}
+
+	return count;
+} /* bench_lookup */
+
+/**
+ * Give back the inode numbers of bench_lookup(), as the kernel does once it
+ * drops them from its caches.
+ *
+ * @param inodes The inode numbers.
+ * @param count Their number.
+ */
+static void bench_forget(const fuse_ino_t *inodes, int count) {
+	int i = 0;
+	struct fuse_req req;
+
+	for(i = 0; i < count; i++) {
+		if(inodes[i] != INODE_ROOT) {
+			memset(&req, 0, sizeof(req));
+			tagfs_oper.forget(&req, inodes[i], 1);
+		}
+	}
+} /* bench_forget */
+
+/**
+ * Resolve the folder a path is in, and the name of the path in it.
+ *
+ * @param path The path.
+ * @param inodes OUT: The inode numbers looked up, the last one that of the folder.
+ * @param name OUT: The last element of the path.
+ * @return The number of inode numbers looked up, or -1 if the folder is missing.
+ */
+static int bench_lookup_parent(const char *path, fuse_ino_t *inodes, const char **name) {
+	char folder[4096];
+	const char *slash = strrchr(path, '/');
+
+	snprintf(folder, sizeof(folder), "%.*s", (int)(slash - path), path);
+	*name = slash + 1;
+
+	return bench_lookup(folder, inodes);
+} /* bench_lookup_parent */
+
+/**
+ * Time resolving the path of a random file, lookup by lookup.
+ */
+static uint64_t bench_lookup_file(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	fuse_ino_t inodes[BENCH_MAX_DEPTH];
+	int count = 0;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_file_path(library, bench_random_below(options->num_files), path, sizeof(path));
+
+	started = bench_now();
+	count = bench_lookup(path, inodes);
+	elapsed = bench_now() - started;
+
+	bench_forget(inodes, count);
+
+	return elapsed;
+} /* bench_lookup_file */
+
+static uint64_t bench_getattr(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	fuse_ino_t inodes[BENCH_MAX_DEPTH];
+	int count = 0;
+	struct fuse_req req;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_file_path(library, bench_random_below(options->num_files), path, sizeof(path));
+	count = bench_lookup(path, inodes);
+
+	if(count < 0) {
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(req));
+
+	started = bench_now();
+	tagfs_oper.getattr(&req, inodes[count - 1], NULL);
+	elapsed = bench_now() - started;
+
+	bench_forget(inodes, count);
+
+	return elapsed;
+} /* bench_getattr */
+
+/**
+ * Time listing a folder the kernel looked up: opendir, readdir until the
+ * listing is exhausted, and releasedir.
+ *
+ * @param ino The inode number of the folder.
+ * @return The latency in nanoseconds.
+ */
+static uint64_t bench_list(fuse_ino_t ino) {
+	off_t offset = 0;
+	struct fuse_file_info fi;
+	struct fuse_req req;
+	uint64_t started = 0;
+
+	memset(&fi, 0, sizeof(fi));
+	memset(&req, 0, sizeof(req));
+
+	started = bench_now();
+	tagfs_oper.opendir(&req, ino, &fi);
+
+	if(req.error == 0) {
+		do {
+			req.size = 0;
+			tagfs_oper.readdir(&req, ino, 4096, offset, &fi);
+			offset += req.size;
+		} while(req.size > 0);
+
+		tagfs_oper.releasedir(&req, ino, &fi);
+	}
+
+	return bench_now() - started;
+} /* bench_list */
+
+static uint64_t bench_readdir(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	fuse_ino_t inodes[BENCH_MAX_DEPTH];
+	int count = 0;
+	uint64_t elapsed = 0;
+
+	bench_folder_path(library, options->num_files, path, sizeof(path));
+	count = bench_lookup(path, inodes);
+
+	if(count < 0) {
+		return 0;
+	}
+
+	elapsed = bench_list(inodes[count - 1]);
+	bench_forget(inodes, count);
+
+	return elapsed;
+} /* bench_readdir */
+
+static uint64_t bench_readdir_root(const struct bench_options *options, const struct bench_library *library, int i) {
+	return bench_list(INODE_ROOT);
+} /* bench_readdir_root */
+
+static uint64_t bench_open(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	fuse_ino_t inodes[BENCH_MAX_DEPTH];
+	int count = 0;
+	struct fuse_file_info fi;
+	struct fuse_req req;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_file_path(library, bench_random_below(options->num_files), path, sizeof(path));
+	count = bench_lookup(path, inodes);
+
+	if(count < 0) {
+		return 0;
+	}
+
+	memset(&fi, 0, sizeof(fi));
+	memset(&req, 0, sizeof(req));
+	fi.flags = O_RDONLY;
+
+	started = bench_now();
+	tagfs_oper.open(&req, inodes[count - 1], &fi);
+	elapsed = bench_now() - started;
+
+	if(req.error == 0) {
+		tagfs_oper.release(&req, inodes[count - 1], &req.fi);
+	}
+
+	bench_forget(inodes, count);
+
+	return elapsed;
+} /* bench_open */
+
+/**
+ * Time one read of a random file, up to 64 KiB from its start.
+ */
+static uint64_t bench_read(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	fuse_ino_t inodes[BENCH_MAX_DEPTH];
+	int count = 0;
+	size_t size = options->file_size < 65536 ? options->file_size : 65536;
+	struct fuse_file_info fi;
+	struct fuse_req req;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_file_path(library, bench_random_below(options->num_files), path, sizeof(path));
+	count = bench_lookup(path, inodes);
+
+	if(count < 0) {
+		return 0;
+	}
+
+	memset(&fi, 0, sizeof(fi));
+	memset(&req, 0, sizeof(req));
+	fi.flags = O_RDONLY;
+	tagfs_oper.open(&req, inodes[count - 1], &fi);
+
+	if(req.error == 0) {
+		fi = req.fi;
+
+		started = bench_now();
+		tagfs_oper.read(&req, inodes[count - 1], size, 0, &fi);
+		elapsed = bench_now() - started;
+
+		tagfs_oper.release(&req, inodes[count - 1], &fi);
+	}
+
+	bench_forget(inodes, count);
+
+	return elapsed;
+} /* bench_read */
+
+/**
+ * Move a file to a single tag on even runs, and back under all of its tags on
+ * odd runs, so the library ends up as it started. Like a shell running both
+ * moves, the folders stay looked up in between, since the folder a file left
+ * may hold no other file.
+ */
+static uint64_t bench_rename(const struct bench_options *options, const struct bench_library *library, int i) {
+	char moved[4096];
+	char path[4096];
+	const char *moved_name = NULL;
+	const char *name = NULL;
+	int file = (i / 2) % options->num_files;
+	static fuse_ino_t inodes[BENCH_MAX_DEPTH]; /* of the folder the file started in */
+	static fuse_ino_t moved_inodes[BENCH_MAX_DEPTH]; /* of the single tag */
+	static int count = -1;
+	static int moved_count = -1;
+	struct fuse_req req;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	memset(&req, 0, sizeof(req));
+
+	if(i % 2 == 0) {
+		bench_file_path(library, file, path, sizeof(path));
+		snprintf(moved, sizeof(moved), "/tag%d/file%d.dat", bench_random_tag(options, library), file + 1);
+		count = bench_lookup_parent(path, inodes, &name);
+		moved_count = bench_lookup_parent(moved, moved_inodes, &moved_name);
+
+		if(count < 0 || moved_count < 0) {
+			return 0;
+		}
+
+		started = bench_now();
+		tagfs_oper.rename(&req, inodes[count - 1], name, moved_inodes[moved_count - 1], moved_name);
+		elapsed = bench_now() - started;
+	} else {
+		if(count < 0 || moved_count < 0) {
+			bench_forget(inodes, count);
+			bench_forget(moved_inodes, moved_count);
+			return 0;
+		}
+
+		snprintf(moved, sizeof(moved), "file%d.dat", file + 1);
+
+		started = bench_now();
+		tagfs_oper.rename(&req, moved_inodes[moved_count - 1], moved, inodes[count - 1], moved);
+		elapsed = bench_now() - started;
+
+		bench_forget(inodes, count);
+		bench_forget(moved_inodes, moved_count);
+	}
+
+	return elapsed;
+} /* bench_rename */
+
+static uint64_t bench_files_at_location(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	int *files = NULL;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_folder_path(library, options->num_files, path, sizeof(path));
+
+	started = bench_now();
+	tag_read_lock();
+	files_at_location(path, &files);
+	tag_unlock();
+	elapsed = bench_now() - started;
+
+	free(files);
+	return elapsed;
+} /* bench_files_at_location */
+
+static uint64_t bench_db_files_at_path(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	char **tags = NULL;
+	int *files = NULL;
+	int num_tags = 0;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_folder_path(library, options->num_files, path, sizeof(path));
+	num_tags = path_to_array(path, &tags);
+
+	started = bench_now();
+	db_files_at_path((const char **)tags, num_tags, &files);
+	elapsed = bench_now() - started;
+
+	free(files);
+	return elapsed;
+} /* bench_db_files_at_path */
+
+static uint64_t bench_smart_tags(const struct bench_options *options, const struct bench_library *library, int i) {
+	char path[4096];
+	int *tags = NULL;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	bench_folder_path(library, options->num_files, path, sizeof(path));
+
+	started = bench_now();
+	tag_read_lock();
+	smart_tags_from_files(path, &tags);
+	tag_unlock();
+	elapsed = bench_now() - started;
+
+	free(tags);
+	return elapsed;
+} /* bench_smart_tags */
+
+static uint64_t bench_bitmap_and(const struct bench_options *options, const struct bench_library *library, int i) {
+	const struct bitmap *a = index_files_bitmap(bench_random_tag(options, library));
+	const struct bitmap *b = index_files_bitmap(bench_random_tag(options, library));
+	uint64_t started = 0;
+
+	if(a == NULL || b == NULL) {
+		return 0;
+	}
+
+	started = bench_now();
+	bitmap_and_cardinality(a, b);
+
+	return bench_now() - started;
+} /* bench_bitmap_and */
+
+/**
+ * Intersect the posting lists of two tags the way they were intersected before
+ * the bitmaps, as sorted arrays merged by array_intersection(). Draws the same
+ * tags as bench_bitmap_and() when run from the same generator state, and only
+ * the intersection is timed.
+ */
+static uint64_t bench_array_intersection(const struct bench_options *options, const struct bench_library *library, int i) {
+	const struct bitmap *a = index_files_bitmap(bench_random_tag(options, library));
+	const struct bitmap *b = index_files_bitmap(bench_random_tag(options, library));
+	int *a_files = NULL;
+	int *b_files = NULL;
+	int *files = NULL;
+	int num_a_files = 0;
+	int num_b_files = 0;
+	uint64_t elapsed = 0;
+	uint64_t started = 0;
+
+	if(a == NULL || b == NULL || bitmap_cardinality(a) == 0 || bitmap_cardinality(b) == 0) {
+		return 0;
+	}
+
+	num_a_files = bitmap_to_array(a, &a_files);
+	num_b_files = bitmap_to_array(b, &b_files);
+
+	started = bench_now();
+	array_intersection(a_files, num_a_files, b_files, num_b_files, &files);
+	elapsed = bench_now() - started;
+
+	free(files);
+	free(a_files);
+	free(b_files);
+	return elapsed;
+} /* bench_array_intersection */
+
+static int bench_compare(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+} /* bench_compare */
+
+/**
+ * Run one operation a number of times.
+ *
+ * @param name The name to report.
+ * @param op The operation.
+ * @param count The number of runs.
+ * @param options The settings of the run.
+ * @param library The library.
+ * @param result OUT: The latencies.
+ */
+static void bench_run(const char *name, bench_op op, int count, const struct bench_options *options, const struct bench_library *library, struct bench_result *result) {
+	int i = 0;
+	uint64_t allocations = 0;
+	uint64_t started = 0;
+
+	result->name = name;
+	result->count = count;
+	result->latencies = malloc(count * sizeof(*result->latencies));
+	assert(result->latencies != NULL);
+
+	allocations = __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED);
+	started = bench_now();
+
+	/* each run is one request, as if FUSE had called in, so the helpers have an arena */
+	for(i = 0; i < count; i++) {
+		arena_begin();
+		result->latencies[i] = op(options, library, i);
+		arena_end();
+	}
+
+	result->elapsed = bench_now() - started;
+	result->allocations = __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED) - allocations;
+
+	qsort(result->latencies, count, sizeof(*result->latencies), bench_compare);
+} /* bench_run */
+
+/**
+ * Print one line of the results table.
+ *
+ * @param result The latencies of an operation. Free'd.
+ */
+static void bench_report(struct bench_result *result) {
+	uint64_t total = 0;
+	int i = 0;
+
+	for(i = 0; i < result->count; i++) {
+		total += result->latencies[i];
+	}
+
+	printf("%-22s %8d %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", result->name, result->count,
+			result->count / (result->elapsed / 1e9),
+			(double)result->allocations / result->count,
+			total / 1e3 / result->count,
+			result->latencies[result->count / 2] / 1e3,
+			result->latencies[(int)(result->count * 0.99)] / 1e3,
+			result->latencies[(int)(result->count * 0.999)] / 1e3,
+			result->latencies[result->count - 1] / 1e3);
+
+	free(result->latencies);
+	result->latencies = NULL;
+} /* bench_report */
+
+static void bench_usage(const char *name) {
+	fprintf(stderr, "Usage: %s [options]\n"
+			"  -d DIR    directory to generate the library in (default bench)\n"
+			"  -n FILES  number of files (default 10000)\n"
+			"  -t TAGS   number of tags (default 1000)\n"
+			"  -k TAGS   mean number of tags per file (default 3)\n"
+			"  -z S      draw tags from a Zipf distribution with exponent S (default 1.0)\n"
+			"  -u        draw tags uniformly instead\n"
+			"  -b BYTES  size of each file (default 4096)\n"
+			"  -o OPS    operations per benchmark (default 2000)\n"
+			"  -s SEED   random seed (default 1)\n"
+			"  -v        also print the per-function statistics of /.tagfs/stats\n", name);
+} /* bench_usage */
+
+int main(int argc, char *argv[]) {
+	char *stats = NULL;
+	int opt = 0;
+	struct bench_library library;
+	struct bench_options options = { "bench", BENCH_ZIPF, 1.0, 10000, 1000, 3, 4096, 2000, 1, false };
+	struct bench_result result;
+	struct tagfs_state state;
+	uint64_t started = 0;
+	unsigned long long rng_state = 0; /* generator state replayed for the second intersection run */
+
+	while((opt = getopt(argc, argv, "d:n:t:k:z:ub:o:s:vh")) != -1) {
+		switch(opt) {
+			case 'd': options.dir = optarg; break;
+			case 'n': options.num_files = atoi(optarg); break;
+			case 't': options.num_tags = atoi(optarg); break;
+			case 'k': options.tags_per_file = atoi(optarg); break;
+			case 'z': options.distribution = BENCH_ZIPF; options.zipf_exponent = atof(optarg); break;
+			case 'u': options.distribution = BENCH_UNIFORM; break;
+			case 'b': options.file_size = atoi(optarg); break;
+			case 'o': options.ops = atoi(optarg); break;
+			case 's': options.seed = strtoull(optarg, NULL, 10); break;
+			case 'v': options.verbose = true; break;
+			default: bench_usage(argv[0]); return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if(options.num_files < 1 || options.num_tags < 1 || options.tags_per_file < 1 || options.file_size < 0 || options.ops < 2) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	if(mkdir(options.dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n", options.dir, strerror(errno));
+		return 1;
+	}
+
+	bench_rng_state = options.seed * 0x9E3779B97F4A7C15ULL + 1;
+	memset(&state, 0, sizeof(state));
+
+	debug_init();
+	debug_set_level(TAGFS_LOG_WARN);
+
+	printf("TagFS benchmark: %d files, %d tags, %d tags per file on average, ", options.num_files, options.num_tags, options.tags_per_file);
+
+	if(options.distribution == BENCH_ZIPF) {
+		printf("Zipf tags (s = %.2f), seed %llu\n", options.zipf_exponent, options.seed);
+	} else {
+		printf("uniform tags, seed %llu\n", options.seed);
+	}
+
+	/* the first mount creates the schema, which is then filled behind its back */
+	bench_mount(&options, &state);
+	tagfs_oper.destroy(&state);
+
+	started = bench_now();
+	bench_generate(&options, &library);
+	printf("generate: %.2f s\n", (bench_now() - started) / 1e9);
+	printf("mount: %.2f s\n\n", bench_mount(&options, &state) / 1e9);
+
+	printf("%-22s %8s %12s %10s %10s %10s %10s %10s %10s\n", "operation", "count", "ops/s", "allocs/op", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+
+	bench_run("lookup", bench_lookup_file, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("getattr", bench_getattr, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("readdir", bench_readdir, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("readdir /", bench_readdir_root, options.ops / 100 > 2 ? options.ops / 100 : 2, &options, &library, &result);
+	bench_report(&result);
+	bench_run("open", bench_open, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("read", bench_read, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("rename", bench_rename, options.ops & ~1, &options, &library, &result);
+	bench_report(&result);
+	bench_run("files_at_location", bench_files_at_location, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("db_files_at_path", bench_db_files_at_path, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_run("smart_tags_from_files", bench_smart_tags, options.ops, &options, &library, &result);
+	bench_report(&result);
+	/* the same pairs of tags, as bitmaps and as the sorted arrays they replaced */
+	rng_state = bench_rng_state;
+	bench_run("bitmap_and_cardinality", bench_bitmap_and, options.ops, &options, &library, &result);
+	bench_report(&result);
+	bench_rng_state = rng_state;
+	bench_run("array_intersection", bench_array_intersection, options.ops, &options, &library, &result);
+	bench_report(&result);
+
+	if(options.verbose) {
+		stats_render(&stats);
+		printf("\n%s", stats);
+		free(stats);
+	}
+
+	tagfs_oper.destroy(&state);
+	return 0;
+} /* main */
@@ -0,0 +1,842 @@
+#include "tagfs_bitmap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARRAY_MAX_CARDINALITY 4096 /* beyond this a bitset is smaller than an array */
+#define BITSET_WORDS 1024 /* 65536 bits */
+#define BITSET_VECTOR_WORDS 4
+#define BITSET_VECTORS (BITSET_WORDS / BITSET_VECTOR_WORDS)
+#define ARRAY_GALLOP_RATIO 32 /* intersect by galloping once one array is this many times larger */
+
+/**
+ * Four bitset words handled as one value. GCC lowers operations on it to
+ * whatever SIMD registers the target has (SSE2, AVX2, NEON), or to plain
+ * 64-bit operations where there are none.
+ */
+typedef uint64_t bitset_vector __attribute__((vector_size(BITSET_VECTOR_WORDS * sizeof(uint64_t))));
+
+enum container_type {
+	CONTAINER_ARRAY, /* sorted array of low 16 bits */
+	CONTAINER_BITSET /* one bit per value of the chunk */
+};
+
+/**
+ * The values of one chunk of 65536 IDs, all sharing the same high 16 bits.
+ */
+struct container {
+	uint16_t key; /* high 16 bits of every value in the container */
+	enum container_type type;
+	int cardinality;
+	int capacity; /* slots allocated in array, for array containers */
+	union {
+		uint16_t *array;
+		uint64_t *words;
+	} data;
+};
+
+struct bitmap {
+	struct container *containers; /* sorted by key */
+	int count;
+	int capacity;
+	int cardinality;
+};
+
+/**
+ * Allocate a zeroed bitset, aligned for bitset_vector access.
+ *
+ * @return The new bitset.
+ */
+static uint64_t *bitset_new() {
+	void *words = NULL;
+	int rc = 0;
+
+	rc = posix_memalign(&words, sizeof(bitset_vector), BITSET_WORDS * sizeof(uint64_t));
+	assert(rc == 0);
+	memset(words, 0, BITSET_WORDS * sizeof(uint64_t));
+
+	return words;
+} /* bitset_new */
+
+/**
+ * Count the bits set in a bitset.
+ *
+ * @param words The bitset.
+ * @return The number of bits set.
+ */
+static int bitset_cardinality(const uint64_t *words) {
+	int cardinality = 0;
+	int i = 0;
+
+	for(i = 0; i < BITSET_WORDS; i++) {
+		cardinality += __builtin_popcountll(words[i]);
+	}
+
+	return cardinality;
+} /* bitset_cardinality */
+
+/**
+ * Intersect two bitsets, keeping the result in the first.
+ *
+ * @param a The first bitset. Holds the result.
+ * @param b The second bitset.
+ * @return The cardinality of the result.
+ */
+static int bitset_and(uint64_t *restrict a, const uint64_t *restrict b) {
+	bitset_vector *va = (bitset_vector *)a;
+	const bitset_vector *vb = (const bitset_vector *)b;
+	int i = 0;
+
+	for(i = 0; i < BITSET_VECTORS; i++) {
+		va[i] &= vb[i];
+	}
+
+	return bitset_cardinality(a);
+} /* bitset_and */
+
+/**
+ * Remove the bits of one bitset from another, keeping the result in the first.
+ *
+ * @param a The first bitset. Holds the result.
+ * @param b The bits to remove.
+ * @return The cardinality of the result.
+ */
+static int bitset_andnot(uint64_t *restrict a, const uint64_t *restrict b) {
+	bitset_vector *va = (bitset_vector *)a;
+	const bitset_vector *vb = (const bitset_vector *)b;
+	int i = 0;
+
+	for(i = 0; i < BITSET_VECTORS; i++) {
+		va[i] &= ~vb[i];
+	}
+
+	return bitset_cardinality(a);
+} /* bitset_andnot */
+
+/**
+ * Count the bits two bitsets have in common.
+ *
+ * @param a The first bitset.
+ * @param b The second bitset.
+ * @return The cardinality of the intersection.
+ */
+static int bitset_and_cardinality(const uint64_t *a, const uint64_t *b) {
+	int cardinality = 0;
+	int i = 0;
+
+	for(i = 0; i < BITSET_WORDS; i++) {
+		cardinality += __builtin_popcountll(a[i] & b[i]);
+	}
+
+	return cardinality;
+} /* bitset_and_cardinality */
+
+/**
+ * Checks if a bit is set in a bitset.
+ *
+ * @param words The bitset.
+ * @param low The bit to check.
+ * @return True, if the bit is set. False, otherwise.
+ */
+static bool bitset_contains(const uint64_t *words, uint16_t low) {
+	return (words[low >> 6] >> (low & 63)) & 1;
+} /* bitset_contains */
+
+/**
+ * Returns the position of a value in a sorted array of 16-bit values, or the
+ * position at which it would have to be inserted.
+ *
+ * @param array The sorted array to search.
+ * @param count The number of elements in the array.
+ * @param value The value to search for.
+ * @return The index of the first element not less than value.
+ */
+static int array_lower_bound(const uint16_t *array, int count, uint16_t value) {
+	int high = count;
+	int low = 0;
+	int middle = 0;
+
+	while(low < high) {
+		middle = low + (high - low) / 2;
+
+		if(array[middle] < value) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+} /* array_lower_bound */
+
+/**
+ * Returns the position of a value in a sorted array of 16-bit values, searching
+ * forward from a position in steps that double until they overshoot, then
+ * bisecting the last step. Costs O(log d) for a value d elements ahead, so
+ * walking a long array with the values of a short one skips most of it.
+ *
+ * @param array The sorted array to search.
+ * @param count The number of elements in the array.
+ * @param start The position to search from. Every element before it is less than value.
+ * @param value The value to search for.
+ * @return The index of the first element not less than value.
+ */
+static int array_gallop(const uint16_t *array, int count, int start, uint16_t value) {
+	int high = start;
+	int low = start;
+	int step = 1;
+
+	while(high < count && array[high] < value) {
+		low = high + 1;
+		high = start + step;
+		step *= 2;
+	}
+
+	high = high < count ? high : count;
+
+	return low + array_lower_bound(array + low, high - low, value);
+} /* array_gallop */
+
+/**
+ * Intersect two sorted arrays of 16-bit values. Arrays of similar sizes are
+ * merged; if one is ARRAY_GALLOP_RATIO times larger, every value of the smaller
+ * one is looked up in it with array_gallop() instead.
+ *
+ * @param a The first array.
+ * @param a_size The number of values in the first array.
+ * @param b The second array.
+ * @param b_size The number of values in the second array.
+ * @param out The intersection. May be the same array as a. If NULL, the values are only counted.
+ * @return The number of values in the intersection.
+ */
+static int array_and(const uint16_t *a, int a_size, const uint16_t *b, int b_size, uint16_t *out) {
+	const uint16_t *large = a;
+	const uint16_t *small = b;
+	int count = 0;
+	int i = 0;
+	int j = 0;
+	int large_size = a_size;
+	int small_size = b_size;
+
+	if(a_size < b_size) {
+		large = b;
+		large_size = b_size;
+		small = a;
+		small_size = a_size;
+	}
+
+	if(small_size * ARRAY_GALLOP_RATIO < large_size) {
+		/* out only trails the read position of a, whichever array a is */
+		for(i = 0; i < small_size && j < large_size; i++) {
+			j = array_gallop(large, large_size, j, small[i]);
+
+			if(j < large_size && large[j] == small[i]) {
+				if(out != NULL) {
+					out[count] = small[i];
+				}
+
+				count++;
+				j++;
+			}
+		}
+
+		return count;
+	}
+
+	while(i < a_size && j < b_size) {
+		if(a[i] < b[j]) {
+			i++;
+		} else if(a[i] > b[j]) {
+			j++;
+		} else {
+			if(out != NULL) {
+				out[count] = a[i];
+			}
+
+			count++;
+			i++;
+			j++;
+		}
+	}
+
+	return count;
+} /* array_and */
+
+/**
+ * Remove the values of one sorted array of 16-bit values from another.
+ *
+ * @param a The array to remove values from.
+ * @param a_size The number of values in the first array.
+ * @param b The values to remove.
+ * @param b_size The number of values in the second array.
+ * @param out The difference. May be the same array as a.
+ * @return The number of values in the difference.
+ */
+static int array_andnot(const uint16_t *a, int a_size, const uint16_t *b, int b_size, uint16_t *out) {
+	int count = 0;
+	int i = 0;
+	int j = 0;
+
+	while(i < a_size) {
+		if(j == b_size || a[i] < b[j]) {
+			out[count++] = a[i++];
+		} else if(a[i] > b[j]) {
+			j++;
+		} else {
+			i++;
+			j++;
+		}
+	}
+
+	return count;
+} /* array_andnot */
+
+/**
+ * Free the storage of a container.
+ *
+ * @param container The container.
+ */
+static void container_free(struct container *container) {
+	if(container->type == CONTAINER_ARRAY) {
+		free(container->data.array);
+	} else {
+		free(container->data.words);
+	}
+
+	container->data.array = NULL;
+} /* container_free */
+
+/**
+ * Convert an array container into a bitset container.
+ *
+ * @param container The container to convert.
+ */
+static void container_to_bitset(struct container *container) {
+	uint64_t *words = NULL;
+	int i = 0;
+
+	assert(container->type == CONTAINER_ARRAY);
+
+	words = bitset_new();
+
+	for(i = 0; i < container->cardinality; i++) {
+		words[container->data.array[i] >> 6] |= (uint64_t)1 << (container->data.array[i] & 63);
+	}
+
+	free(container->data.array);
+	container->data.words = words;
+	container->type = CONTAINER_BITSET;
+	container->capacity = 0;
+} /* container_to_bitset */
+
+/**
+ * Convert a bitset container into an array container. The cardinality of the
+ * container must be up to date.
+ *
+ * @param container The container to convert.
+ */
+static void container_to_array(struct container *container) {
+	uint16_t *array = NULL;
+	uint64_t word = 0;
+	int count = 0;
+	int i = 0;
+
+	assert(container->type == CONTAINER_BITSET);
+
+	array = malloc((container->cardinality > 0 ? container->cardinality : 1) * sizeof(*array));
+	assert(array != NULL);
+
+	for(i = 0; i < BITSET_WORDS; i++) {
+		for(word = container->data.words[i]; word != 0; word &= word - 1) {
+			array[count++] = i * 64 + __builtin_ctzll(word);
+		}
+	}
+
+	assert(count == container->cardinality);
+
+	free(container->data.words);
+	container->data.array = array;
+	container->type = CONTAINER_ARRAY;
+	container->capacity = container->cardinality > 0 ? container->cardinality : 1;
+} /* container_to_array */
+
+/**
+ * Switch a bitset container to an array once it is sparse enough.
+ *
+ * @param container The container to check.
+ */
+static void container_shrink(struct container *container) {
+	if(container->type == CONTAINER_BITSET && container->cardinality <= ARRAY_MAX_CARDINALITY) {
+		container_to_array(container);
+	}
+} /* container_shrink */
+
+/**
+ * Intersect a container with another one, keeping the result in the first.
+ *
+ * @param a The first container. Holds the result.
+ * @param b The second container.
+ */
+static void container_and(struct container *a, const struct container *b) {
+	int count = 0;
+	int i = 0;
+
+	if(a->type == CONTAINER_ARRAY && b->type == CONTAINER_ARRAY) {
+		a->cardinality = array_and(a->data.array, a->cardinality, b->data.array, b->cardinality, a->data.array);
+	} else if(a->type == CONTAINER_ARRAY) { /* array and bitset */
+		for(i = 0; i < a->cardinality; i++) {
+			if(bitset_contains(b->data.words, a->data.array[i])) {
+				a->data.array[count++] = a->data.array[i];
+			}
+		}
+
+		a->cardinality = count;
+	} else if(b->type == CONTAINER_ARRAY) { /* bitset and array: the result is at most as large as the array */
+		uint16_t *array = malloc((b->cardinality > 0 ? b->cardinality : 1) * sizeof(*array));
+		assert(array != NULL);
+
+		for(i = 0; i < b->cardinality; i++) {
+			if(bitset_contains(a->data.words, b->data.array[i])) {
+				array[count++] = b->data.array[i];
+			}
+		}
+
+		free(a->data.words);
+		a->data.array = array;
+		a->type = CONTAINER_ARRAY;
+		a->capacity = b->cardinality > 0 ? b->cardinality : 1;
+		a->cardinality = count;
+	} else {
+		a->cardinality = bitset_and(a->data.words, b->data.words);
+		container_shrink(a);
+	}
+} /* container_and */
+
+/**
+ * Remove the values of a container from another one, keeping the result in the
+ * first.
+ *
+ * @param a The first container. Holds the result.
+ * @param b The values to remove.
+ */
+static void container_andnot(struct container *a, const struct container *b) {
+	int count = 0;
+	int i = 0;
+
+	if(a->type == CONTAINER_ARRAY && b->type == CONTAINER_ARRAY) {
+		a->cardinality = array_andnot(a->data.array, a->cardinality, b->data.array, b->cardinality, a->data.array);
+	} else if(a->type == CONTAINER_ARRAY) { /* array minus bitset */
+		for(i = 0; i < a->cardinality; i++) {
+			if(!bitset_contains(b->data.words, a->data.array[i])) {
+				a->data.array[count++] = a->data.array[i];
+			}
+		}
+
+		a->cardinality = count;
+	} else if(b->type == CONTAINER_ARRAY) { /* bitset minus array */
+		for(i = 0; i < b->cardinality; i++) {
+			a->data.words[b->data.array[i] >> 6] &= ~((uint64_t)1 << (b->data.array[i] & 63));
+		}
+
+		a->cardinality = bitset_cardinality(a->data.words);
+		container_shrink(a);
+	} else {
+		a->cardinality = bitset_andnot(a->data.words, b->data.words);
+		container_shrink(a);
+	}
+} /* container_andnot */
+
+/**
+ * Count the values two containers have in common.
+ *
+ * @param a The first container.
+ * @param b The second container.
+ * @return The cardinality of the intersection.
+ */
+static int container_and_cardinality(const struct container *a, const struct container *b) {
+	const struct container *array_container = NULL;
+	const struct container *other = NULL;
+	int count = 0;
+	int i = 0;
+
+	if(a->type == CONTAINER_BITSET && b->type == CONTAINER_BITSET) {
+		return bitset_and_cardinality(a->data.words, b->data.words);
+	}
+
+	array_container = a->type == CONTAINER_ARRAY ? a : b;
+	other = array_container == a ? b : a;
+
+	if(other->type == CONTAINER_BITSET) {
+		for(i = 0; i < array_container->cardinality; i++) {
+			count += bitset_contains(other->data.words, array_container->data.array[i]);
+		}
+	} else {
+		count = array_and(a->data.array, a->cardinality, b->data.array, b->cardinality, NULL);
+	}
+
+	return count;
+} /* container_and_cardinality */
+
+/**
+ * Copy a container.
+ *
+ * @param destination The container to copy into.
+ * @param source The container to copy.
+ */
+static void container_copy(struct container *destination, const struct container *source) {
+	*destination = *source;
+
+	if(source->type == CONTAINER_ARRAY) {
+		destination->capacity = source->cardinality > 0 ? source->cardinality : 1;
+		destination->data.array = malloc(destination->capacity * sizeof(*destination->data.array));
+		assert(destination->data.array != NULL);
+		memcpy(destination->data.array, source->data.array, source->cardinality * sizeof(*source->data.array));
+	} else {
+		destination->data.words = bitset_new();
+		memcpy(destination->data.words, source->data.words, BITSET_WORDS * sizeof(uint64_t));
+	}
+} /* container_copy */
+
+/**
+ * Find the container for a key.
+ *
+ * @param bitmap The bitmap.
+ * @param key The high 16 bits of a value.
+ * @param position OUT: The index of the container, or the index at which it would have to be inserted.
+ * @return True, if the container exists. False, otherwise.
+ */
+static bool bitmap_find_container(const struct bitmap *bitmap, uint16_t key, int *position) {
+	int high = bitmap->count;
+	int low = 0;
+	int middle = 0;
+
+	while(low < high) {
+		middle = low + (high - low) / 2;
+
+		if(bitmap->containers[middle].key < key) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	*position = low;
+	return low < bitmap->count && bitmap->containers[low].key == key;
+} /* bitmap_find_container */
+
+/**
+ * Drop the containers which became empty and recompute the cardinality.
+ *
+ * @param bitmap The bitmap.
+ */
+static void bitmap_compact(struct bitmap *bitmap) {
+	int count = 0;
+	int i = 0;
+
+	bitmap->cardinality = 0;
+
+	for(i = 0; i < bitmap->count; i++) {
+		if(bitmap->containers[i].cardinality == 0) {
+			container_free(&bitmap->containers[i]);
+		} else {
+			bitmap->cardinality += bitmap->containers[i].cardinality;
+			bitmap->containers[count++] = bitmap->containers[i];
+		}
+	}
+
+	bitmap->count = count;
+} /* bitmap_compact */
+
+struct bitmap *bitmap_new() {
+	struct bitmap *bitmap = NULL;
+
+	bitmap = calloc(1, sizeof(*bitmap));
+	assert(bitmap != NULL);
+
+	return bitmap;
+} /* bitmap_new */
+
+struct bitmap *bitmap_from_array(const int *array, int count) {
+	struct bitmap *bitmap = NULL;
+	int i = 0;
+
+	bitmap = bitmap_new();
+
+	for(i = 0; i < count; i++) {
+		assert(array[i] >= 0);
+		bitmap_add(bitmap, array[i]);
+	}
+
+	return bitmap;
+} /* bitmap_from_array */
+
+struct bitmap *bitmap_copy(const struct bitmap *bitmap) {
+	struct bitmap *copy = NULL;
+	int i = 0;
+
+	copy = bitmap_new();
+	copy->count = bitmap->count;
+	copy->capacity = bitmap->count;
+	copy->cardinality = bitmap->cardinality;
+
+	if(bitmap->count > 0) {
+		copy->containers = malloc(bitmap->count * sizeof(*copy->containers));
+		assert(copy->containers != NULL);
+
+		for(i = 0; i < bitmap->count; i++) {
+			container_copy(&copy->containers[i], &bitmap->containers[i]);
+		}
+	}
+
+	return copy;
+} /* bitmap_copy */
+
+void bitmap_free(struct bitmap **bitmap) {
+	int i = 0;
+
+	assert(*bitmap != NULL);
+
+	for(i = 0; i < (*bitmap)->count; i++) {
+		container_free(&(*bitmap)->containers[i]);
+	}
+
+	free((*bitmap)->containers);
+	free(*bitmap);
+	*bitmap = NULL;
+} /* bitmap_free */
+
+bool bitmap_add(struct bitmap *bitmap, uint32_t value) {
+	struct container *container = NULL;
+	uint16_t key = value >> 16;
+	uint16_t low = value & 0xFFFF;
+	int position = 0;
+	int slot = 0;
+
+	if(!bitmap_find_container(bitmap, key, &position)) {
+		if(bitmap->count == bitmap->capacity) {
+			bitmap->capacity = bitmap->capacity > 0 ? bitmap->capacity * 2 : 4;
+			bitmap->containers = realloc(bitmap->containers, bitmap->capacity * sizeof(*bitmap->containers));
+			assert(bitmap->containers != NULL);
+		}
+
+		memmove(&bitmap->containers[position + 1], &bitmap->containers[position], (bitmap->count - position) * sizeof(*bitmap->containers));
+		bitmap->count++;
+
+		container = &bitmap->containers[position];
+		container->key = key;
+		container->type = CONTAINER_ARRAY;
+		container->cardinality = 0;
+		container->capacity = 4;
+		container->data.array = malloc(container->capacity * sizeof(*container->data.array));
+		assert(container->data.array != NULL);
+	}
+
+	container = &bitmap->containers[position];
+
+	if(container->type == CONTAINER_BITSET) {
+		if(bitset_contains(container->data.words, low)) {
+			return false;
+		}
+
+		container->data.words[low >> 6] |= (uint64_t)1 << (low & 63);
+	} else {
+		slot = array_lower_bound(container->data.array, container->cardinality, low);
+
+		if(slot < container->cardinality && container->data.array[slot] == low) {
+			return false;
+		}
+
+		if(container->cardinality == ARRAY_MAX_CARDINALITY) {
+			container_to_bitset(container);
+			container->data.words[low >> 6] |= (uint64_t)1 << (low & 63);
+		} else {
+			if(container->cardinality == container->capacity) {
+				container->capacity *= 2;
+				container->data.array = realloc(container->data.array, container->capacity * sizeof(*container->data.array));
+				assert(container->data.array != NULL);
+			}
+
+			memmove(&container->data.array[slot + 1], &container->data.array[slot], (container->cardinality - slot) * sizeof(*container->data.array));
+			container->data.array[slot] = low;
+		}
+	}
+
+	container->cardinality++;
+	bitmap->cardinality++;
+	return true;
+} /* bitmap_add */
+
+bool bitmap_remove(struct bitmap *bitmap, uint32_t value) {
+	struct container *container = NULL;
+	uint16_t key = value >> 16;
+	uint16_t low = value & 0xFFFF;
+	int position = 0;
+	int slot = 0;
+
+	if(!bitmap_find_container(bitmap, key, &position)) {
+		return false;
+	}
+
+	container = &bitmap->containers[position];
+
+	if(container->type == CONTAINER_BITSET) {
+		if(!bitset_contains(container->data.words, low)) {
+			return false;
+		}
+
+		container->data.words[low >> 6] &= ~((uint64_t)1 << (low & 63));
+		container->cardinality--;
+		container_shrink(container);
+	} else {
+		slot = array_lower_bound(container->data.array, container->cardinality, low);
+
+		if(slot == container->cardinality || container->data.array[slot] != low) {
+			return false;
+		}
+
+		memmove(&container->data.array[slot], &container->data.array[slot + 1], (container->cardinality - slot - 1) * sizeof(*container->data.array));
+		container->cardinality--;
+	}
+
+	bitmap->cardinality--;
+
+	if(container->cardinality == 0) {
+		container_free(container);
+		memmove(&bitmap->containers[position], &bitmap->containers[position + 1], (bitmap->count - position - 1) * sizeof(*bitmap->containers));
+		bitmap->count--;
+	}
+
+	return true;
+} /* bitmap_remove */
+
+bool bitmap_contains(const struct bitmap *bitmap, uint32_t value) {
+	const struct container *container = NULL;
+	uint16_t low = value & 0xFFFF;
+	int position = 0;
+	int slot = 0;
+
+	if(!bitmap_find_container(bitmap, value >> 16, &position)) {
+		return false;
+	}
+
+	container = &bitmap->containers[position];
+
+	if(container->type == CONTAINER_BITSET) {
+		return bitset_contains(container->data.words, low);
+	}
+
+	slot = array_lower_bound(container->data.array, container->cardinality, low);
+	return slot < container->cardinality && container->data.array[slot] == low;
+} /* bitmap_contains */
+
+int bitmap_cardinality(const struct bitmap *bitmap) {
+	return bitmap->cardinality;
+} /* bitmap_cardinality */
+
+void bitmap_and_inplace(struct bitmap *a, const struct bitmap *b) {
+	int i = 0;
+	int j = 0;
+
+	for(i = 0; i < a->count; i++) {
+		while(j < b->count && b->containers[j].key < a->containers[i].key) {
+			j++;
+		}
+
+		if(j < b->count && b->containers[j].key == a->containers[i].key) {
+			container_and(&a->containers[i], &b->containers[j]);
+		} else {
+			a->containers[i].cardinality = 0;
+		}
+	}
+
+	bitmap_compact(a);
+} /* bitmap_and_inplace */
+
+void bitmap_andnot_inplace(struct bitmap *a, const struct bitmap *b) {
+	int i = 0;
+	int j = 0;
+
+	for(i = 0; i < a->count; i++) {
+		while(j < b->count && b->containers[j].key < a->containers[i].key) {
+			j++;
+		}
+
+		if(j < b->count && b->containers[j].key == a->containers[i].key) {
+			container_andnot(&a->containers[i], &b->containers[j]);
+		}
+	}
+
+	bitmap_compact(a);
+} /* bitmap_andnot_inplace */
+
+int bitmap_and_cardinality(const struct bitmap *a, const struct bitmap *b) {
+	int cardinality = 0;
+	int i = 0;
+	int j = 0;
+
+	while(i < a->count && j < b->count) {
+		if(a->containers[i].key < b->containers[j].key) {
+			i++;
+		} else if(a->containers[i].key > b->containers[j].key) {
+			j++;
+		} else {
+			cardinality += container_and_cardinality(&a->containers[i++], &b->containers[j++]);
+		}
+	}
+
+	return cardinality;
+} /* bitmap_and_cardinality */
+
+int bitmap_to_array(const struct bitmap *bitmap, int **array) {
+	const struct container *container = NULL;
+	uint32_t high = 0;
+	uint64_t word = 0;
+	int count = 0;
+	int i = 0;
+	int j = 0;
+
+	assert(*array == NULL);
+
+	if(bitmap->cardinality == 0) {
+		return 0;
+	}
+
+	*array = malloc(bitmap->cardinality * sizeof(**array));
+	assert(*array != NULL);
+
+	for(i = 0; i < bitmap->count; i++) {
+		container = &bitmap->containers[i];
+		high = (uint32_t)container->key << 16;
+
+		if(container->type == CONTAINER_ARRAY) {
+			for(j = 0; j < container->cardinality; j++) {
+				(*array)[count++] = high | container->data.array[j];
+			}
+		} else {
+			for(j = 0; j < BITSET_WORDS; j++) {
+				for(word = container->data.words[j]; word != 0; word &= word - 1) {
+					(*array)[count++] = high | (j * 64 + __builtin_ctzll(word));
+				}
+			}
+		}
+	}
+
+	assert(count == bitmap->cardinality);
+	return count;
+} /* bitmap_to_array */
+
+long bitmap_memory_usage(const struct bitmap *bitmap) {
+	long bytes = sizeof(*bitmap) + bitmap->capacity * sizeof(*bitmap->containers);
+	int i = 0;
+
+	for(i = 0; i < bitmap->count; i++) {
+		if(bitmap->containers[i].type == CONTAINER_ARRAY) {
+			bytes += bitmap->containers[i].capacity * sizeof(uint16_t);
+		} else {
+			bytes += BITSET_WORDS * sizeof(uint64_t);
+		}
+	}
+
+	return bytes;
+} /* bitmap_memory_usage */
@@ -0,0 +1,133 @@
+/**
+ * Compressed bitmaps of file IDs. The 32-bit ID space is split into chunks of
+ * 65536 IDs. Each non-empty chunk is stored in a container, either as a sorted
+ * array of the low 16 bits (sparse chunks) or as a 65536-bit bitset (dense
+ * chunks), in the style of roaring bitmaps. Intersections, differences and
+ * cardinalities work container by container without decompressing.
+ *
+ * @file tagfs_bitmap.h
+ * @author Keith Woelke
+ * @date 10/17/2026
+ */
+
+#ifndef TAGFS_BITMAP_H
+#define TAGFS_BITMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bitmap;
+
+/**
+ * Create an empty bitmap. The bitmap must be free'd with bitmap_free().
+ *
+ * @return The new bitmap.
+ */
+struct bitmap *bitmap_new();
+
+/**
+ * Create a bitmap holding the values of an array. The array does not need to
+ * be sorted. The bitmap must be free'd with bitmap_free().
+ *
+ * @param array The values to add.
+ * @param count The number of values in the array.
+ * @return The new bitmap.
+ */
+struct bitmap *bitmap_from_array(const int *array, int count);
+
+/**
+ * Create a copy of a bitmap. The copy must be free'd with bitmap_free().
+ *
+ * @param bitmap The bitmap to copy.
+ * @return The copy.
+ */
+struct bitmap *bitmap_copy(const struct bitmap *bitmap);
+
+/**
+ * Free a bitmap and set the pointer to NULL.
+ *
+ * @param bitmap A pointer to the bitmap to free.
+ */
+void bitmap_free(struct bitmap **bitmap);
+
+/**
+ * Add a value to a bitmap.
+ *
+ * @param bitmap The bitmap.
+ * @param value The value to add.
+ * @return True, if the value was added. False, if it was already present.
+ */
+bool bitmap_add(struct bitmap *bitmap, uint32_t value);
+
+/**
+ * Remove a value from a bitmap.
+ *
+ * @param bitmap The bitmap.
+ * @param value The value to remove.
+ * @return True, if the value was removed. False, if it was not present.
+ */
+bool bitmap_remove(struct bitmap *bitmap, uint32_t value);
+
+/**
+ * Checks if a bitmap contains a value.
+ *
+ * @param bitmap The bitmap.
+ * @param value The value to look for.
+ * @return True, if the value is present. False, otherwise.
+ */
+bool bitmap_contains(const struct bitmap *bitmap, uint32_t value);
+
+/**
+ * Returns the number of values in a bitmap. Runs in constant time.
+ *
+ * @param bitmap The bitmap.
+ * @return The number of values in the bitmap.
+ */
+int bitmap_cardinality(const struct bitmap *bitmap);
+
+/**
+ * Intersect a bitmap with another one, keeping the result in the first.
+ *
+ * @param a The bitmap to intersect. Holds the result.
+ * @param b The bitmap to intersect with.
+ */
+void bitmap_and_inplace(struct bitmap *a, const struct bitmap *b);
+
+/**
+ * Remove the values of a bitmap from another one, keeping the result in the
+ * first.
+ *
+ * @param a The bitmap to remove values from. Holds the result.
+ * @param b The values to remove.
+ */
+void bitmap_andnot_inplace(struct bitmap *a, const struct bitmap *b);
+
+/**
+ * Returns the number of values two bitmaps have in common, without building
+ * their intersection.
+ *
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @return The cardinality of the intersection.
+ */
+int bitmap_and_cardinality(const struct bitmap *a, const struct bitmap *b);
+
+/**
+ * Copy the values of a bitmap into a new array, in ascending order. The array
+ * must be free'd by the caller.
+ *
+ * @param bitmap The bitmap.
+ * @param array OUT: The values of the bitmap. Left as NULL if the bitmap is empty.
+ * @return The number of values in the array.
+ */
+int bitmap_to_array(const struct bitmap *bitmap, int **array);
+
+/**
+ * Returns the number of bytes used by a bitmap.
+ *
+ * @param bitmap The bitmap.
+ * @return The memory used by the bitmap, in bytes.
+ */
+long bitmap_memory_usage(const struct bitmap *bitmap);
+
+#endif
@@ -0,0 +1,190 @@
+#include "tagfs_arena.h"
+#include "tagfs_bitmap.h"
+#include "tagfs_cache.h"
+#include "tagfs_common.h"
+#include "tagfs_debug.h"
+#include "tagfs_index.h"
+
+#include <assert.h>
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+
+/**
+ * A resolved path, along with the tag generations it was resolved against.
+ */
+struct path_entry {
+	int file_id; /* 0 if the path names no file */
+	bool folder;
+	struct bitmap *files; /* files at the path */
+	int num_tags;
+	int *tags; /* tags the resolution read. -1 for a name which did not resolve. */
+	unsigned int *generations; /* generation of each tag at resolution time */
+};
+
+struct path_cache {
+	pthread_mutex_t lock; /* readers share the tag lock, so the table needs its own */
+	GHashTable *entries; /* normalized path -> struct path_entry */
+};
+
+/**
+ * Free a cache entry. Used as the value destructor of the hash table.
+ *
+ * @param data The entry to free.
+ */
+static void path_entry_free(gpointer data) {
+	struct path_entry *entry = data;
+
+	bitmap_free(&entry->files);
+	free(entry->tags);
+	free(entry->generations);
+	free(entry);
+} /* path_entry_free */
+
+/**
+ * Checks if the tags an entry was resolved against are unchanged.
+ *
+ * @param entry The cache entry.
+ * @return True, if the entry is still valid. False, otherwise.
+ */
+static bool path_entry_valid(const struct path_entry *entry) {
+	int i = 0;
+
+	for(i = 0; i < entry->num_tags; i++) {
+		if(index_tag_generation(entry->tags[i]) != entry->generations[i]) {
+			return false;
+		}
+	}
+
+	return true;
+} /* path_entry_valid */
+
+void path_cache_init() {
+	struct path_cache *cache = NULL;
+	int rc = 0; /* return code of pthread operation */
+
+	DEBUG(ENTRY);
+
+	cache = malloc(sizeof(*cache));
+	assert(cache != NULL);
+
+	rc = pthread_mutex_init(&cache->lock, NULL);
+	assert(rc == 0);
+	cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, free, path_entry_free);
+
+	TAGFS_DATA->path_cache = cache;
+
+	DEBUG(EXIT);
+} /* path_cache_init */
+
+void path_cache_destroy() {
+	struct path_cache *cache = TAGFS_DATA->path_cache;
+
+	DEBUG(ENTRY);
+
+	assert(cache != NULL);
+
+	g_hash_table_destroy(cache->entries);
+	pthread_mutex_destroy(&cache->lock);
+	free_single_ptr((void **)&TAGFS_DATA->path_cache);
+
+	DEBUG(EXIT);
+} /* path_cache_destroy */
+
+char *path_cache_key(const char *path) {
+	char *key = NULL;
+	int i = 0;
+	int length = 0;
+
+	assert(path != NULL);
+
+	key = arena_alloc(strlen(path) + 2);
+
+	key[length++] = '/';
+
+	for(i = 0; path[i] != '\0'; i++) {
+		if(path[i] != '/' || key[length - 1] != '/') {
+			key[length++] = path[i];
+		}
+	}
+
+	if(length > 1 && key[length - 1] == '/') {
+		length--;
+	}
+
+	key[length] = '\0';
+	return key;
+} /* path_cache_key */
+
+bool path_cache_lookup(const char *key, int *file_id, bool *folder, struct bitmap **files) {
+	bool found = false;
+	struct path_cache *cache = TAGFS_DATA->path_cache;
+	struct path_entry *entry = NULL;
+
+	DEBUG(ENTRY);
+
+	pthread_mutex_lock(&cache->lock);
+
+	entry = g_hash_table_lookup(cache->entries, key);
+
+	if(entry != NULL && !path_entry_valid(entry)) {
+		DEBUG("Dropping stale cache entry for %s", key);
+		g_hash_table_remove(cache->entries, key);
+		entry = NULL;
+	}
+
+	if(entry != NULL) {
+		*file_id = entry->file_id;
+		*folder = entry->folder;
+
+		if(files != NULL) {
+			*files = bitmap_copy(entry->files);
+		}
+
+		found = true;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	DEBUG("Path cache %s for %s", found ? "hit" : "miss", key);
+	DEBUG(EXIT);
+	return found;
+} /* path_cache_lookup */
+
+void path_cache_insert(const char *key, int file_id, bool folder, const struct bitmap *files, const int *tags, int num_tags) {
+	struct path_cache *cache = TAGFS_DATA->path_cache;
+	struct path_entry *entry = NULL;
+	int i = 0;
+
+	DEBUG(ENTRY);
+
+	entry = malloc(sizeof(*entry));
+	assert(entry != NULL);
+	entry->file_id = file_id;
+	entry->folder = folder;
+	entry->files = bitmap_copy(files);
+	entry->num_tags = num_tags;
+	entry->tags = malloc((num_tags > 0 ? num_tags : 1) * sizeof(*entry->tags));
+	assert(entry->tags != NULL);
+	entry->generations = malloc((num_tags > 0 ? num_tags : 1) * sizeof(*entry->generations));
+	assert(entry->generations != NULL);
+
+	for(i = 0; i < num_tags; i++) {
+		entry->tags[i] = tags[i];
+		entry->generations[i] = index_tag_generation(tags[i]);
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	if(g_hash_table_size(cache->entries) >= TAGFS_PATH_CACHE_SIZE) {
+		DEBUG("Path cache is full, clearing %d entries", g_hash_table_size(cache->entries));
+		g_hash_table_remove_all(cache->entries);
+	}
+
+	g_hash_table_replace(cache->entries, strdup(key), entry);
+
+	pthread_mutex_unlock(&cache->lock);
+
+	DEBUG("Cached %s: file ID %d, %sa folder", key, file_id, folder ? "" : "not ");
+	DEBUG(EXIT);
+} /* path_cache_insert */
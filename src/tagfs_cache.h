@@ -0,0 +1,67 @@
+/**
+ * Cache of resolved paths. Maps a normalized path to what it resolved to: the
+ * file it names, whether it is a folder, and the files found at it. Each entry
+ * remembers the generation of every tag its resolution read (see
+ * index_tag_generation()), so an entry is dropped as soon as one of those tags
+ * gains or loses a file, and entries for unrelated tags survive.
+ *
+ * Entries must be looked up and inserted while holding the tag lock, so the
+ * generations cannot change while a path is being resolved.
+ *
+ * @file tagfs_cache.h
+ * @author Keith Woelke
+ * @date 10/17/2026
+ */
+
+#ifndef TAGFS_CACHE_H
+#define TAGFS_CACHE_H
+
+#include <stdbool.h>
+
+struct bitmap;
+
+/**
+ * Create the path cache. Must be called once from tagfs_init, after
+ * index_init().
+ */
+void path_cache_init();
+
+/**
+ * Free the path cache. Must be called once from tagfs_destroy.
+ */
+void path_cache_destroy();
+
+/**
+ * Normalize a path for use as a cache key, collapsing repeated slashes and
+ * dropping a trailing slash. The returned string is in the request arena, see
+ * tagfs_arena.h.
+ *
+ * @param path A string representing a path in the filesystem.
+ * @return The normalized path.
+ */
+char *path_cache_key(const char *path);
+
+/**
+ * Look up a resolved path.
+ *
+ * @param key The normalized path, as returned by path_cache_key().
+ * @param file_id OUT: The ID of the file the path names, or 0 if it names no file.
+ * @param folder OUT: True, if the path is a valid folder.
+ * @param files OUT: A copy of the files at the path, to be free'd with bitmap_free(). Not filled in if NULL.
+ * @return True, if the path was cached and is still valid. False, otherwise.
+ */
+bool path_cache_lookup(const char *key, int *file_id, bool *folder, struct bitmap **files);
+
+/**
+ * Store a resolved path.
+ *
+ * @param key The normalized path, as returned by path_cache_key().
+ * @param file_id The ID of the file the path names, or 0 if it names no file.
+ * @param folder True, if the path is a valid folder.
+ * @param files The files at the path. The cache keeps its own copy.
+ * @param tags The IDs of the tags the resolution read. -1 stands for a tag name which did not resolve.
+ * @param num_tags The number of tag IDs.
+ */
+void path_cache_insert(const char *key, int file_id, bool folder, const struct bitmap *files, const int *tags, int num_tags);
+
+#endif
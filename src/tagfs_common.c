@@ -1,202 +1,196 @@
+#include "tagfs_arena.h"
+#include "tagfs_bitmap.h"
+#include "tagfs_cache.h"
 #include "tagfs_common.h"
+#include "tagfs_cooccur.h"
 #include "tagfs_db.h"
 #include "tagfs_debug.h"
+#include "tagfs_dict.h"
+#include "tagfs_folders.h"
+#include "tagfs_index.h"
+#include "tagfs_path.h"
 
 #include <assert.h>
-#include <glib.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
 
 /**
- * Given a hash table, remove all matching path elements (tags).
+ * Returns the files carrying every tag of a path view as a bitmap. The tags are
+ * intersected from the one with the fewest files up, and the intersection stops
+ * as soon as it is empty.
  *
- * @param path A directory path.
- * @param table The hash table from which to remove all matching path elements (tags).
+ * @param view The view of a path in the filesystem.
+ * @return The files at the path, to be free'd with bitmap_free(). Empty if there are none.
  */
-static int remove_path_from_hash_table(const char *path, GHashTable **table) {
-	char **path_array = NULL;
-	char *tag_name = NULL;
+static struct bitmap *files_bitmap_at_view(const struct path_view *view) {
+	const struct bitmap **tag_files = NULL;
+	const struct bitmap *smallest = NULL;
+	struct bitmap *files = NULL;
 	int i = 0;
-	int num_tags_in_path = 0;
-	long unsigned int tag_id = 0;
+	int j = 0;
+	int num_tokens = view->num_tags;
+	int tag_id = 0;
 
 	DEBUG(ENTRY);
-	DEBUG("Removing tags from %s from hash table of size %d", path, g_hash_table_size(*table));
 
-	num_tags_in_path = path_to_array(path, &path_array);
+	if(num_tokens == 0) { /* if root */
+		DEBUG("Retrieving a list of files with no tags for root view.");
+		/* get all untagged files */
+		tag_id = dict_tag_id("/");
+		assert(tag_id >= 0);
+		smallest = index_files_bitmap(tag_id);
+		files = smallest != NULL ? bitmap_copy(smallest) : bitmap_new();
+	} else {
+		tag_files = arena_alloc(num_tokens * sizeof(*tag_files));
 
-	for(i = 0; i < num_tags_in_path; i++) {
-		tag_name = path_array[i];
-		tag_id = db_tag_id_from_tag_name(tag_name);
+		/* look up the files of every tag first, stopping at a tag without any */
+		for(i = 0; i < num_tokens; i++) {
+			tag_id = dict_tag_id_slice(path_tag(view, i), path_tag_length(view, i));
+			tag_files[i] = tag_id > 0 ? index_files_bitmap(tag_id) : NULL;
 
-		g_hash_table_remove(*table, (gpointer)tag_id);
-	}
+			if(tag_files[i] == NULL || bitmap_cardinality(tag_files[i]) == 0) {
+				if(i == 0 && tag_id > 0) { /* This shouldn't happen if database is purged properly after a delete */
+					/* only the tag read lock is held here, the next db_batch_commit() purges empty tags */
+					WARN("Tag ID %d has no files.", tag_id);
+				}
 
-	if(num_tags_in_path > 0) {
-		free_double_ptr((void ***)&path_array, num_tags_in_path);
-	}
+				break;
+			}
+		}
 
-	DEBUG("Returning a hash table of size %d", g_hash_table_size(*table));
-	DEBUG(EXIT);
-	return g_hash_table_size(*table);
-} /* remove_path_from_hash_table */
+		if(i == num_tokens) {
+			/* intersect the rarest tags first, so the running set starts small and stays small */
+			for(i = 1; i < num_tokens; i++) {
+				smallest = tag_files[i];
 
-/**
- * Swaps two integers.
- *
- * @param a The first integer.
- * @param b The second integer.
- */
-static void swap(int *a, int *b) {
-	int temp = *a;
+				for(j = i; j > 0 && bitmap_cardinality(tag_files[j - 1]) > bitmap_cardinality(smallest); j--) {
+					tag_files[j] = tag_files[j - 1];
+				}
 
-	DEBUG(ENTRY);
+				tag_files[j] = smallest;
+			}
 
-	assert(a != NULL);
-	assert(b != NULL);
+			DEBUG("%d file(s) with the rarest tag of %s.", bitmap_cardinality(tag_files[0]), view->path);
+			files = bitmap_copy(tag_files[0]);
 
-	*a = *b;
-	*b = temp;
+			for(i = 1; i < num_tokens && bitmap_cardinality(files) > 0; i++) {
+				bitmap_and_inplace(files, tag_files[i]);
+			}
+		} else { /* path is not valid */
+			files = bitmap_new();
+		}
+	}
 
+	DEBUG("%d file(s) at %s.", bitmap_cardinality(files), view->path);
 	DEBUG(EXIT);
-} /* swap */
+	return files;
+} /* files_bitmap_at_view */
 
 /**
- * Sifts the largest values to the bottom of the heap.
+ * Resolves a path to the file it names, and whether it is a folder. Results are
+ * kept in the path cache, so only the first lookup of a path (or the first one
+ * after one of its tags changed) computes the files at the path and looks the
+ * file name up in the database. Must be called with the tag lock held.
  *
- * @param array The array to be sifted.
- * @param start The beginning of the array segment to sift.
- * @param end The end of the array segment to sift.
+ * @param path A string representing a path in the filesystem.
+ * @param folder OUT: True, if the path is a valid folder. Not filled in if NULL.
+ * @param files OUT: The files at the path, to be free'd with bitmap_free(). Not filled in if NULL.
+ * @return The ID of the file the path names, or 0 if it names no file.
  */
-static void sift_down(int *array, int start, int end) {
-	int child = 0;
-	int root = start;
-	int save_swap = 0;
+static int resolve_path(const char *path, bool *folder, struct bitmap **files) {
+	bool is_folder = false;
+	char *key = NULL;
+	int *tags = NULL;
+	struct bitmap *path_files = NULL;
+	int file_id = 0;
+	int i = 0;
+	int num_tags = 0;
+	int num_tokens = 0;
+	struct path_view view;
 
 	DEBUG(ENTRY);
 
-	assert(array != NULL);
-	assert(start >= 0);
-	assert(end >= 0);
-	assert(start <= end);
+	key = path_cache_key(path);
 
-	while (root * 2 + 1 <= end) {
-		child = root * 2 + 1;
-		save_swap = root;
+	if(!path_cache_lookup(key, &file_id, &is_folder, files)) {
+		num_tokens = path_split(key, &view);
 
-		if (array[save_swap] < array[child]) {
-			save_swap = child;
-		}
+		/* remember every tag the resolution reads, so tag changes can invalidate it */
+		tags = arena_alloc((num_tokens + 1) * sizeof(*tags));
 
-		if (child + 1 <= end && array[save_swap] < array[child + 1]) {
-			save_swap = child + 1;
+		for(i = 0; i < num_tokens; i++) {
+			tags[num_tags++] = dict_tag_id_slice(path_tag(&view, i), path_tag_length(&view, i));
 		}
 
-		if (save_swap != root) {
-			swap(&array[root], &array[save_swap]);
-			root = save_swap;
-		} else {
-			return;
+		if(num_tokens <= 1) { /* the path or its parent is the root, which lists the untagged files */
+			tags[num_tags++] = 0;
 		}
-	}
 
-	DEBUG(EXIT);
-} /* sift_down */
+		path_files = files_bitmap_at_view(&view);
+		is_folder = num_tokens == 0 || (path_distinct_tags(&view) == num_tokens && bitmap_cardinality(path_files) > 0);
 
-/**
- * Puts the array into max-heap form.
- *
- * @param array The array to be heapified.
- * @param count The number of elements in the array.
- */
-static void heapify(int *array, int count) {
-	int start = count / 2 - 1;
+		if(num_tokens > 0) { /* the last element is the file name, the rest are the tags of its directory */
+			file_id = db_file_id_from_path(&view);
+		}
 
-	DEBUG(ENTRY);
+		path_cache_insert(key, file_id, is_folder, path_files, tags, num_tags);
 
-	assert(array != NULL);
-	assert(count > 0);
+		if(files != NULL) {
+			*files = path_files;
+		} else {
+			bitmap_free(&path_files);
+		}
+	}
 
-	while (start >= 0) {
-		sift_down(array, start--, count - 1);
+	if(folder != NULL) {
+		*folder = is_folder;
 	}
 
+	DEBUG("%s resolved to file ID %d, %sa folder", path, file_id, is_folder ? "" : "not ");
 	DEBUG(EXIT);
-} /* heapify */
+	return file_id;
+} /* resolve_path */
 
-/**
- * Sorts an array of integers using the heap sort algorithm.
- *
- * @param array The array of integers to be sorted.
- * @param count The number of elements in the array.
- */
-static void heap_sort(int *array, int count) {
-	int end = 0;
+void tag_lock_init() {
+	int rc = 0; /* return code of pthread operation */
 
 	DEBUG(ENTRY);
 
-	assert(array != NULL);
-	assert(count > 0);
-
-	heapify(array, count);
-
-	end = count - 1;
-
-	while (end > 0) {
-		swap(&array[end], &array[0]);
-		sift_down(array, 0, --end);
-	}
+	rc = pthread_rwlock_init(&TAGFS_DATA->tag_lock, NULL);
+	assert(rc == 0);
 
 	DEBUG(EXIT);
-} /* heap_sort */
-
-/**
- * Calculates if all of the elements in a path are unique.
- *
- * @param path The path to check.
- * @return True, if all path elements are unique. False, otherwise.
- */
-static bool unique_tags_in_path(const char *path) {
-	bool unique = true;
-	char **tag_array = NULL;
-	char **tags_checked = NULL;
-	char *tag = NULL;
-	int i = 0;
-	int num_tokens = 0;
+} /* tag_lock_init */
 
+void tag_lock_destroy() {
 	DEBUG(ENTRY);
 
-	assert(path != NULL);
+	pthread_rwlock_destroy(&TAGFS_DATA->tag_lock);
 
-	/* break path into tags and create array to hold checked tags */
-	DEBUG("Checking uniqueness of tags in %s", path);
-	num_tokens = path_to_array(path, &tag_array);
-	DEBUG("Number of tokens: %d", num_tokens);
-	tags_checked = malloc(num_tokens * sizeof(*tags_checked));
-	assert(tags_checked != NULL);
+	DEBUG(EXIT);
+} /* tag_lock_destroy */
 
-	for(i = 0; i < num_tokens; i++) {
-		assert(tag_array != NULL);
-		tag = tag_array[i];
+void tag_read_lock() {
+	int rc = 0; /* return code of pthread operation */
 
-		if(array_contains_string((const char **)tags_checked, tag, i)) { /* if token is a duplicate */
-			unique = false;
-			break;
-		}
+	rc = pthread_rwlock_rdlock(&TAGFS_DATA->tag_lock);
+	assert(rc == 0);
+} /* tag_read_lock */
 
-		/* save checked tag */
-		tags_checked[i] = strdup(tag_array[i]);
-		assert(tags_checked[i] != NULL);
-	}
+void tag_write_lock() {
+	int rc = 0; /* return code of pthread operation */
 
-	free_double_ptr((void ***)&tag_array, num_tokens);
-	free_double_ptr((void ***)&tags_checked, i);
+	rc = pthread_rwlock_wrlock(&TAGFS_DATA->tag_lock);
+	assert(rc == 0);
+} /* tag_write_lock */
 
-	DEBUG("Tags in path are %sunique", unique ? "" : "not ");
-	DEBUG(EXIT);
-	return unique;
-	return true;
-} /* unique_tags_in_path */
+void tag_unlock() {
+	int rc = 0; /* return code of pthread operation */
+
+	rc = pthread_rwlock_unlock(&TAGFS_DATA->tag_lock);
+	assert(rc == 0);
+} /* tag_unlock */
 
 int num_digits(unsigned int num) {
 	int count = 0;
@@ -218,51 +212,22 @@ int num_digits(unsigned int num) {
 
 char *get_exec_dir(const char *exec_name) {
 	char *exec_dir = NULL;
-	char *real_path = NULL;
+	char *slash = NULL;
 
 	assert(exec_name != NULL);
 
-	real_path = realpath(exec_name, NULL);
-	exec_dir = dirname(real_path);
-	free_single_ptr((void **)&real_path);
+	/* cut the executable name off in place, since this runs before any request arena exists */
+	exec_dir = realpath(exec_name, NULL);
+	assert(exec_dir != NULL);
+	slash = strrchr(exec_dir, '/');
+	slash += slash == exec_dir; /* keep the root */
+	*slash = '\0';
 
 	return exec_dir;
 } /* get_exec_dir */
 
-char *file_name_from_id(int file_id) {
-	char *file_location = NULL;
-	char *file_name = NULL;
-	char *tmp_file_name = NULL;
-	int file_name_length = 0;
-	int written = 0; /* number of characters written by snprintf */
-
-	DEBUG(ENTRY);
-	DEBUG("Retrieving file name of file id %d", file_id);
-
-	/* get file location */
-	file_location = db_get_file_location(file_id);
-
-	/* get file name from file location */
-	tmp_file_name = basename(file_location);
-
-	file_name_length = strlen(tmp_file_name);
-	file_name = malloc(file_name_length * sizeof(*file_name) + 1);
-	assert(file_name != NULL);
-	written = snprintf(file_name, file_name_length + 1, "%s", tmp_file_name);
-	free_single_ptr((void **)&tmp_file_name);
-	assert(written == file_name_length);
-
-	free_single_ptr((void **)&file_location);
-
-	DEBUG("File name of file ID %d is %s", file_id, file_name);
-	DEBUG(EXIT);
-	return file_name;
-} /* file_name_from_id */
-
 bool valid_path_to_folder(const char *path) {
 	bool valid = false;
-	int *file_array = NULL;
-	int num_files = 0;
 
 	DEBUG(ENTRY);
 
@@ -270,30 +235,18 @@ bool valid_path_to_folder(const char *path) {
 
 	DEBUG("Checking that %s is a valid path to a folder", path);
 
-	if(strcmp(path, "/") == 0) { valid = true; }
-	else {
-		/* count files at location */
-		num_files = files_at_location(path, &file_array);
-
-		/* if tags are not unique (to prevent repeated filtering of identical tags) or there are no files at the location */
-		if(!unique_tags_in_path(path) || num_files == 0) { valid = false; }
-		else {
-			valid = true;
-			free_single_ptr((void **)&file_array);
-		}
-	}
+	resolve_path(path, &valid, NULL);
 
-	DEBUG("%s is %sa valid path to a folder", path, valid ? "" : "not a ");
+	DEBUG("%s is %sa valid path to a folder", path, valid ? "" : "not ");
 	DEBUG(EXIT);
 	return valid;
 } /* valid_path_to_folder */
 
 int path_to_array(const char *path, char ***array) {
 	char *tmp_path = NULL;
-	char *tok_ptr = NULL;
-	char *token = NULL;
 	int i = 0;
 	int num_tokens = 0;
+	struct path_view view;
 
 	DEBUG(ENTRY);
 
@@ -302,29 +255,21 @@ int path_to_array(const char *path, char ***array) {
 
 	DEBUG("Converting %s to array", path);
 
-	if(strcmp(path, "/") != 0) {
-		/* calculate the number of tags in the path */
-		num_tokens = num_tags_in_path(path);
-		DEBUG("Number of tokens in path: %d", num_tokens);
+	num_tokens = path_split(path, &view);
 
-		*array = malloc(num_tokens * sizeof(**array));
-		assert(*array != NULL);
+	if(num_tokens > 0) {
+		*array = arena_alloc(num_tokens * sizeof(**array));
 
-		tmp_path = strdup(path);
-		assert(tmp_path != NULL);
+		/* terminate every tag in one copy of the path, so the tags point into it */
+		tmp_path = path_slice_strdup(path, (struct path_slice){ 0, strlen(path) });
 
-		/* copy tags from path into an array */
-		token = strtok_r(tmp_path, "/", &tok_ptr);
 		DEBUG("Array contents:");
-		for(i = 0; token != NULL; i++) {
-			(*array)[i] = strdup(token);
-			assert((*array)[i] != 0);
+		for(i = 0; i < num_tokens; i++) {
+			(*array)[i] = tmp_path + view.tags[i].offset;
+			(*array)[i][view.tags[i].length] = '\0';
 			DEBUG("array[%d] = %s, at address %p.", i, (*array)[i], (*array)[i]);
-			token = strtok_r(NULL, "/", &tok_ptr);
 		}
 
-		free_single_ptr((void **)&tmp_path);
-
 		DEBUG("Returning array from %s with %d element(s).", path, num_tokens);
 	}
 
@@ -332,32 +277,6 @@ int path_to_array(const char *path, char ***array) {
 	return num_tokens;
 } /* path_to_array */
 
-int num_tags_in_path(const char *path) {
-	char *tmp_path = NULL;
-	char *tok_ptr = NULL;
-	char *token = NULL;
-	int i = 0;
-
-	DEBUG(ENTRY);
-
-	assert(path != NULL);
-
-	DEBUG("Calculating number of tags in %s", path);
-
-	tmp_path = strdup(path);
-	assert(tmp_path != 0);
-	token = strtok_r(tmp_path, "/", &tok_ptr);
-
-	/* count tokens */
-	for(i = 0; token != NULL; i++) { token = strtok_r(NULL, "/", &tok_ptr); }
-
-	free_single_ptr((void **)&tmp_path);
-
-	DEBUG("%d tags in %s", i, path);
-	DEBUG(EXIT);
-	return i;
-} /* num_tags_in_path */
-
 bool array_contains_string(const char **array, const char *string, int count) {
 	bool contains = false;
 	int i = 0;
@@ -390,91 +309,35 @@ void free_single_ptr(void **ptr) {
 	*ptr = NULL;
 } /* free_single_ptr */
 
-void free_double_ptr(void ***array, int count) {
-	int i = 0;
-
-	DEBUG(ENTRY);
-
-	assert(*array != NULL);
-	assert(count >= 0);
-
-	DEBUG("Attempting to free array of %d pointer(s) plus the main pointer.", count);
-
-	assert(*array != NULL);
-
-	/* free each element */
-	for(i = 0; i < count; i++) {
-		free_single_ptr((void **)&(*array)[i]);
-	}
-
-	DEBUG("Free'd %d element(s).", i);
-
-	free_single_ptr((void **)array);
-
-	DEBUG("Free'd main array pointer.");
-
-	DEBUG(EXIT);
-} /* free_double_ptr */
-
-int smart_tags_from_files(const char *path, int *files, int num_files, int **tags) {
-	GHashTable *table = NULL;
-	GHashTableIter iter;
-	gpointer key = NULL;
-	gpointer value = NULL;
-	int *file_array = NULL;
-	int *files_with_tag = NULL;
-	int exclude_tags_count = 0;
+int smart_tags_from_files(const char *path, int **tags) {
+	int *tag_ids = NULL;
 	int i = 0;
-	int num_files_with_tag = 0;
-	int popular_tag = -1;
+	int num_folders = 0;
+	int num_tokens = 0;
+	struct path_view view;
 
 	DEBUG(ENTRY);
-	DEBUG("Browsing for minimal set of tags on %d files at %s", num_files, path);
-
-	/* populate hash table with file IDs */
-	table = g_hash_table_new(NULL, NULL);
-	for(i = 0; i < num_files; i++) {
-		g_hash_table_insert(table, GINT_TO_POINTER(files[i]), GINT_TO_POINTER(files[i]));
-	}
-
-	/* find most popular tags */
-	while(popular_tag != 0) {
-		num_files = g_hash_table_size(table);
-		file_array = malloc(sizeof(*file_array) * num_files);
+	DEBUG("Browsing for minimal set of tags at %s", path);
 
-		i = 0;
-		g_hash_table_iter_init(&iter, table); /* copy files from hash table to array */
-		while(g_hash_table_iter_next(&iter, &key, &value)) {
-				file_array[i++] = GPOINTER_TO_INT(key);
-		}
-
-		popular_tag = most_popular_tag_on_files_at_location(path, file_array, num_files, tags, &exclude_tags_count);
-
-		free_single_ptr((void *)&file_array);
-
-		num_files_with_tag = db_files_from_tag_id(popular_tag, &files_with_tag);
+	num_tokens = path_split(path, &view);
+	tag_ids = arena_alloc((num_tokens > 0 ? num_tokens : 1) * sizeof(*tag_ids));
 
-		/* remove files with most popular tag from hash table */
-		for(i = 0; i < num_files_with_tag; i++) {
-			g_hash_table_remove(table, GINT_TO_POINTER(files_with_tag[i]));
-		}
-
-		if(files_with_tag != NULL) {
-			free_single_ptr((void *)&files_with_tag);
-		}
+	for(i = 0; i < num_tokens; i++) {
+		tag_ids[i] = dict_tag_id_slice(path_tag(&view, i), path_tag_length(&view, i));
+		assert(tag_ids[i] > 0); /* only called for locations with files */
 	}
 
-	g_hash_table_destroy(table);
+	num_folders = folder_cache_folders(tag_ids, num_tokens, tags);
 
-	DEBUG("Returning %d tags", exclude_tags_count);
+	DEBUG("Returning %d tags", num_folders);
 	DEBUG(EXIT);
-	return exclude_tags_count;
+	return num_folders;
 } /* smart_tags_from_files */
 
 int folders_at_location(const char *path, int *files, int num_files, int **folders) {
 	bool FAST_BROWSE = false;
-	int *file_array = NULL;
 	int num_folders = 0;
+	struct path_view view;
 
 	DEBUG(ENTRY);
 
@@ -490,9 +353,7 @@ int folders_at_location(const char *path, int *files, int num_files, int **folde
 		if(FAST_BROWSE) {
 			num_folders = db_get_all_tags(folders);
 		} else {
-			num_files = db_get_all_files(&file_array);
-			num_folders = smart_tags_from_files(path, file_array, num_files, folders);
-			free_single_ptr((void *)&file_array);
+			num_folders = smart_tags_from_files(path, folders);
 		}
 
 		assert(num_folders >= 0);
@@ -501,9 +362,17 @@ int folders_at_location(const char *path, int *files, int num_files, int **folde
 	/* get all tags on file array */
 	else {
 		if(FAST_BROWSE) {
-			num_folders = db_tags_from_files(files, num_files, folders);
+			num_folders = -1;
+
+			if(path_split(path, &view) == 1) { /* one level below root, the co-occurrence matrix knows the tags */
+				num_folders = cooccur_tags_with(dict_tag_id_slice(path_tag(&view, 0), path_tag_length(&view, 0)), folders);
+			}
+
+			if(num_folders < 0) {
+				num_folders = index_tags_from_files(files, num_files, folders);
+			}
 		} else {
-			num_folders = smart_tags_from_files(path, files, num_files, folders);
+			num_folders = smart_tags_from_files(path, folders);
 		}
 
 		assert(num_folders >= 0);
@@ -562,191 +431,35 @@ int array_intersection(int *a, int a_size, int *b, int b_size, int **intersectio
 	return intersection_index;
 } /* array_intersection */
 
-int files_at_location(const char *path, int **file_array) {
-	char **tag_array = NULL;
-	int *cur_files = NULL;
-	int *intersection_files = NULL;
-	int *prev_files = NULL;
-	int i = 0;
-	int num_cur_files = 0;
-	int num_intersection_files = 0;
-	int num_prev_files = 0;
-	int num_tokens = 0;
-	int tag_id = 0;
-
-	DEBUG(ENTRY);
-
-	assert(path != NULL);
-	assert(*file_array == NULL);
-
-	num_tokens = path_to_array(path, &tag_array);
-	DEBUG("Path broken up into %d tokens for %s.", num_tokens, path);
-
-	if(num_tokens == 0) { /* if root */
-		DEBUG("Retrieving a list of files with no tags for root view.");
-		/* get all untagged files */
-		tag_id = db_tag_id_from_tag_name("/");
-		assert(tag_id >= 0);
-		num_prev_files = db_files_from_tag_id(tag_id, &prev_files);
-	} else {
-		DEBUG("Retrieving files for %s.", tag_array[i]);
-		tag_id = db_tag_id_from_tag_name(tag_array[i]); /* get tag ID for first tag */
-
-		if(tag_id >= 0) { /* if first tag is valid */
-			DEBUG("Tag ID of %s is %d.", tag_array[i], tag_id);
-			num_prev_files = db_files_from_tag_id(tag_id, &prev_files);
-
-			if(num_prev_files == 0 && tag_id != 0) { /* This shouldn't happen if database is purged properly after a delete */
-				WARN("Tag ID %d has no files.", tag_id);
-				WARN("Purging database of tag ID %d", tag_id);
-
-				db_delete_tag(tag_id);
-			} else if(num_prev_files > 0) {
-				DEBUG("%d file(s) with %s tag.", num_prev_files, tag_array[i]);
-
-				for(i = 1; i < num_tokens; i++) {
-					tag_id = db_tag_id_from_tag_name(tag_array[i]); /* get files with tag */
-
-					if(tag_id > 0) { /* if tag is valid */
-						num_cur_files = db_files_from_tag_id(tag_id, &cur_files);
-
-						if(num_prev_files > 0) {
-							/* find intersection of both arrays */
-							heap_sort(prev_files, num_prev_files);
-							heap_sort(cur_files, num_cur_files);
-
-							num_intersection_files = array_intersection(prev_files, num_prev_files, cur_files, num_cur_files, &intersection_files);
-
-							free_single_ptr((void *)&cur_files);
-							free_single_ptr((void *)&prev_files);
-
-							/* assign result to prev_files array */
-							prev_files = intersection_files;
-							intersection_files = NULL;
-							num_prev_files = num_intersection_files;
-						}
-					}
-					else { /* path is not valid */
-						num_prev_files = 0;
-					}
-				}
-			}
-
-		}
-
-		free_double_ptr((void ***)&tag_array, num_tokens);
-	}
-
-	*file_array = prev_files;
-
-	DEBUG(EXIT);
-
-	return num_prev_files;
-} /* files_at_location */
-
-char *tag_name_from_tag_id(int tag_id) {
-	char *tag_name = NULL;
-
-	DEBUG(ENTRY);
-
-	assert(tag_id > 0);
-
-	DEBUG("Retrieving tag name from tag ID %d", tag_id);
-	tag_name = db_tag_name_from_tag_id(tag_id);
-
-	DEBUG("Tag ID %d has name of %s", tag_id, tag_name);
-	DEBUG(EXIT);
-	return tag_name;
-} /* file_name_from_id */
-
-char *dirname(const char *path) {
-	char *tmp_path = NULL;
-	int i = 0;
-	int length = 0;
-
-	assert(path != NULL);
-
-	tmp_path = strdup(path);
-	assert(tmp_path != NULL);
-
-	length = strlen(tmp_path);
-
-	for(i = length - 1; i >= 0; i--) {
-		if(i == 0) {
-			tmp_path[1] = '\0';
-		}
-		else if(tmp_path[i] == '/') {
-			tmp_path[i] = '\0';
-			break;
-		}
-	}
-
-	return tmp_path;
-} /* dirname */
-
-char *basename(const char *path) {
-	char *tmp_path = NULL;
-	int i = 0;
-	int j = 0;
-	int length = 0;
-
-	DEBUG(ENTRY);
+struct bitmap *files_bitmap_at_location(const char *path) {
+	struct path_view view;
 
 	assert(path != NULL);
 
-	DEBUG("Calculating the basename of %s", path);
-
-	tmp_path = strdup(path);
-	assert(tmp_path != NULL);
-
-	length = strlen(tmp_path);
-
-	for(i = length - 1; i >= 0; i--) {
-		if(tmp_path[i] == '/') {
-			i++; /* increment to start after the '/' character */
-
-			for(; i <= length; i++) {
-				tmp_path[j++] = tmp_path[i];		
-			}
-			break;
-		}
-	}
+	path_split(path, &view);
 
-	DEBUG("Base name is %s", tmp_path);
-	DEBUG(EXIT);
-	return tmp_path;
-} /* basename */
+	return files_bitmap_at_view(&view);
+} /* files_bitmap_at_location */
 
-bool valid_path_to_file(const char *path) {
-	bool valid = false;
-	int file_id = 0;
+int files_at_location(const char *path, int **file_array) {
+	struct bitmap *files = NULL;
+	int num_files = 0;
 
 	DEBUG(ENTRY);
 
 	assert(path != NULL);
+	assert(*file_array == NULL);
 
-	DEBUG("Checking if %s is a valid path to a file", path);
-
-	file_id = file_id_from_path(path);
-
-	if(file_id > 0) {
-		return true;
-	}
+	files = files_bitmap_at_location(path);
+	num_files = bitmap_to_array(files, file_array);
+	bitmap_free(&files);
 
-	DEBUG("%s is %sa valid file.", path, valid ? "" : "not "); 
 	DEBUG(EXIT);
-	return valid;
-} /* valid_path_to_file */
+	return num_files;
+} /* files_at_location */
 
 int file_id_from_path(const char *path) {
-	bool valid = false;
-	char *dirpath = NULL;
-	char *file_found = NULL;
-	char *filename = NULL;
-	int *file_array = NULL;
-	int file_count = 0;
 	int file_id = 0;
-	int i = 0;
 
 	DEBUG(ENTRY);
 
@@ -754,34 +467,7 @@ int file_id_from_path(const char *path) {
 
 	DEBUG("Retrieving file ID from %s", path);
 
-	dirpath = dirname(path);
-	filename = basename(path);
-
-	DEBUG("Retrieving files from %s", dirpath);
-	file_count = files_at_location(dirpath, &file_array);
-	DEBUG("%d files at %s", file_count, dirpath);
-	free_single_ptr((void **)&dirpath);
-
-	if(file_array != NULL) {
-		for(i = 0; i < file_count; i++) {
-			file_found = file_name_from_id(file_array[i]);
-
-			if(strcmp(file_found, filename) == 0) {
-				file_id = file_array[i];
-				valid = true;
-			}
-
-			free_single_ptr((void **)&file_found);
-
-			if(valid == true) {
-				break;
-			}
-		}
-
-		free_single_ptr((void **)&file_array);
-	}
-
-	free_single_ptr((void **)&filename);
+	file_id = resolve_path(path, NULL, NULL);
 
 	DEBUG("%s has file ID of %d.", path, file_id); 
 	DEBUG(EXIT);
@@ -802,15 +488,20 @@ char *get_file_location(int file_id) {
 } /* get_file_location */
 
 void delete_file(int file_id) {
+	struct db_batch *batch = NULL;
+
 	DEBUG(ENTRY);
 
-	db_delete_file(file_id);
-	db_delete_empty_tags();
+	batch = db_batch_begin();
+	db_batch_delete_file(batch, file_id);
+	db_batch_delete_empty_tags(batch);
+	db_batch_commit(&batch);
 
 	DEBUG(EXIT);
 } /* delete_file */
 
-void remove_tags(int file_id) {
+bool remove_tags(struct db_batch *batch, int file_id) {
+	bool last_file = false;
 	int *tags = NULL;
 	int i = 0;
 	int num_tags = 0;
@@ -825,10 +516,19 @@ void remove_tags(int file_id) {
 	DEBUG("File ID %d has %d tags to remove", file_id, num_tags);
 
 	for(i = 0; i < num_tags; i++) {
-		db_remove_tag_from_file(tags[i], file_id);
+		db_batch_remove_tag(batch, tags[i], file_id);
+
+		if(index_count_files_with_tag(tags[i]) == 1) {
+			last_file = true;
+		}
+	}
+
+	if(tags != NULL) {
+		free_single_ptr((void **)&tags);
 	}
 
 	DEBUG(EXIT);
+	return last_file;
 } /* remove_tags */
 
 int tags_from_file(int file_id, int **tags) {
@@ -840,114 +540,32 @@ int tags_from_file(int file_id, int **tags) {
 
 	DEBUG("Retrieving tags from file ID %d", file_id);
 
-	num_tags = db_tags_from_files(&file_id, 1, tags);
+	num_tags = index_tags_from_file(file_id, tags);
 
 	DEBUG(EXIT);
 	return num_tags;
-} /* tags_from_files */
-
-int most_popular_tag_on_files_at_location(const char *path, int *files, int num_files, int **exclude_tags, int *exclude_tags_count) {
-	GHashTable *table = NULL;
-	GHashTableIter iter;
-	gpointer key = NULL;
-	gpointer largest_key = NULL;
-	gpointer largest_value = NULL;
-	gpointer value = NULL;
-	int *tags_on_file = NULL;
-	int file_id = 0;
-	int i = 0;
-	int j = 0;
-	int num_tags = 0;
-	long unsigned int tag_id = 0;
+} /* tags_from_file */
 
-	DEBUG(ENTRY);
-	DEBUG("Looking for the most popular tag on %d files at %s, excluding %d tags", num_files, path, *exclude_tags_count);
-
-	table = g_hash_table_new(NULL, NULL);
-
-	for(i = 0; i < num_files; i++) {
-		file_id = files[i];
-		num_tags = tags_from_file(file_id, &tags_on_file);
-
-		for(j = 0; j < num_tags; j++) {
-			tag_id = tags_on_file[j];
-
-			if(g_hash_table_lookup(table, (gpointer)tag_id) == NULL) {
-				g_hash_table_insert(table, (gpointer)tag_id, (gpointer)1);
-			} else {
-				value = g_hash_table_lookup(table, (gpointer)tag_id);
-				g_hash_table_insert(table, (gpointer)tag_id, (gpointer)value++);
-			}
-		}
-
-		free_single_ptr((void **)&tags_on_file);
-	}
-
-	remove_path_from_hash_table(path, &table);
-
-	if(*exclude_tags == NULL) {
-		*exclude_tags = malloc(sizeof(**exclude_tags) * g_hash_table_size(table));
-	}
-
-	for(i = 0; i < *exclude_tags_count; i++) {
-		tag_id = (*exclude_tags)[i];
-		g_hash_table_remove(table, (gpointer)tag_id);
-	}
-
-	g_hash_table_iter_init(&iter, table);
-	while(g_hash_table_iter_next(&iter, &key, &value)) {
-		if(value > largest_value) {
-			largest_key = key;
-			largest_value = value;
-		}
-	}
-
-	g_hash_table_destroy(table);
-
-	if(largest_key != 0) { /* add tag to list of exclusions */
-		(*exclude_tags)[(*exclude_tags_count)++] = GPOINTER_TO_INT(largest_key);
-	}
-
-	DEBUG("The most popular tag on the %d files at %s has ID %d", num_files, path, GPOINTER_TO_INT(largest_key));
-	DEBUG(EXIT);
-	return GPOINTER_TO_INT(largest_key);
-} /* most_popular_tag_on_files_at_location */
-
-void remove_file(int file_id) {
+void remove_file(struct db_batch *batch, int file_id) {
 	DEBUG(ENTRY);
 	DEBUG("Removing file ID %d from the filesystem.", file_id);
 
 	assert(file_id > 0);
 
-	db_remove_file(file_id);
+	db_batch_delete_file(batch, file_id);
 
 	DEBUG(EXIT);
-} /* get_file_location */
+} /* remove_file */
 
-void add_tag_to_file(int tag_id, int file_id) {
+void add_tag_to_file(struct db_batch *batch, int tag_id, int file_id) {
 	DEBUG(ENTRY);
 
 	assert(tag_id > 0);
 	assert(file_id > 0);
 
-	db_add_tag_to_file(tag_id, file_id);
+	db_batch_add_tag(batch, tag_id, file_id);
 
 	DEBUG("Adding tag ID %d to file ID %d", tag_id, file_id);
 
 	DEBUG(EXIT);
 } /* add_tag_to_file */
-
-int tag_id_from_tag_name(char *tag_name) {
-	int tag_id = 0;
-
-	DEBUG(ENTRY);
-
-	assert(tag_name != NULL);
-
-	tag_id = db_tag_id_from_tag_name(tag_name);
-
-	DEBUG("Tag ID %d corresponds to tag %s", tag_id, tag_name);
-
-	DEBUG(EXIT);
-	return tag_id;
-} /* tag_id_from_tag_name */
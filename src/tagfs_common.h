@@ -9,10 +9,10 @@
 #ifndef TAGFS_COMMON_H
 #define TAGFS_COMMON_H
 
-#include <semaphore.h>
 #include <stdbool.h>
 
-sem_t sem;
+struct bitmap;
+struct db_batch;
 
 /**
  * Counts the number if digits in an integer.
@@ -22,6 +22,37 @@ sem_t sem;
  */
 int num_digits(unsigned int num);
 
+/**
+ * Initialize the lock which serializes tag mutations against path resolution.
+ * Must be called once from tagfs_init before any other thread runs.
+ */
+void tag_lock_init();
+
+/**
+ * Destroy the lock created by tag_lock_init(). Must be called once from 
+ * tagfs_destroy.
+ */
+void tag_lock_destroy();
+
+/**
+ * Take the tag lock for reading. Any number of threads may resolve paths, list
+ * directories and read files at the same time, but none of them will observe a 
+ * tag mutation that is only half done. Release with tag_unlock().
+ */
+void tag_read_lock();
+
+/**
+ * Take the tag lock for writing. Used by operations which add or remove tags or
+ * files (rename, unlink, ...), so the whole mutation appears atomic to readers.
+ * Release with tag_unlock().
+ */
+void tag_write_lock();
+
+/**
+ * Release the tag lock taken with tag_read_lock() or tag_write_lock().
+ */
+void tag_unlock();
+
 /**
  * Get the directory of where the TagFS is being executed from (assuming it is 
  * passed argv[0]). The returned path must be free'd by the caller. Logging 
@@ -33,15 +64,6 @@ int num_digits(unsigned int num);
  */
 char *get_exec_dir(const char *exec_name);
 
-/**
- * Retrieves the file name of the file associated with a file ID. The returned
- * file name must be free'd by the caller.
- *
- * @param file_id The ID of the file.
- * @return The name of the file corresponding to the file ID.
- */
-char *file_name_from_id(int file_id);
-
 /**
  * Checks whether or not a given path is valid. This is specifically done by 
  * checking that every component of the path is valid and that every component 
@@ -57,9 +79,10 @@ bool valid_path_to_folder(const char *path);
  * Converts a path into an array of tokens. The path is delimated using the "/" 
  * character and each token is inserted into an array. The number of elements in
  * the array is returned and the pointer passed in by the user will be allocated
- * for the array of elements. The caller is responsible for freeing both the 
- * array pointer, and the pointers of each token in the array. The function 
- * free_double_ptr() can be used for this purpose.
+ * for the array of elements. The array and its tokens are allocated from the
+ * request arena (see tagfs_arena.h), and must not be free'd. Only needed where
+ * the tokens have to be C strings; path_split() (see tagfs_path.h) splits a
+ * path without copying it.
  *
  * @param path A string representing a path in the filesystem.
  * @param array A pointer to an array of strings (char pointers).
@@ -67,16 +90,6 @@ bool valid_path_to_folder(const char *path);
  */
 int path_to_array(const char *path, char ***array);
 
-/**
- * Counts the number of tags in a path. Uses the standand path delimiter "/" to 
- * calculate the total. Function uses strtok_r, but does not modify the path 
- * that is passed in as a parameter.
- *
- * @param path A string representing a path in the filesystem.
- * @return The number of path elements delimited by the "/" character.
- */
-int num_tags_in_path(const char *path);
-
 /**
  * Checks if a string is contained within an array. Expects a count parameter 
  * to be passed in representing the length of the array.
@@ -96,15 +109,6 @@ bool array_contains_string(const char **array, const char *string, int count);
  */
 void free_single_ptr(void **ptr);
 
-/**
- * Responsible for freeing the memory in an array of objects that have been
- * alloc'd. Also frees the array pointer.
- *
- * @param array A pointer to the array of pointers to be free'd.
- * @param count The number of elements in the array to be free'd.
- */
-void free_double_ptr(void ***array, int count);
-
 /**
  * Returns a list of the folders at the specified location in the filesystem. This based on the files which are at the same location.
  *
@@ -116,15 +120,6 @@ void free_double_ptr(void ***array, int count);
  */
 int folders_at_location(const char *path, int *files, int num_files, int **folders);
 
-/**
- * Counts the number of tags in a path. Uses the standand path delimiter "/" to calculate the total. Function uses strtok, but does not modify the path that is passed in as a parameter.
- *
- * @param path A string representing a path in the filesystem.
-const int num_tags_in_path(const char* path);
- * @return The number of path elements delimited by the "/" character.
- */
-int num_tags_in_path(const char *path);
-
 /*
  * Finds the overlap between two arrays. Namely, it will return an array with the elements both arrays have in common. Both arrays are assumed to contain sorted array of unique values. Caller is responsible for freeing the memory for returned folder array.
  *
@@ -138,56 +133,33 @@ int num_tags_in_path(const char *path);
 int array_intersection(int *a, int a_size, int *b, int b_size, int **intersection);
 
 /**
- * Returns a collection of the tags at a location, attempting to remove superfluous paths for reaching files.
+ * Returns a collection of the tags at a location, attempting to remove superfluous paths for reaching files. The tags are a greedy cover of the files at the location, see tagfs_folders.h.
  *
- * @param path A string representing a path in the filesystem.
- * @param files An array containing the files IDs of the files location at the specified path.
- * @param num_files The number of file IDs.
+ * @param path A string representing a path in the filesystem. Must contain files, unless it is the root.
  * @param tags The array of tags to display at the location.
  * @return The number of folders at the specified location.
  */
-int smart_tags_from_files(const char *path, int *files, int num_files, int **tags);
-
-/**
- * Returns a collection of the files at the specified path in the filesystem.
- *
- * @param path A string representing a path in the filesystem.
- * @param file_array A collection containing the files in the specified path.
- * @return The number of files at the specified location.
- */
-int files_at_location(const char *path, int **file_array);
-
-/**
- * Returns the tag name that corresponds with the specified tag ID.
- *
- * @param file_id The file ID to match to a tag name.
- * @return The tag name that corresponds to the specified file ID.
- */
-char *tag_name_from_tag_id(int file_id);
-
-/**
- * Returns the directory for a given path. Specifically, a string will be returned which is the specified path minus everything after the last '/' character.
- *
- * @param path A string representing a path in the filesystem.
- * @return The directory of the specified path.
- */
-char *dirname(const char *path);
+int smart_tags_from_files(const char *path, int **tags);
 
 /**
- * Returns the base name for a given path. specifically, a string will be returned which is the everything following the last '/' character.
+ * Returns the files at the specified path in the filesystem as a bitmap. The
+ * tags of the path are intersected from the one with the fewest files up, and
+ * the intersection stops as soon as it is empty. The bitmap must be free'd by
+ * the caller with bitmap_free().
  *
  * @param path A string representing a path in the filesystem.
- * @return The base name of the specified path.
+ * @return The files at the specified location. Empty if there are none.
  */
-char *basename(const char *path);
+struct bitmap *files_bitmap_at_location(const char *path);
 
 /**
- * Checks if a file is valid. This is done with a call to file_id_from_path. If a file has a file ID, then the file is assumed to be valid.
+ * Returns a collection of the files at the specified path in the filesystem.
  *
  * @param path A string representing a path in the filesystem.
- * @return True, if the file is valid. False, if the file is not valid.
+ * @param file_array A collection containing the files in the specified path.
+ * @return The number of files at the specified location.
  */
-bool valid_path_to_file(const char *path);
+int files_at_location(const char *path, int **file_array);
 
 /**
  * Retrieves the file ID for a file specified by path. File is identified by determining which files belong at the given location and retrieving the file ID for the file at the specified location.
@@ -202,23 +174,27 @@ int file_id_from_path(const char *path);
  * Wrapper for db_get_file_location. Returns the location of a file on the physical filesystem.
  *
  * @param file_id The file ID in the database to match against.
- * @return The physical location on the filesystem.
+ * @return The physical location on the filesystem, or NULL if there is no such file.
  */
 char *get_file_location(int file_id);
 
 /**
- * Delete a file from the TagFS by its corresponding file ID.
+ * Delete a file from the TagFS by its corresponding file ID, and the tags left
+ * without files, in one transaction.
  *
  * @param file_id The ID of the file to delete.
  */
 void delete_file(int file_id);
 
 /**
- * Remove all tags from a file.
+ * Queue removing all tags from a file. Tags left without files are not deleted;
+ * queue db_batch_delete_empty_tags() after the last change if this returns true.
  *
+ * @param batch The batch to queue the changes in.
  * @param file_id The ID of the file to remove all tags from.
+ * @return True, if the file is the last one carrying one of its tags.
  */
-void remove_tags(int file_id);
+bool remove_tags(struct db_batch *batch, int file_id);
 
 /**
  * Retrieve all tags on a file.
@@ -230,36 +206,20 @@ void remove_tags(int file_id);
 int tags_from_file(int file_id, int **tags);
 
 /**
- * Given a path and a collection of files at that location, calculate which tag is used the most among all files.
- *
- * @param path A directory path.
- * @param files An array of file IDs.
- * @param num_files The number of files.
- * @param exclude_tags An array of tag IDs to exclude from consideration.
- * @param exclude_tags_count The number tags to exclude.
- */
-int most_popular_tag_on_files_at_location(const char *path, int *files, int num_files, int **exclude_tags, int *exclude_tags_count);
-
-/**
- * Remove a file from the filesystem.
+ * Queue removing a file from the filesystem.
  *
+ * @param batch The batch to queue the change in.
  * @param file_id The ID of the file to be removed from the filesystem.
  */
-void remove_file(int file_id);
+void remove_file(struct db_batch *batch, int file_id);
 
 /**
- * Add a tag to a file.
+ * Queue adding a tag to a file.
  *
+ * @param batch The batch to queue the change in.
  * @param tag_id The tag to add to the file.
  * @param file_id The file to which to add the tag.
  */
-void add_tag_to_file(int tag_id, int file_id);
-
-/**
- * Retrieve the tag ID which corresponds with a tag name.
- *
- * @param tag The tag for which to return an ID.
- */
-int tag_id_from_tag_name(char *tag_name);
+void add_tag_to_file(struct db_batch *batch, int tag_id, int file_id);
 
 #endif
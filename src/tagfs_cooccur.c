@@ -0,0 +1,347 @@
+#include "tagfs_common.h"
+#include "tagfs_cooccur.h"
+#include "tagfs_debug.h"
+#include "tagfs_index.h"
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * Number of files carrying both the tag of a row and another tag.
+ */
+struct cooccur_pair {
+	int tag_id;
+	int count;
+};
+
+/**
+ * Row of the matrix for one tag.
+ */
+struct cooccur_row {
+	int cardinality; /* files carrying the tag */
+	int num_pairs;
+	int capacity;
+	struct cooccur_pair *pairs; /* sorted by tag ID, no zero counts */
+};
+
+struct cooccur_matrix {
+	struct cooccur_row *rows; /* tag ID -> row */
+	int num_rows;
+	long num_pairs; /* pairs in all rows, each pair of tags counted in both of its rows */
+	long memory; /* bytes allocated for rows and pairs */
+	bool available; /* false once the matrix outgrew TAGFS_COOCCUR_MAX_MEMORY */
+};
+
+/**
+ * Drop the matrix because it outgrew its memory budget.
+ *
+ * @param matrix The matrix.
+ */
+static void cooccur_drop(struct cooccur_matrix *matrix) {
+	int i = 0;
+
+	WARN("Tag co-occurrence matrix needs more than %ld bytes, listings will count from the index instead", (long)TAGFS_COOCCUR_MAX_MEMORY);
+
+	for(i = 0; i < matrix->num_rows; i++) {
+		free(matrix->rows[i].pairs);
+	}
+
+	free(matrix->rows);
+	matrix->rows = NULL;
+	matrix->num_rows = 0;
+	matrix->num_pairs = 0;
+	matrix->memory = 0;
+	matrix->available = false;
+} /* cooccur_drop */
+
+/**
+ * Returns the row of a tag, making room for it if needed.
+ *
+ * @param matrix The matrix.
+ * @param tag_id The tag ID.
+ * @return The row, or NULL if the matrix had to be dropped.
+ */
+static struct cooccur_row *cooccur_row(struct cooccur_matrix *matrix, int tag_id) {
+	int num_rows = 0;
+
+	assert(tag_id > 0);
+
+	if(tag_id >= matrix->num_rows) {
+		num_rows = matrix->num_rows > 0 ? matrix->num_rows : 64;
+		while(num_rows <= tag_id) {
+			num_rows *= 2;
+		}
+
+		if(matrix->memory + (long)(num_rows - matrix->num_rows) * sizeof(*matrix->rows) > TAGFS_COOCCUR_MAX_MEMORY) {
+			cooccur_drop(matrix);
+			return NULL;
+		}
+
+		matrix->rows = realloc(matrix->rows, num_rows * sizeof(*matrix->rows));
+		assert(matrix->rows != NULL);
+		memset(&matrix->rows[matrix->num_rows], 0, (num_rows - matrix->num_rows) * sizeof(*matrix->rows));
+		matrix->memory += (long)(num_rows - matrix->num_rows) * sizeof(*matrix->rows);
+		matrix->num_rows = num_rows;
+	}
+
+	return &matrix->rows[tag_id];
+} /* cooccur_row */
+
+/**
+ * Find the slot of a tag in a row.
+ *
+ * @param row The row.
+ * @param tag_id The tag ID to look for.
+ * @return The index of the pair holding the tag, or of the pair it would be inserted before.
+ */
+static int cooccur_find(const struct cooccur_row *row, int tag_id) {
+	int high = row->num_pairs;
+	int low = 0;
+	int middle = 0;
+
+	while(low < high) {
+		middle = low + (high - low) / 2;
+
+		if(row->pairs[middle].tag_id < tag_id) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+} /* cooccur_find */
+
+/**
+ * Change the count of one pair in one row, inserting or removing the pair as
+ * needed.
+ *
+ * @param matrix The matrix.
+ * @param tag_a The tag of the row.
+ * @param tag_b The other tag of the pair.
+ * @param delta 1 or -1.
+ */
+static void cooccur_adjust(struct cooccur_matrix *matrix, int tag_a, int tag_b, int delta) {
+	int capacity = 0;
+	int i = 0;
+	struct cooccur_row *row = NULL;
+
+	if(!matrix->available) { /* dropped while adjusting the other half of the pair */
+		return;
+	}
+
+	row = cooccur_row(matrix, tag_a);
+
+	if(row == NULL) {
+		return;
+	}
+
+	i = cooccur_find(row, tag_b);
+
+	if(i < row->num_pairs && row->pairs[i].tag_id == tag_b) {
+		row->pairs[i].count += delta;
+		assert(row->pairs[i].count >= 0);
+
+		if(row->pairs[i].count == 0) {
+			memmove(&row->pairs[i], &row->pairs[i + 1], (row->num_pairs - i - 1) * sizeof(*row->pairs));
+			row->num_pairs--;
+			matrix->num_pairs--;
+		}
+
+		return;
+	}
+
+	assert(delta > 0);
+
+	if(row->num_pairs == row->capacity) {
+		capacity = row->capacity > 0 ? row->capacity * 2 : 4;
+
+		if(matrix->memory + (long)(capacity - row->capacity) * sizeof(*row->pairs) > TAGFS_COOCCUR_MAX_MEMORY) {
+			cooccur_drop(matrix);
+			return;
+		}
+
+		row->pairs = realloc(row->pairs, capacity * sizeof(*row->pairs));
+		assert(row->pairs != NULL);
+		matrix->memory += (long)(capacity - row->capacity) * sizeof(*row->pairs);
+		row->capacity = capacity;
+	}
+
+	memmove(&row->pairs[i + 1], &row->pairs[i], (row->num_pairs - i) * sizeof(*row->pairs));
+	row->pairs[i].tag_id = tag_b;
+	row->pairs[i].count = delta;
+	row->num_pairs++;
+	matrix->num_pairs++;
+} /* cooccur_adjust */
+
+/**
+ * Add a tag on one file to the matrix, or take it out.
+ *
+ * @param matrix The matrix.
+ * @param tag_id The tag.
+ * @param tags The other tags on the file.
+ * @param num_tags The number of other tags.
+ * @param delta 1 to add the tag, -1 to take it out.
+ */
+static void cooccur_update(struct cooccur_matrix *matrix, int tag_id, const int *tags, int num_tags, int delta) {
+	struct cooccur_row *row = NULL;
+	int i = 0;
+
+	if(!matrix->available) {
+		return;
+	}
+
+	row = cooccur_row(matrix, tag_id);
+
+	if(row == NULL) {
+		return;
+	}
+
+	row->cardinality += delta;
+	assert(row->cardinality >= 0);
+
+	for(i = 0; i < num_tags; i++) {
+		cooccur_adjust(matrix, tag_id, tags[i], delta);
+		cooccur_adjust(matrix, tags[i], tag_id, delta);
+	}
+} /* cooccur_update */
+
+void cooccur_init() {
+	int *files = NULL;
+	int *tags = NULL;
+	int i = 0;
+	int j = 0;
+	int num_files = 0;
+	int num_tags = 0;
+	struct cooccur_matrix *matrix = NULL;
+
+	DEBUG(ENTRY);
+	INFO("Building tag co-occurrence matrix");
+
+	matrix = calloc(1, sizeof(*matrix));
+	assert(matrix != NULL);
+	matrix->available = true;
+	TAGFS_DATA->cooccur = matrix;
+
+	num_files = index_all_files(&files);
+
+	for(i = 0; i < num_files && matrix->available; i++) {
+		num_tags = index_tags_from_file(files[i], &tags);
+
+		/* add the tags one at a time, each paired with the ones before it */
+		for(j = 0; j < num_tags; j++) {
+			cooccur_update(matrix, tags[j], tags, j, 1);
+		}
+
+		if(tags != NULL) {
+			free_single_ptr((void **)&tags);
+		}
+	}
+
+	if(files != NULL) {
+		free_single_ptr((void **)&files);
+	}
+
+	if(matrix->available) {
+		INFO("Tag co-occurrence matrix holds %ld pairs for %d tag IDs in %ld KiB", matrix->num_pairs / 2, matrix->num_rows, matrix->memory / 1024);
+	}
+
+	DEBUG(EXIT);
+} /* cooccur_init */
+
+void cooccur_destroy() {
+	struct cooccur_matrix *matrix = TAGFS_DATA->cooccur;
+	int i = 0;
+
+	DEBUG(ENTRY);
+
+	assert(matrix != NULL);
+
+	for(i = 0; i < matrix->num_rows; i++) {
+		free(matrix->rows[i].pairs);
+	}
+
+	free(matrix->rows);
+	free_single_ptr((void **)&TAGFS_DATA->cooccur);
+
+	DEBUG(EXIT);
+} /* cooccur_destroy */
+
+void cooccur_add_tag(int tag_id, const int *tags, int num_tags) {
+	DEBUG(ENTRY);
+
+	cooccur_update(TAGFS_DATA->cooccur, tag_id, tags, num_tags, 1);
+
+	DEBUG(EXIT);
+} /* cooccur_add_tag */
+
+void cooccur_remove_tag(int tag_id, const int *tags, int num_tags) {
+	DEBUG(ENTRY);
+
+	cooccur_update(TAGFS_DATA->cooccur, tag_id, tags, num_tags, -1);
+
+	DEBUG(EXIT);
+} /* cooccur_remove_tag */
+
+bool cooccur_counts(int tag_id, int *counts, int num_counts) {
+	const struct cooccur_row *row = NULL;
+	struct cooccur_matrix *matrix = TAGFS_DATA->cooccur;
+	int i = 0;
+
+	if(!matrix->available) {
+		return false;
+	}
+
+	if(tag_id <= 0 || tag_id >= matrix->num_rows) {
+		return true;
+	}
+
+	row = &matrix->rows[tag_id];
+
+	if(tag_id < num_counts) {
+		counts[tag_id] = row->cardinality;
+	}
+
+	for(i = 0; i < row->num_pairs && row->pairs[i].tag_id < num_counts; i++) {
+		counts[row->pairs[i].tag_id] = row->pairs[i].count;
+	}
+
+	return true;
+} /* cooccur_counts */
+
+int cooccur_tags_with(int tag_id, int **tags) {
+	const struct cooccur_row *row = NULL;
+	struct cooccur_matrix *matrix = TAGFS_DATA->cooccur;
+	int i = 0;
+
+	DEBUG(ENTRY);
+
+	assert(*tags == NULL);
+
+	if(!matrix->available) {
+		DEBUG(EXIT);
+		return -1;
+	}
+
+	if(tag_id <= 0 || tag_id >= matrix->num_rows || matrix->rows[tag_id].num_pairs == 0) {
+		DEBUG(EXIT);
+		return 0;
+	}
+
+	row = &matrix->rows[tag_id];
+
+	*tags = malloc(row->num_pairs * sizeof(**tags));
+	assert(*tags != NULL);
+
+	for(i = 0; i < row->num_pairs; i++) {
+		(*tags)[i] = row->pairs[i].tag_id;
+	}
+
+	DEBUG("Tag ID %d shares files with %d tags", tag_id, row->num_pairs);
+	DEBUG(EXIT);
+	return row->num_pairs;
+} /* cooccur_tags_with */
+
+long cooccur_memory_usage() {
+	return TAGFS_DATA->cooccur->memory;
+} /* cooccur_memory_usage */
@@ -0,0 +1,86 @@
+/**
+ * Tag co-occurrence matrix. For every pair of tags, the number of files which
+ * carry both, and for every tag the number of files which carry it. The matrix
+ * is sparse: a tag only has entries for the tags it actually shares a file
+ * with. It is built from the index when the filesystem is mounted and kept up
+ * to date by the index as tags are added to and removed from files, so the
+ * folders one level below the root can be counted without visiting any file.
+ *
+ * The matrix may not grow beyond TAGFS_COOCCUR_MAX_MEMORY bytes. If it would,
+ * it is dropped, every query reports it as unavailable, and callers fall back
+ * to counting from the index.
+ *
+ * The matrix is read under tag_read_lock() and changed under tag_write_lock().
+ *
+ * @file tagfs_cooccur.h
+ * @author Keith Woelke
+ * @date 10/17/2026
+ */
+
+#ifndef TAGFS_COOCCUR_H
+#define TAGFS_COOCCUR_H
+
+#include <stdbool.h>
+
+/**
+ * Build the matrix from the index. Must be called once from tagfs_init, after
+ * index_init().
+ */
+void cooccur_init();
+
+/**
+ * Free the matrix. Must be called once from tagfs_destroy, before
+ * index_destroy().
+ */
+void cooccur_destroy();
+
+/**
+ * Record that a tag was added to a file.
+ *
+ * @param tag_id The ID of the tag added to the file.
+ * @param tags The other tags on the file.
+ * @param num_tags The number of other tags on the file.
+ */
+void cooccur_add_tag(int tag_id, const int *tags, int num_tags);
+
+/**
+ * Record that a tag was removed from a file.
+ *
+ * @param tag_id The ID of the tag removed from the file.
+ * @param tags The tags remaining on the file.
+ * @param num_tags The number of tags remaining on the file.
+ */
+void cooccur_remove_tag(int tag_id, const int *tags, int num_tags);
+
+/**
+ * Count the tags on the files carrying a tag, by tag ID.
+ *
+ * @param tag_id The ID of the tag.
+ * @param counts OUT: Tag ID -> number of files carrying both tags. counts[tag_id] is the number of files carrying the tag. Must be zeroed by the caller.
+ * @param num_counts The number of entries in counts. Tags with higher IDs are not counted.
+ * @return True, if the counts were filled in. False, if the matrix is unavailable.
+ */
+bool cooccur_counts(int tag_id, int *counts, int num_counts);
+
+/**
+ * Returns the tags found on the files carrying a tag, not including the tag
+ * itself. The returned array must be free'd by the caller.
+ *
+ * Only folders_at_location() calls this, and only when its FAST_BROWSE switch
+ * is set, which it currently never is: folders are counted by
+ * folder_cache_folders(), which reads the matrix through cooccur_counts().
+ *
+ * @param tag_id The ID of the tag.
+ * @param tags OUT: The tags sharing a file with the tag, sorted by ID. Left as NULL if there are none.
+ * @return The number of tags, or -1 if the matrix is unavailable.
+ */
+int cooccur_tags_with(int tag_id, int **tags);
+
+/**
+ * Returns the memory held by the matrix. Reported in /.tagfs/stats.
+ *
+ * @return The size of the matrix in bytes, or 0 if it is unavailable.
+ */
+long cooccur_memory_usage();
+
+#endif
@@ -1,13 +1,179 @@
 #include "tagfs_common.h"
 #include "tagfs_db.h"
 #include "tagfs_debug.h"
+#include "tagfs_dict.h"
+#include "tagfs_index.h"
+#include "tagfs_path.h"
+#include "tagfs_stats.h"
 
 #include <assert.h>
-#include <glib.h>
 #include <math.h>
+#include <pthread.h>
 #include <semaphore.h>
 #include <sqlite3.h>
 #include <string.h>
+#include <strings.h>
+
+/**
+ * Number of IDs looked up by one execution of a batch statement, and the
+ * parameter list which holds them. Unused parameters of the last batch are left
+ * NULL, which matches no row.
+ */
+#define DB_BATCH_SIZE 256
+#define DB_BATCH_PARAMS_4 "?, ?, ?, ?"
+#define DB_BATCH_PARAMS_16 DB_BATCH_PARAMS_4 ", " DB_BATCH_PARAMS_4 ", " DB_BATCH_PARAMS_4 ", " DB_BATCH_PARAMS_4
+#define DB_BATCH_PARAMS_64 DB_BATCH_PARAMS_16 ", " DB_BATCH_PARAMS_16 ", " DB_BATCH_PARAMS_16 ", " DB_BATCH_PARAMS_16
+#define DB_BATCH_PARAMS DB_BATCH_PARAMS_64 ", " DB_BATCH_PARAMS_64 ", " DB_BATCH_PARAMS_64 ", " DB_BATCH_PARAMS_64
+
+/**
+ * Every query shape used by the database layer. Each one is compiled at most
+ * once per connection (the first time it is used) and then reused by binding
+ * new parameters, so the hot paths never parse or plan SQL.
+ */
+enum db_statement_id {
+	DB_FILE_LOCATION, /* location and name of a file by file ID */
+	DB_BACKING_FILE, /* location and name of a file TagFS created, by file ID */
+	DB_FILE_NAMES, /* names of a batch of files */
+	DB_ALL_TAG_NAMES, /* ID and name of every tag */
+	DB_ALL_TAGS,
+	DB_ALL_FILES,
+	DB_ALL_FILE_TAGS, /* every row of file_has_tag */
+	DB_DELETE_FILE,
+	DB_DELETE_TAG,
+	DB_DELETE_EMPTY_TAGS,
+	DB_ADD_TAG_TO_FILE,
+	DB_REMOVE_TAG_FROM_FILE,
+	DB_ADD_FILE,
+	DB_BEGIN,
+	DB_COMMIT,
+	DB_ROLLBACK,
+	DB_STATEMENT_COUNT
+};
+
+/**
+ * SQL for each entry of db_statement_id. Parameters are always bound, never
+ * spliced into the text.
+ */
+static const char *db_statement_sql[DB_STATEMENT_COUNT] = {
+	[DB_FILE_LOCATION] = "SELECT file_location, COALESCE(backing_name, file_name) FROM files WHERE file_id = ?1",
+	[DB_BACKING_FILE] = "SELECT file_location, backing_name FROM files WHERE file_id = ?1 AND backing_name IS NOT NULL",
+	[DB_FILE_NAMES] = "SELECT file_id, file_name FROM files WHERE file_id IN (" DB_BATCH_PARAMS ")",
+	[DB_ALL_TAG_NAMES] = "SELECT tag_id, tag_name FROM tags",
+	[DB_ALL_TAGS] = "SELECT tag_id FROM tags",
+	[DB_ALL_FILES] = "SELECT file_id FROM files",
+	[DB_ALL_FILE_TAGS] = "SELECT file_id, tag_id FROM file_has_tag ORDER BY tag_id, file_id",
+	[DB_DELETE_FILE] = "DELETE FROM files WHERE file_id = ?1",
+	[DB_DELETE_TAG] = "DELETE FROM tags WHERE tag_id = ?1",
+	[DB_DELETE_EMPTY_TAGS] = "DELETE FROM tags WHERE tag_id NOT IN (SELECT DISTINCT tag_id FROM file_has_tag)",
+	[DB_ADD_TAG_TO_FILE] = "INSERT INTO file_has_tag VALUES(?1, ?2)",
+	[DB_REMOVE_TAG_FROM_FILE] = "DELETE FROM file_has_tag WHERE file_id = ?1 AND tag_id = ?2",
+	[DB_ADD_FILE] = "INSERT INTO files(file_location, file_name, backing_name) VALUES(?1, ?2, ?3)",
+	[DB_BEGIN] = "BEGIN IMMEDIATE", /* take the write lock up front, so the transaction cannot fail half way with SQLITE_BUSY */
+	[DB_COMMIT] = "COMMIT",
+	[DB_ROLLBACK] = "ROLLBACK"
+};
+
+/**
+ * Schema migrations, in the order they are applied. PRAGMA user_version holds
+ * the number of migrations a database has had, so each one runs once per
+ * database, in the same transaction as the version bump. A released migration
+ * is never edited; schema changes are appended as a new one.
+ */
+static const char *db_migrations[] = {
+	/* 1: the original schema. Databases from before migrations already have it, and are at version 0 too. */
+	"CREATE TABLE IF NOT EXISTS tags ("
+	"	tag_id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+	"	tag_name TEXT NOT NULL"
+	");"
+	"CREATE TABLE IF NOT EXISTS files ("
+	"	file_id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+	"	file_location TEXT NOT NULL,"
+	"	file_name TEXT NOT NULL"
+	");"
+	"CREATE TABLE IF NOT EXISTS file_has_tag ("
+	"	file_id INTEGER NOT NULL REFERENCES files(file_id) ON DELETE CASCADE,"
+	"	tag_id INTEGER NOT NULL REFERENCES tags(tag_id),"
+	"	PRIMARY KEY(file_id, tag_id)"
+	");"
+	"CREATE VIEW IF NOT EXISTS all_tables AS"
+	"	SELECT file_id, tag_id, file_location, file_name, tag_name"
+	"	FROM (files JOIN file_has_tag USING(file_id)) JOIN tags USING(tag_id);"
+	"CREATE VIEW IF NOT EXISTS file_tag_count AS"
+	"	SELECT file_name, COUNT(file_name) \"Total Tag Count\""
+	"	FROM all_tables"
+	"	GROUP BY file_name;",
+
+	/*
+	 * 2: indexes for the statements above and the compiled path statements. The
+	 * primary key of file_has_tag only covers lookups by file, so tag to file
+	 * lookups and the relational division of db_path_sql() need their own. Tag
+	 * and file IDs are rowids, so the name indexes cover the lookups by name.
+	 */
+	"CREATE INDEX IF NOT EXISTS file_has_tag_by_tag ON file_has_tag(tag_id, file_id);"
+	"CREATE INDEX IF NOT EXISTS tags_by_name ON tags(tag_name);"
+	"CREATE INDEX IF NOT EXISTS files_by_name ON files(file_name);",
+
+	/*
+	 * 3: the name of the backing file in file_location, when it is not the
+	 * name of the file. Files created through the filesystem get a unique
+	 * backing name, so files of the same name can be created under different
+	 * tags. NULL for files whose backing file carries their own name.
+	 */
+	"ALTER TABLE files ADD COLUMN backing_name TEXT;"
+};
+
+#define DB_MIGRATION_COUNT ((int)(sizeof(db_migrations) / sizeof(*db_migrations)))
+
+/**
+ * Largest number of tags in a path whose compiled statement is kept in the
+ * per-connection cache. Deeper paths are compiled for a single lookup.
+ */
+#define DB_PATH_STATEMENT_CACHE 16
+
+/**
+ * A database connection owned by a single thread. Handles are opened the first
+ * time a thread talks to the database and stay open until that thread exits or
+ * the filesystem is unmounted, so a query never pays for sqlite3_open_v2() or
+ * for re-reading the schema.
+ */
+struct db_handle {
+	sqlite3 *conn;
+	sqlite3_stmt *statements[DB_STATEMENT_COUNT]; /* compiled on first use */
+	sqlite3_stmt *path_statements[2][DB_PATH_STATEMENT_CACHE + 1]; /* [with file name][number of tags], see db_path_sql() */
+	struct tagfs_state *state; /* owner of the handle list this handle is on */
+	struct db_handle *next;
+};
+
+/**
+ * Kinds of change a batch can hold.
+ */
+enum db_batch_op {
+	DB_BATCH_NONE, /* cancelled by a later change */
+	DB_BATCH_ADD_TAG,
+	DB_BATCH_REMOVE_TAG,
+	DB_BATCH_DELETE_FILE,
+	DB_BATCH_DELETE_EMPTY_TAGS
+};
+
+/**
+ * One queued change.
+ */
+struct db_batch_entry {
+	enum db_batch_op op;
+	int tag_id;
+	int file_id;
+	int changes; /* rows changed, filled in by db_batch_commit() */
+};
+
+/**
+ * Changes queued by one filesystem operation. Nothing touches the database or
+ * the index until db_batch_commit().
+ */
+struct db_batch {
+	struct db_batch_entry *entries;
+	int num_entries;
+	int capacity;
+};
 
 /**
  * Compiles an SQL statement into byte-code.
@@ -17,7 +183,7 @@
  * @param res OUT: A sqlite statement handle.
  * @return The result of the operation, corresponding to the return codes of the sqlite3_prepare_v2 function call.
  */
-static int db_prepare_statement(sqlite3 *conn, char *query, sqlite3_stmt **res) {
+static int db_prepare_statement(sqlite3 *conn, const char *query, sqlite3_stmt **res) {
 	int query_length = 0;
 	int rc = SQLITE_ERROR; /* return code of sqlite operation */
 
@@ -39,7 +205,7 @@ static int db_prepare_statement(sqlite3 *conn, char *query, sqlite3_stmt **res)
 		WARN("An error occured while communicating with the database");
 	}
 
-	DEBUG("Query compilation was %ssuccessful", rc == SQLITE_DONE ? "" : "un");
+	DEBUG("Query compilation was %ssuccessful", rc == SQLITE_OK ? "" : "un");
 	DEBUG(EXIT);
 	return rc;
 } /* db_prepare_statement */
@@ -50,7 +216,7 @@ static int db_prepare_statement(sqlite3 *conn, char *query, sqlite3_stmt **res)
  * @param res A sqlite statement handle.
  * @return The result of the operation, corresponding to the return codes of the sqlite3_step function call.
  */
-static int db_step_statement(sqlite3 *conn, char *query, sqlite3_stmt *res) {
+static int db_step_statement(sqlite3_stmt *res) {
 	int rc = SQLITE_ERROR; /* return code of sqlite operation */
 
 	DEBUG(ENTRY);
@@ -63,7 +229,7 @@ static int db_step_statement(sqlite3 *conn, char *query, sqlite3_stmt *res) {
 
 	/* handle result code */
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE) {
-		DEBUG("WARNING: Executing statement \"%s\" failed with result code %d: %s", query, rc, sqlite3_errmsg(conn));
+		DEBUG("WARNING: Executing statement \"%s\" failed with result code %d: %s", sqlite3_sql(res), rc, sqlite3_errmsg(sqlite3_db_handle(res)));
 		WARN("An error occured while communicating with the database");
 	}
 
@@ -72,52 +238,17 @@ static int db_step_statement(sqlite3 *conn, char *query, sqlite3_stmt *res) {
 	return rc;
 } /* db_step_statement */
 
-/*
- * Execute the SQL statement.
- *
- * @param conn A sqlite database handle.
- * @param query An SQL statement, UTF-8 encoded.
- * @param res OUT: A sqlite statement handle.
- * @return The result of the operation, corresponding to the return codes of the sqlite3_prepare_v2 function call (if it fails), otherwise the error code that is returned corresponds to the return codes of the sqlite3_step function call.
- */
-static int db_execute_statement(sqlite3 *conn, char *query, sqlite3_stmt **res) {
-	int rc = SQLITE_ERROR;
-
-	DEBUG(ENTRY);
-
-	assert(conn != NULL);
-	assert(query != NULL);
-	assert(*res == NULL);
-
-	DEBUG("Executing query: %s", query);
-
-	rc = db_prepare_statement(conn, query, res);
-
-	/* handle result code */
-	if(rc == SQLITE_OK) {
-		rc = db_step_statement(conn, query, *res);
-	}
-
-	DEBUG("Query execution complete with result code: %d", rc);
-	DEBUG(EXIT);
-	return rc;
-} /* db_execute_statement */
-
 /**
  * Finalize a sqlite statement.
  *
- * @param conn A sqlite database handle.
- * @param query An SQL statement, UTF-8 encoded.
  * @param res A sqlite statement handle.
  * @return The result of the operation, corresponding to the return codes of the sqlite3_finalize function call.
  */
-static int db_finalize_statement(sqlite3 *conn, char *query, sqlite3_stmt *res) {
+static int db_finalize_statement(sqlite3_stmt *res) {
 	int rc = SQLITE_ERROR;
 
 	DEBUG(ENTRY);
 
-	assert(conn != NULL);
-	assert(query != NULL);
 	assert(res != NULL);
 
 	DEBUG("Finalizing statement.");
@@ -126,7 +257,7 @@ static int db_finalize_statement(sqlite3 *conn, char *query, sqlite3_stmt *res)
 
 	/* handle result code */
 	if(rc != SQLITE_OK) {
-		DEBUG("WARNING: Finalizing statement \"%s\" failed with result code %d: %s", query, rc, sqlite3_errmsg(conn));
+		DEBUG("WARNING: Finalizing statement failed with result code %d", rc);
 		WARN("An error occured when communicating with the database");
 	}
 
@@ -136,40 +267,75 @@ static int db_finalize_statement(sqlite3 *conn, char *query, sqlite3_stmt *res)
 } /* db_finalize_statement */
 
 /**
- * Insert the results of the specified query into the specified table. Only the results of the first column are entered into the table, and the values are assumed to be integers.
+ * Return a cached statement to its initial state so it can be bound and run
+ * again. Must be called once the caller is done with the results of a
+ * statement retrieved through db_statement(); an unreset statement keeps its
+ * read transaction open.
  *
- * @param conn A sqlite database handle.
- * @param query An SQL statement, UTF-8 encoded.
+ * @param res A sqlite statement handle.
+ */
+static void db_reset_statement(sqlite3_stmt *res) {
+	assert(res != NULL);
+
+	/* the result of sqlite3_reset repeats the error of the last step, which has already been reported */
+	sqlite3_reset(res);
+	sqlite3_clear_bindings(res);
+} /* db_reset_statement */
+
+/**
+ * Bind an integer to a statement parameter.
+ *
+ * @param res A sqlite statement handle.
+ * @param index The index of the parameter, starting at 1.
+ * @param value The value to bind.
  */
-static void db_insert_query_results_into_hashtable(sqlite3 *conn, char *query, GHashTable *table) {
+static void db_bind_int(sqlite3_stmt *res, int index, int value) {
 	int rc = SQLITE_ERROR;
-	sqlite3_stmt *res = NULL;
-	unsigned long int_from_table = 0;
 
-	DEBUG(ENTRY);
+	assert(res != NULL);
 
-	assert(query != NULL);
-	assert(conn != NULL);
-	assert(table != NULL);
+	rc = sqlite3_bind_int(res, index, value);
+
+	if(rc != SQLITE_OK) {
+		DEBUG("ERROR: Binding %d to parameter %d of \"%s\" failed with result code %d", value, index, sqlite3_sql(res), rc);
+		ERROR("An error occured while communicating with the database");
+	}
+} /* db_bind_int */
 
-	DEBUG("Inserting into table results from query: %s", query);
+/**
+ * Bind a string of a given length to a statement parameter. The string is not
+ * copied, so it must stay valid until the statement is reset.
+ *
+ * @param res A sqlite statement handle.
+ * @param index The index of the parameter, starting at 1.
+ * @param value The value to bind. Need not be NUL-terminated, unless length is -1.
+ * @param length The length of the value, or -1 to bind up to its NUL.
+ */
+static void db_bind_text_length(sqlite3_stmt *res, int index, const char *value, int length) {
+	int rc = SQLITE_ERROR;
 
-	rc = db_execute_statement(conn, query, &res);
+	assert(res != NULL);
+	assert(value != NULL);
 
-	/* insert results into hashset */
-	while(rc == SQLITE_ROW) {
-		int_from_table = sqlite3_column_int(res, 0);
-		g_hash_table_insert(table, (gpointer)int_from_table, (gpointer)int_from_table);
+	rc = sqlite3_bind_text(res, index, value, length, SQLITE_STATIC);
 
-		rc = db_step_statement(conn, query, res);
-		if(int_from_table == 0)printf("%d\n", rc);
+	if(rc != SQLITE_OK) {
+		DEBUG("ERROR: Binding \"%.*s\" to parameter %d of \"%s\" failed with result code %d", length, value, index, sqlite3_sql(res), rc);
+		ERROR("An error occured while communicating with the database");
 	}
+} /* db_bind_text_length */
 
-	db_finalize_statement(conn, query, res);
-
-	DEBUG("Results entered into table from query: %s", query);
-	DEBUG(EXIT);
-} /* db_insert_query_results_into_hashtable */
+/**
+ * Bind a string to a statement parameter. The string is not copied, so it must
+ * stay valid until the statement is reset.
+ *
+ * @param res A sqlite statement handle.
+ * @param index The index of the parameter, starting at 1.
+ * @param value The value to bind.
+ */
+static void db_bind_text(sqlite3_stmt *res, int index, const char *value) {
+	db_bind_text_length(res, index, value, -1);
+} /* db_bind_text */
 
 /**
  * Disconnect from the database.
@@ -232,11 +398,141 @@ static void db_enable_foreign_keys(sqlite3 *conn) {
 } /* db_enable_foreign_keys */
 
 /**
- * Connect to the database.
+ * Run SQL which returns no rows on a connection.
+ *
+ * @param conn The sqlite3 database connection.
+ * @param sql One or more SQL statements.
+ * @return The result code of sqlite3_exec.
+ */
+static int db_exec(sqlite3 *conn, const char *sql) {
+	char *err_msg = NULL; /* sqlite3 error message */
+	int rc = 0; /* return code of sqlite3 operation */
+
+	rc = sqlite3_exec(conn, sql, NULL, NULL, &err_msg);
+
+	if(rc != SQLITE_OK) {
+		DEBUG("WARNING: Executing \"%.60s\" failed with result code %d: %s", sql, rc, err_msg != NULL ? err_msg : sqlite3_errmsg(conn));
+	}
+
+	if(err_msg != NULL) {
+		sqlite3_free(err_msg);
+	}
+
+	return rc;
+} /* db_exec */
+
+/**
+ * Bring the schema of the database up to date, creating it if the database is
+ * new. Each pending migration runs in its own transaction along with the bump
+ * of PRAGMA user_version, so an interrupted upgrade resumes where it stopped.
+ *
+ * @param conn The sqlite3 database connection to migrate.
+ */
+static void db_migrate(sqlite3 *conn) {
+	char version_sql[64];
+	int rc = 0; /* return code of sqlite3 operation */
+	int version = 0;
+	sqlite3_stmt *res = NULL;
+
+	DEBUG(ENTRY);
+
+	assert(conn != NULL);
+
+	if(db_prepare_statement(conn, "PRAGMA user_version", &res) != SQLITE_OK || db_step_statement(res) != SQLITE_ROW) {
+		ERROR("Unable to read the schema version of the database");
+	}
+
+	version = sqlite3_column_int(res, 0);
+	db_finalize_statement(res);
+
+	if(version > DB_MIGRATION_COUNT) {
+		WARN("Database schema version %d is newer than this build of tagfs knows (%d)", version, DB_MIGRATION_COUNT);
+	}
+
+	for(; version < DB_MIGRATION_COUNT; version++) {
+		INFO("Migrating database schema to version %d", version + 1);
+
+		snprintf(version_sql, sizeof(version_sql), "PRAGMA user_version = %d", version + 1);
+
+		rc = db_exec(conn, "BEGIN IMMEDIATE");
+
+		if(rc == SQLITE_OK) {
+			rc = db_exec(conn, db_migrations[version]);
+		}
+
+		if(rc == SQLITE_OK) {
+			rc = db_exec(conn, version_sql);
+		}
+
+		if(rc == SQLITE_OK) {
+			rc = db_exec(conn, "COMMIT");
+		}
+
+		if(rc != SQLITE_OK) {
+			db_exec(conn, "ROLLBACK");
+			ERROR("Migrating the database schema to version %d failed", version + 1);
+		}
+	}
+
+	DEBUG("Database schema is at version %d", version);
+	DEBUG(EXIT);
+} /* db_migrate */
+
+/**
+ * Apply the database mount options to a new connection. A setting SQLite
+ * rejects is reported and the connection keeps working with the SQLite default.
+ *
+ * @param conn The sqlite3 database connection to configure.
+ */
+static void db_apply_options(sqlite3 *conn) {
+	const char *journal_mode = NULL;
+	const struct tagfs_db_options *options = &TAGFS_DATA->db_options;
+	char *sql = NULL;
+	sqlite3_stmt *res = NULL;
+
+	DEBUG(ENTRY);
+
+	assert(conn != NULL);
+
+	sql = sqlite3_mprintf("PRAGMA synchronous = %s; PRAGMA temp_store = %s; PRAGMA cache_size = %d; PRAGMA mmap_size = %lld",
+			options->synchronous, options->temp_store, options->cache_size, options->mmap_size);
+	assert(sql != NULL);
+
+	if(db_exec(conn, sql) != SQLITE_OK) {
+		WARN("Unable to apply the database options, using SQLite defaults");
+	}
+
+	sqlite3_free(sql);
+
+	/* the journal mode pragma reports the mode in effect, which differs from the one asked for if it is not supported */
+	sql = sqlite3_mprintf("PRAGMA journal_mode = %s", options->journal_mode);
+	assert(sql != NULL);
+
+	if(db_prepare_statement(conn, sql, &res) == SQLITE_OK) {
+		if(db_step_statement(res) == SQLITE_ROW) {
+			journal_mode = (const char *)sqlite3_column_text(res, 0);
+		}
+
+		if(journal_mode == NULL || strcasecmp(journal_mode, options->journal_mode) != 0) {
+			WARN("Database journal mode is %s instead of %s", journal_mode != NULL ? journal_mode : "unknown", options->journal_mode);
+		}
+
+		db_finalize_statement(res);
+	}
+
+	sqlite3_free(sql);
+
+	DEBUG("Database options: journal_mode=%s synchronous=%s temp_store=%s cache_size=%d mmap_size=%lld",
+			options->journal_mode, options->synchronous, options->temp_store, options->cache_size, options->mmap_size);
+	DEBUG(EXIT);
+} /* db_apply_options */
+
+/**
+ * Open a new connection to the database.
  *
  * @return The database connection handle.
  */
-static sqlite3 *db_connect() {
+static sqlite3 *db_open() {
 	int rc = 0; /* return code of sqlite3 operation */
 	sqlite3 *conn = NULL;
 
@@ -245,7 +541,7 @@ static sqlite3 *db_connect() {
 
 	/* connect to the database */
 	assert(TAGFS_DATA->db_path != NULL);
-	rc = sqlite3_open_v2(/*TAGFS_DATA->db_path*/"/home/keith/Programming/FUSE/TagFS/src/tagfs.sl3", &conn, SQLITE_OPEN_READWRITE, NULL); /* TODO: set as 'SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE' and create the database if it does not exist already */
+	rc = sqlite3_open_v2(TAGFS_DATA->db_path, &conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL); /* connections are never shared between threads. A missing database is created, and given a schema by db_migrate(). */
 	assert(conn != NULL);
 
 	/* handle result code */
@@ -255,325 +551,665 @@ static sqlite3 *db_connect() {
 	}
 	else { DEBUG("Database connection successful"); }
 
+	/* other threads have their own connections, so wait out their writes instead of failing */
+	sqlite3_busy_timeout(conn, TAGFS_DB_BUSY_TIMEOUT);
+
 	db_enable_foreign_keys(conn);
+	db_apply_options(conn);
 
 	DEBUG(EXIT);
 	return conn;
+} /* db_open */
+
+/**
+ * Close the database handle of a thread which is exiting. Called by pthreads
+ * as the destructor of the db_key thread-specific value. The FUSE context may
+ * already be gone at this point, so logging functions must not be called.
+ *
+ * @param data The db_handle of the exiting thread.
+ */
+static void db_release_handle(void *data) {
+	struct db_handle *handle = data;
+	struct db_handle **link = NULL;
+	struct tagfs_state *state = handle->state;
+	int i = 0;
+
+	pthread_mutex_lock(&state->db_lock);
+
+	for(link = &state->db_handles; *link != NULL; link = &(*link)->next) {
+		if(*link == handle) {
+			*link = handle->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&state->db_lock);
+
+	for(i = 0; i < DB_STATEMENT_COUNT; i++) {
+		sqlite3_finalize(handle->statements[i]); /* no-op on NULL */
+	}
+
+	for(i = 0; i <= DB_PATH_STATEMENT_CACHE; i++) {
+		sqlite3_finalize(handle->path_statements[0][i]);
+		sqlite3_finalize(handle->path_statements[1][i]);
+	}
+
+	sqlite3_close(handle->conn);
+	free(handle);
+} /* db_release_handle */
+
+/**
+ * Retrieve the database handle of the calling thread, opening one if this
+ * thread has not used the database before. The handle is owned by the
+ * connection manager and must not be closed by the caller.
+ *
+ * @return The database handle of the calling thread.
+ */
+static struct db_handle *db_thread_handle() {
+	struct db_handle *handle = NULL;
+
+	handle = pthread_getspecific(TAGFS_DATA->db_key);
+
+	if(handle == NULL) {
+		DEBUG("Opening database handle for thread %lu", (unsigned long)pthread_self());
+
+		handle = calloc(1, sizeof(*handle));
+		assert(handle != NULL);
+		handle->conn = db_open();
+		handle->state = TAGFS_DATA;
+
+		pthread_mutex_lock(&TAGFS_DATA->db_lock);
+		handle->next = TAGFS_DATA->db_handles;
+		TAGFS_DATA->db_handles = handle;
+		pthread_mutex_unlock(&TAGFS_DATA->db_lock);
+
+		pthread_setspecific(TAGFS_DATA->db_key, handle);
+	}
+
+	return handle;
+} /* db_thread_handle */
+
+/**
+ * Retrieve the database connection of the calling thread.
+ *
+ * @return The database connection handle.
+ */
+static sqlite3 *db_connect() {
+	return db_thread_handle()->conn;
 } /* db_connect */
 
-char *db_get_file_location(int file_id) {
-	char *file_location = NULL;
-	char *query = NULL;
-	char *tmp_file_directory = NULL; /* holds text from the query so it can be copied to a new memory location */
-	char *tmp_file_name = NULL; /* hold name of file until it can be copied to a new memory location */
-	char query_outline[] = "SELECT file_location, file_name FROM files WHERE file_id = ";
-	int file_location_length = 0; /* length of the file location to return */
-	int query_length = 0;
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
+/**
+ * Retrieve a compiled statement from the calling thread's statement cache,
+ * compiling it if this is the first time the thread uses it. The caller binds
+ * its parameters, steps it, and must hand it back with db_reset_statement().
+ *
+ * @param id The query shape to retrieve.
+ * @return A sqlite statement handle ready to be bound.
+ */
+static sqlite3_stmt *db_statement(enum db_statement_id id) {
+	struct db_handle *handle = NULL;
+	int rc = SQLITE_ERROR;
+
+	assert(id >= 0 && id < DB_STATEMENT_COUNT);
+
+	handle = db_thread_handle();
+
+	if(handle->statements[id] == NULL) {
+		rc = db_prepare_statement(handle->conn, db_statement_sql[id], &handle->statements[id]);
+
+		if(rc != SQLITE_OK) {
+			ERROR("Unable to compile statement %d", id);
+		}
+	}
+
+	return handle->statements[id];
+} /* db_statement */
+
+/**
+ * Run a statement which takes no parameters and returns no rows, such as the
+ * transaction control statements.
+ *
+ * @param id The statement to run.
+ * @return The result of the operation, corresponding to the return codes of the sqlite3_step function call.
+ */
+static int db_run_statement(enum db_statement_id id) {
+	int rc = SQLITE_ERROR; /* return code of sqlite operation */
 	sqlite3_stmt *res = NULL;
 
-	DEBUG(ENTRY);
+	res = db_statement(id);
+	rc = db_step_statement(res);
+	db_reset_statement(res);
 
-	assert(file_id > 0);
+	return rc;
+} /* db_run_statement */
 
-	DEBUG("Retrieving physical location for file with ID %d", file_id);
+/**
+ * Look up the names of a set of IDs, DB_BATCH_SIZE IDs per query, and hand each
+ * one to a callback as soon as it is read.
+ *
+ * @param id The statement, such as DB_FILE_NAMES.
+ * @param ids The IDs to look up.
+ * @param num_ids The number of IDs.
+ * @param callback Called once per ID found, in no particular order. Returning non-zero stops the lookup.
+ * @param data Passed to the callback.
+ * @return The number of names handed to the callback.
+ */
+static int db_names_from_ids(enum db_statement_id id, const int *ids, int num_ids, db_name_callback callback, void *data) {
+	bool stop = false;
+	const char *name = NULL;
+	int count = 0;
+	int i = 0;
+	int j = 0;
+	sqlite3_stmt *res = NULL;
 
-	/* prepare query */
-	query_length = strlen(query_outline) + num_digits(file_id);
-	query = malloc(query_length * sizeof(*query) + 1);
-	written = snprintf(query, query_length + 1, "SELECT file_location, file_name FROM files WHERE file_id = %d", file_id);
-	assert(written == query_length);
+	DEBUG(ENTRY);
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	assert(num_ids == 0 || ids != NULL);
+	assert(callback != NULL);
 
-	db_execute_statement(conn, query, &res);
+	res = db_statement(id);
 
-	/* get file location and name */
-	tmp_file_directory = (char *)sqlite3_column_text(res, 0);
-	assert(tmp_file_directory != NULL);
-	tmp_file_name = (char *)sqlite3_column_text(res, 1);
-	assert(tmp_file_name != NULL);
+	for(i = 0; i < num_ids && !stop; i += DB_BATCH_SIZE) {
+		for(j = 0; j < DB_BATCH_SIZE && i + j < num_ids; j++) {
+			db_bind_int(res, j + 1, ids[i + j]);
+		}
 
-	/* build full file path from name and directory */
-	file_location_length = strlen(tmp_file_directory) + strlen(tmp_file_name) + 1;
-	file_location = malloc(file_location_length * sizeof(*file_location) + 1); 
-	written = snprintf((char *)file_location, file_location_length + 1, "%s/%s", tmp_file_directory, tmp_file_name);
-	assert(written == file_location_length);
+		while(!stop && db_step_statement(res) == SQLITE_ROW) {
+			name = (const char *)sqlite3_column_text(res, 1);
+			assert(name != NULL);
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
+			stop = callback(data, sqlite3_column_int(res, 0), name) != 0;
+			count++;
+		}
 
-	free_single_ptr((void *)&query);
+		db_reset_statement(res);
+	}
 
-	DEBUG("File id %d corresponds to %s", file_id, file_location);
+	DEBUG("Read %d names for %d IDs", count, num_ids);
 	DEBUG(EXIT);
-	return file_location;
-} /* db_get_file_location */
+	return count;
+} /* db_names_from_ids */
 
-int db_tags_from_files(int *files, int num_files, int **tags) {
-	GHashTable *table = NULL;
-	GHashTableIter iter;
-	char *file_id_str = NULL;
-	char *query = NULL;
-	char or_outline[] = " OR file_id = ";
-	char query_outline[] = "SELECT DISTINCT tag_id FROM all_tables WHERE file_id = ";
-	const int QUERY_LENGTH_CAP = 1024;
-	gpointer key = NULL;
-	gpointer value = NULL;
-	int file_id = 0;
-	int hash_table_size = 0;
+/**
+ * Build the SQL which finds the files at a path of num_tags distinct tag names.
+ * The files carrying every tag are found by relational division: the rows of
+ * file_has_tag whose tag is one of the names are grouped by file, and only the
+ * files with a row for each name are kept. A path without tags lists the
+ * untagged files. When with_name is set, ?1 is a file name and the statement
+ * returns the one file at the path with that name; the tag names follow as
+ * ?2 onward. Otherwise the tag names are ?1 onward and every file at the path
+ * is returned, sorted by file ID. The returned string must be free'd with
+ * sqlite3_free().
+ *
+ * @param num_tags The number of distinct tag names in the path.
+ * @param with_name True, if the statement looks up a single file by name.
+ * @return The SQL of the statement.
+ */
+static char *db_path_sql(int num_tags, bool with_name) {
+	char *parameters = NULL;
+	char *sql = NULL;
+	char *tmp = NULL;
+	int first = with_name ? 2 : 1; /* index of the first tag name parameter */
 	int i = 0;
-	int initial_query_length = 0;
-	int num_digits_in_id = 0;
-	int query_outline_length = 0;
-	int sql_length_avail = 0;
-	int sql_max_length = 0;
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
 
-	DEBUG(ENTRY);
+	assert(num_tags >= 0);
 
-	assert(files != NULL);
-	assert(num_files > 0);
-	assert(*tags == NULL);
-
-	DEBUG("Retrieving tags from %d files", num_files);
+	if(num_tags == 0) {
+		if(with_name) {
+			return sqlite3_mprintf("SELECT file_id FROM files WHERE file_name = ?1 AND file_id NOT IN (SELECT file_id FROM file_has_tag) LIMIT 1");
+		}
 
-	/* prepare query/table */
-	query_outline_length = strlen(query_outline);
-	table = g_hash_table_new(NULL, NULL);
-	assert(table != NULL);
+		return sqlite3_mprintf("SELECT file_id FROM files WHERE file_id NOT IN (SELECT file_id FROM file_has_tag) ORDER BY file_id");
+	}
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	parameters = sqlite3_mprintf("?%d", first);
 
-	/* calculate maximum query length */
-	sql_max_length = sqlite3_limit(conn, SQLITE_LIMIT_SQL_LENGTH, -1);
-	assert(sql_max_length > query_outline_length);
-	DEBUG("Database reports maximum query length of %d", sql_max_length);
-	sql_max_length = sql_max_length < QUERY_LENGTH_CAP ? sql_max_length : QUERY_LENGTH_CAP;
-	assert(sql_max_length > query_outline_length);
-	DEBUG("Maximum query length has been set to %d", sql_max_length);
+	for(i = 1; i < num_tags; i++) {
+		tmp = sqlite3_mprintf("%s, ?%d", parameters, first + i);
+		sqlite3_free(parameters);
+		parameters = tmp;
+	}
 
-	/* for each file id */
-	for(i = 0; i < num_files; i++) {
-		num_digits_in_id = num_digits(files[i]);
-		file_id = files[i];
+	if(with_name) {
+		sql = sqlite3_mprintf("SELECT files.file_id FROM files JOIN file_has_tag USING(file_id) JOIN tags USING(tag_id) WHERE files.file_name = ?1 AND tags.tag_name IN (%s) GROUP BY files.file_id HAVING COUNT(*) = %d LIMIT 1", parameters, num_tags);
+	} else {
+		sql = sqlite3_mprintf("SELECT file_has_tag.file_id FROM file_has_tag JOIN tags USING(tag_id) WHERE tags.tag_name IN (%s) GROUP BY file_has_tag.file_id HAVING COUNT(*) = %d ORDER BY file_has_tag.file_id", parameters, num_tags);
+	}
 
-		/* start new query */
-		if(sql_length_avail <= 0) {
-			DEBUG("Starting new query");
-			sql_length_avail = sql_max_length - query_outline_length;
-			assert(sql_length_avail > 0);
+	sqlite3_free(parameters);
+	assert(sql != NULL);
+	return sql;
+} /* db_path_sql */
 
-			query = calloc(sql_max_length + 1, sizeof(*query));
-			assert(query != NULL);
+/**
+ * Retrieve a compiled path statement from the calling thread's cache, compiling
+ * it on first use. Paths with more than DB_PATH_STATEMENT_CACHE tags are
+ * compiled for the caller alone, and must be finalized instead of reset.
+ *
+ * @param num_tags The number of distinct tag names in the path.
+ * @param with_name True, if the statement looks up a single file by name.
+ * @param cached OUT: True, if the statement belongs to the cache and must be handed back with db_reset_statement().
+ * @return A sqlite statement handle ready to be bound.
+ */
+static sqlite3_stmt *db_path_statement(int num_tags, bool with_name, bool *cached) {
+	char *sql = NULL;
+	int rc = SQLITE_ERROR;
+	sqlite3_stmt **slot = NULL;
+	sqlite3_stmt *res = NULL;
+	struct db_handle *handle = NULL;
 
-			initial_query_length = query_outline_length + num_digits_in_id;
-			written = snprintf(query, initial_query_length + 1, "%s%d", query_outline, file_id);
-			assert(written == query_outline_length + num_digits_in_id);
+	handle = db_thread_handle();
+	*cached = num_tags <= DB_PATH_STATEMENT_CACHE;
+	slot = *cached ? &handle->path_statements[with_name][num_tags] : &res;
 
-			sql_length_avail -= num_digits_in_id;
+	if(*slot == NULL) {
+		sql = db_path_sql(num_tags, with_name);
+		rc = db_prepare_statement(handle->conn, sql, slot);
+		sqlite3_free(sql);
 
-			continue;
+		if(rc != SQLITE_OK) {
+			ERROR("Unable to compile path statement for %d tags", num_tags);
 		}
+	}
 
-		/* test if query can contain next file id */
-		sql_length_avail -= strlen(or_outline) + num_digits(files[i]);
+	return *slot;
+} /* db_path_statement */
 
-		/* if the query is at maximum length */
-		if(sql_length_avail <= 0) {
-			DEBUG("Query has reached maximum length...");
-			i--; /* leave it for next iteration */
+/**
+ * Bind the distinct names of a tag path to a path statement.
+ *
+ * @param res A path statement compiled for the number of distinct names.
+ * @param first The index of the first tag name parameter.
+ * @param tags The tag names of the path, possibly repeated.
+ * @param num_tags The number of tag names.
+ */
+static void db_bind_path(sqlite3_stmt *res, int first, const char **tags, int num_tags) {
+	int i = 0;
+	int index = first;
 
-			db_insert_query_results_into_hashtable(conn, query, table);
+	for(i = 0; i < num_tags; i++) {
+		if(!array_contains_string(tags, tags[i], i)) {
+			db_bind_text(res, index++, tags[i]);
+		}
+	}
+} /* db_bind_path */
 
-			free_single_ptr((void *)&query);
+/**
+ * Count the distinct names of a tag path. Repeating a tag in a path filters by
+ * it only once, so the path compiler only sees distinct names.
+ *
+ * @param tags The tag names of the path.
+ * @param num_tags The number of tag names.
+ * @return The number of distinct tag names.
+ */
+static int db_distinct_tags(const char **tags, int num_tags) {
+	int count = 0;
+	int i = 0;
 
-			continue;
+	for(i = 0; i < num_tags; i++) {
+		if(!array_contains_string(tags, tags[i], i)) {
+			count++;
 		}
+	}
+
+	return count;
+} /* db_distinct_tags */
+
+/**
+ * Receives one value of a streamed statement, see db_ints_from_statement().
+ *
+ * @param data The data passed along with the callback.
+ * @param value The value of the first column of the row.
+ * @return 0 to continue with the next row. Anything else stops the statement.
+ */
+typedef int (*db_int_callback)(void *data, int value);
+
+/**
+ * A growable array of integers, filled by db_append_int().
+ */
+struct db_int_buffer {
+	int *values;
+	int count;
+	int capacity;
+};
+
+/**
+ * Append a value to a struct db_int_buffer. Used as a db_int_callback.
+ *
+ * @param data The buffer.
+ * @param value The value to append.
+ * @return 0, to receive every value.
+ */
+static int db_append_int(void *data, int value) {
+	struct db_int_buffer *buffer = data;
 
-		/* append file ID to query */
-		file_id_str = calloc(num_digits_in_id + 1, sizeof(*file_id_str));
-		snprintf(file_id_str, num_digits_in_id + 1, "%d", file_id);
-		strncat(strncat(query, or_outline, strlen(or_outline)), file_id_str, strlen(file_id_str));
-		free_single_ptr((void *)&file_id_str);
+	if(buffer->count == buffer->capacity) {
+		buffer->capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 64;
+		buffer->values = realloc(buffer->values, buffer->capacity * sizeof(*buffer->values));
+		assert(buffer->values != NULL);
 	}
 
-	db_insert_query_results_into_hashtable(conn, query, table);
+	buffer->values[buffer->count++] = value;
+	return 0;
+} /* db_append_int */
+
+/**
+ * Stream the first column of a statement into a callback, running the
+ * statement once. The statement is reset when done, so a callback which stops
+ * early also ends the query early.
+ *
+ * @param res A bound sqlite statement handle.
+ * @param callback Called once per row, in the order of the statement.
+ * @param data Passed to the callback.
+ * @return The number of values handed to the callback.
+ */
+static int db_ints_from_statement(sqlite3_stmt *res, db_int_callback callback, void *data) {
+	bool stop = false;
+	int count = 0;
 
-	free_single_ptr((void *)&query);
-	db_disconnect(conn);
+	DEBUG(ENTRY);
 
-	/* copy results of set to array */
-	hash_table_size = g_hash_table_size(table);
-	*tags = malloc(hash_table_size * sizeof(**tags));
+	assert(res != NULL);
+	assert(callback != NULL);
 
-	g_hash_table_iter_init(&iter, table);
+	DEBUG("Streaming results of the query: %s", sqlite3_sql(res));
 
-	i = 0;
-	while(g_hash_table_iter_next(&iter, &key, &value)) {
-		(*tags)[i++] = (unsigned long)value;
+	while(!stop && db_step_statement(res) == SQLITE_ROW) {
+		stop = callback(data, sqlite3_column_int(res, 0)) != 0;
+		count++;
 	}
 
-	g_hash_table_destroy(table);
+	db_reset_statement(res);
 
-	DEBUG("Returning array of %d elements", hash_table_size);
+	DEBUG("Streamed %d results%s", count, stop ? ", stopped early" : "");
 	DEBUG(EXIT);
-	return hash_table_size;
-} /* db_tags_from_files */
-
-int db_count_from_query(char *query) {
-	char *count_query = NULL;
-	char select_count_outline[] = "SELECT COUNT(*) FROM ()";
-	int count = 0; /* number of rows returned from the count query */
-	int length = 0; /* length of the sqlite3 count query */
-	int written = 0; /* characters written by snprintf */
-	sqlite3 *conn = NULL;
+	return count;
+} /* db_ints_from_statement */
+
+/**
+ * Returns an integer array built from the first column of a statement, running
+ * the statement once. The statement is reset when done.
+ *
+ * @param res A bound sqlite statement handle.
+ * @param result_array OUT: The results from the first column. Left as NULL if there are no results.
+ * @return The number of results returned from the statement.
+ */
+static int db_int_array_from_statement(sqlite3_stmt *res, int **result_array) {
+	struct db_int_buffer buffer = { NULL, 0, 0 };
+
+	assert(*result_array == NULL);
+
+	db_ints_from_statement(res, db_append_int, &buffer);
+	*result_array = buffer.values;
+
+	return buffer.count;
+} /* db_int_array_from_statement */
+
+/**
+ * Queue a change in a batch. Queueing a change which is already queued does
+ * nothing, and adding a tag back to a file it is queued to be removed from
+ * cancels the removal, so that a rename within the tags a file already carries
+ * writes nothing for those tags.
+ *
+ * @param batch The batch.
+ * @param op The kind of change.
+ * @param tag_id The tag ID of the change, 0 if there is none.
+ * @param file_id The file ID of the change, 0 if there is none.
+ */
+static void db_batch_queue(struct db_batch *batch, enum db_batch_op op, int tag_id, int file_id) {
+	struct db_batch_entry *entry = NULL;
+	int i = 0;
+
+	assert(batch != NULL);
+
+	for(i = 0; i < batch->num_entries; i++) {
+		entry = &batch->entries[i];
+
+		if(entry->tag_id != tag_id || entry->file_id != file_id) {
+			continue;
+		}
+
+		if(entry->op == op) {
+			return;
+		} else if(entry->op == DB_BATCH_REMOVE_TAG && op == DB_BATCH_ADD_TAG) {
+			entry->op = DB_BATCH_NONE;
+			return;
+		}
+	}
+
+	if(batch->num_entries == batch->capacity) {
+		batch->capacity = batch->capacity > 0 ? batch->capacity * 2 : 8;
+		batch->entries = realloc(batch->entries, batch->capacity * sizeof(*batch->entries));
+		assert(batch->entries != NULL);
+	}
+
+	entry = &batch->entries[batch->num_entries++];
+	entry->op = op;
+	entry->tag_id = tag_id;
+	entry->file_id = file_id;
+	entry->changes = 0;
+} /* db_batch_queue */
+
+/**
+ * Write one queued change to the database. Must be called inside a transaction.
+ *
+ * @param entry The change. Its number of changed rows is filled in.
+ * @return The result of the operation, corresponding to the return codes of the sqlite3_step function call.
+ */
+static int db_batch_step(struct db_batch_entry *entry) {
+	int rc = SQLITE_DONE; /* return code of sqlite operation */
 	sqlite3_stmt *res = NULL;
 
-	DEBUG(ENTRY);
+	switch(entry->op) {
+		case DB_BATCH_ADD_TAG:
+			res = db_statement(DB_ADD_TAG_TO_FILE);
+			db_bind_int(res, 1, entry->file_id);
+			db_bind_int(res, 2, entry->tag_id);
+			break;
+		case DB_BATCH_REMOVE_TAG:
+			res = db_statement(DB_REMOVE_TAG_FROM_FILE);
+			db_bind_int(res, 1, entry->file_id);
+			db_bind_int(res, 2, entry->tag_id);
+			break;
+		case DB_BATCH_DELETE_FILE:
+			res = db_statement(DB_DELETE_FILE);
+			db_bind_int(res, 1, entry->file_id);
+			break;
+		case DB_BATCH_DELETE_EMPTY_TAGS:
+			res = db_statement(DB_DELETE_EMPTY_TAGS);
+			break;
+		case DB_BATCH_NONE:
+			return rc;
+	}
 
-	assert(query != NULL);
+	rc = db_step_statement(res);
+	db_reset_statement(res);
+
+	if(rc == SQLITE_DONE) {
+		entry->changes = sqlite3_changes(db_connect());
+	}
 
-	DEBUG("Calculating number of results returned from query: %s", query);
+	DEBUG("Batch change %d on tag ID %d and file ID %d changed %d rows", entry->op, entry->tag_id, entry->file_id, entry->changes);
+	return rc;
+} /* db_batch_step */
 
-	/* calculate query length */
-	length = strlen(query) + strlen(select_count_outline);
+/**
+ * Apply a committed change to the index.
+ *
+ * @param entry The change.
+ */
+static void db_batch_apply(const struct db_batch_entry *entry) {
+	int tag_id = 0;
+
+	switch(entry->op) {
+		case DB_BATCH_ADD_TAG:
+			index_add_tag_to_file(entry->tag_id, entry->file_id);
+			break;
+		case DB_BATCH_REMOVE_TAG:
+			index_remove_tag_from_file(entry->tag_id, entry->file_id);
+			break;
+		case DB_BATCH_DELETE_FILE:
+			index_remove_file(entry->file_id);
+			break;
+		case DB_BATCH_DELETE_EMPTY_TAGS:
+			if(entry->changes > 0) {
+				/* the changes before it are applied, so the index knows which tags lost their last file */
+				for(tag_id = 1; tag_id < dict_tag_id_limit(); tag_id++) {
+					if(index_count_files_with_tag(tag_id) == 0) {
+						dict_remove_tag(tag_id);
+					}
+				}
+
+				index_tag_names_changed();
+			}
+			break;
+		case DB_BATCH_NONE:
+			break;
+	}
+} /* db_batch_apply */
 
-	/* build count query */
-	count_query = malloc(length * sizeof(*count_query) + 1);
-	assert(count_query != NULL);
-	written = snprintf(count_query, length + 1, "SELECT COUNT(*) FROM (%s)", query);
-	assert(written == length);
-	DEBUG("Complete query: %s", count_query);
+void db_init() {
+	int rc = 0; /* return code of pthread operations */
 
-	conn = db_connect();
-	assert(conn != NULL);
+	DEBUG(ENTRY);
+	INFO("Starting database connection manager");
 
-	/* compile prepared statement */	
-	db_execute_statement(conn, count_query, &res);
+	TAGFS_DATA->db_handles = NULL;
 
-	/* get result of count */
-	count = sqlite3_column_int(res, 0);
+	rc = pthread_mutex_init(&TAGFS_DATA->db_lock, NULL);
+	assert(rc == 0);
+	rc = pthread_key_create(&TAGFS_DATA->db_key, db_release_handle);
+	assert(rc == 0);
 
-	db_finalize_statement(conn, count_query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&count_query);
+	/* open the first handle now so a bad database fails the mount, not the first lookup */
+	db_migrate(db_connect());
 
-	DEBUG("Query returns a count of %d", count);
 	DEBUG(EXIT);
-	return count;
-} /* db_count_from_query */
+} /* db_init */
 
-char *db_tag_name_from_tag_id(int tag_id) {
-	char *query = NULL;
-	char *tag_name = NULL;
-	char query_outline[] = "SELECT tag_name FROM tags WHERE tag_id = ";
-	int num_digits_in_id = 0;
-	int query_length = 0;
-	int query_outline_length = 0;
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
-	sqlite3_stmt *res = NULL;
+void db_destroy() {
+	struct db_handle *handle = NULL;
+	int i = 0;
 
 	DEBUG(ENTRY);
+	INFO("Closing database connections");
 
-	assert(tag_id > 0);
+	pthread_mutex_lock(&TAGFS_DATA->db_lock);
 
-	DEBUG("Retrieving tag name for tag ID %d", tag_id);
+	while(TAGFS_DATA->db_handles != NULL) {
+		handle = TAGFS_DATA->db_handles;
+		TAGFS_DATA->db_handles = handle->next;
 
-	/* prepare query */
-	num_digits_in_id = num_digits(tag_id);
-	query_outline_length = strlen(query_outline);
-	query_length = query_outline_length + num_digits_in_id;
-	query = malloc(query_length * sizeof(*query) + 1);
-	assert(query != NULL);
-	written = snprintf(query, query_length + 1, "%s%d", query_outline, tag_id);
-	assert(written == query_length);
+		for(i = 0; i < DB_STATEMENT_COUNT; i++) {
+			if(handle->statements[i] != NULL) {
+				db_finalize_statement(handle->statements[i]);
+			}
+		}
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+		for(i = 0; i <= DB_PATH_STATEMENT_CACHE; i++) {
+			if(handle->path_statements[0][i] != NULL) {
+				db_finalize_statement(handle->path_statements[0][i]);
+			}
 
-	db_execute_statement(conn, query, &res);
+			if(handle->path_statements[1][i] != NULL) {
+				db_finalize_statement(handle->path_statements[1][i]);
+			}
+		}
+
+		db_disconnect(handle->conn);
+		free_single_ptr((void **)&handle);
+	}
 
-	/* get name corresponding to tag_id */
-	tag_name = strdup((char *)sqlite3_column_text(res, 0));
+	pthread_mutex_unlock(&TAGFS_DATA->db_lock);
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&query);
+	pthread_setspecific(TAGFS_DATA->db_key, NULL);
+	pthread_key_delete(TAGFS_DATA->db_key);
+	pthread_mutex_destroy(&TAGFS_DATA->db_lock);
 
-	DEBUG("Tag ID %d corresponds to tag %s", tag_id, tag_name);
 	DEBUG(EXIT);
-	return tag_name;
-} /* db_tag_name_from_tag_id */
-
-int db_int_array_from_query(char *desired_column_name, char *result_query, int **result_array) {
-	bool column_match = false;
-	int result = 0;
-	int column_count = 0;
-	int desired_column_index = 0;
-	int i = 0;
-	int num_results = 0;
-	sqlite3 *conn = NULL;
+} /* db_destroy */
+
+/**
+ * Build the full path of a backing file from the current row of a statement
+ * whose first two columns are its directory and its name.
+ *
+ * @param res A sqlite statement handle, stepped to a row.
+ * @return The path, which must be free'd by the caller.
+ */
+static char *db_location_from_row(sqlite3_stmt *res) {
+	char *file_location = NULL;
+	const char *tmp_file_directory = NULL; /* holds text from the query so it can be copied to a new memory location */
+	const char *tmp_file_name = NULL; /* hold name of backing file until it can be copied to a new memory location */
+	int file_location_length = 0; /* length of the file location to return */
+	int written = 0; /* number of characters written */
+
+	/* get file location and name */
+	tmp_file_directory = (const char *)sqlite3_column_text(res, 0);
+	assert(tmp_file_directory != NULL);
+	tmp_file_name = (const char *)sqlite3_column_text(res, 1);
+	assert(tmp_file_name != NULL);
+
+	/* build full file path from name and directory */
+	file_location_length = strlen(tmp_file_directory) + strlen(tmp_file_name) + 1;
+	file_location = malloc(file_location_length * sizeof(*file_location) + 1);
+	written = snprintf((char *)file_location, file_location_length + 1, "%s/%s", tmp_file_directory, tmp_file_name);
+	assert(written == file_location_length);
+
+	return file_location;
+} /* db_location_from_row */
+
+char *db_get_file_location(int file_id) {
+	char *file_location = NULL;
 	sqlite3_stmt *res = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	assert(desired_column_name != NULL);
-	assert(result_query != NULL);
-	assert(*result_array == NULL);
+	assert(file_id > 0);
 
-	DEBUG("Creating array from the %s column of the query: %s", desired_column_name, result_query);
+	DEBUG("Retrieving physical location for file with ID %d", file_id);
 
-	num_results = db_count_from_query(result_query);
+	res = db_statement(DB_FILE_LOCATION);
+	db_bind_int(res, 1, file_id);
 
-	if(num_results > 0) {
-		*result_array = malloc(num_results * sizeof(**result_array));
-		assert(*result_array != NULL);
+	/* the kernel may still hold the inode number of a file deleted since */
+	if(db_step_statement(res) == SQLITE_ROW) {
+		file_location = db_location_from_row(res);
+	}
 
-		conn = db_connect();
-		assert(conn != NULL);
+	db_reset_statement(res);
 
-		db_prepare_statement(conn, result_query, &res);
-		column_count = sqlite3_column_count(res);
+	DEBUG("File id %d corresponds to %s", file_id, file_location != NULL ? file_location : "(none)");
+	stats_record(STATS_DB_GET_FILE_LOCATION, started);
+	DEBUG(EXIT);
+	return file_location;
+} /* db_get_file_location */
 
-		for(desired_column_index = 0; desired_column_index < column_count; desired_column_index++) { /* find the requested column */
-			if(strcmp(desired_column_name, sqlite3_column_name(res, desired_column_index)) == 0) { 
-				DEBUG("Matching column found (%s)", desired_column_name);
-				column_match = true;
-				break; 
-			}
-		}
+char *db_get_backing_file(int file_id) {
+	char *file_location = NULL;
+	sqlite3_stmt *res = NULL;
 
-		if(column_match == false) {
-			DEBUG("Matching column not found (%s)", desired_column_name);
-			ERROR("Unexpected input received from database.");
-		}
+	DEBUG(ENTRY);
 
-		for(i = 0; db_step_statement(conn, result_query, res) == SQLITE_ROW; i++) {
-			result = sqlite3_column_int(res, desired_column_index); 
-			(*result_array)[i] = result;
-		}
+	assert(file_id > 0);
+
+	res = db_statement(DB_BACKING_FILE);
+	db_bind_int(res, 1, file_id);
 
-		db_finalize_statement(conn, result_query, res);
-		db_disconnect(conn);
+	if(db_step_statement(res) == SQLITE_ROW) {
+		file_location = db_location_from_row(res);
 	}
 
+	db_reset_statement(res);
+
+	DEBUG("File id %d has backing file %s", file_id, file_location != NULL ? file_location : "(none of its own)");
 	DEBUG(EXIT);
-	return num_results;
-} /* db_int_array_from_query */
+	return file_location;
+} /* db_get_backing_file */
 
 int db_get_all_tags(int **tags) {
-	char query[] = "SELECT tag_id FROM tags";
 	int count = 0;
-	sqlite3 *conn = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
@@ -581,119 +1217,100 @@ int db_get_all_tags(int **tags) {
 
 	DEBUG("Retrieving all tags");
 
-	conn = db_connect();
-	assert(conn != NULL);
-
-	count = db_int_array_from_query("tag_id", query, tags);
-	db_disconnect(conn);
+	count = db_int_array_from_statement(db_statement(DB_ALL_TAGS), tags);
 
 	DEBUG("Returning a list of %d tags", count);
+	stats_record(STATS_DB_GET_ALL_TAGS, started);
 	DEBUG(EXIT);
 	return count;
 } /* db_get_all_tags */
 
-int db_get_all_files(int **files) {
-	char query[] = "SELECT file_id FROM files";
+int db_each_tag_name(db_name_callback callback, void *data) {
 	int count = 0;
-	sqlite3 *conn = NULL;
+	sqlite3_stmt *res = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	assert(*files == NULL);
+	assert(callback != NULL);
 
-	DEBUG("Retrieving all files");
+	res = db_statement(DB_ALL_TAG_NAMES);
 
-	conn = db_connect();
-	assert(conn != NULL);
+	while(db_step_statement(res) == SQLITE_ROW) {
+		count++;
+
+		if(callback(data, sqlite3_column_int(res, 0), (const char *)sqlite3_column_text(res, 1)) != 0) {
+			break;
+		}
+	}
 
-	count = db_int_array_from_query("file_id", query, files);
-	db_disconnect(conn);
+	db_reset_statement(res);
 
-	DEBUG("Returning a list of %d files", count);
+	DEBUG("Read the names of %d tags", count);
+	stats_record(STATS_DB_EACH_TAG_NAME, started);
 	DEBUG(EXIT);
 	return count;
-} /* db_get_all_files */
+} /* db_each_tag_name */
 
-int db_files_from_tag_id(int tag_id, int **files) {
-	char query_outline[] = "SELECT file_id FROM all_tables WHERE tag_id = ";
-	int query_outline_length = 0;
-	char *query = NULL;
+int db_get_all_files(int **files) {
 	int count = 0;
-	int query_length = 0;
-	int written = 0; /* number of characters written */
-	int num_digits_in_id = 0;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
 	assert(*files == NULL);
 
-	DEBUG("Retrieving files from tag ID %d", tag_id);
-
-	if(tag_id > 0) {
-		/* prepare query */
-		num_digits_in_id = num_digits(tag_id);
-		query_outline_length = strlen(query_outline);
-		query_length = query_outline_length + num_digits_in_id;
-		query = malloc(query_length * sizeof(*query) + 1);
-		assert(query != NULL);
-		written = snprintf(query, query_length + 1, "%s%d", query_outline, tag_id);
-		assert(written == query_length);
+	DEBUG("Retrieving all files");
 
-		count = db_int_array_from_query("file_id", query, files);
-		free_single_ptr((void **)&query);
-	} else {
-		count = db_int_array_from_query("file_id", "SELECT * FROM files WHERE file_id NOT IN (SELECT file_id FROM file_has_tag)", files);
-	}
+	count = db_int_array_from_statement(db_statement(DB_ALL_FILES), files);
 
 	DEBUG("Returning a list of %d files", count);
+	stats_record(STATS_DB_GET_ALL_FILES, started);
 	DEBUG(EXIT);
 	return count;
-} /* db_files_from_tag_id */
+} /* db_get_all_files */
 
-void db_delete_file(int file_id) {
-	char *query = NULL;
-	char query_outline[] = "DELETE FROM files WHERE file_id = \"\"";
-	int query_length = 0;
-	int rc = SQLITE_ERROR; /* return code of sqlite operation */
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
+int db_get_all_file_tags(int **files, int **tags) {
+	int capacity = 0;
+	int count = 0;
 	sqlite3_stmt *res = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	assert(file_id > 0);
+	assert(*files == NULL);
+	assert(*tags == NULL);
 
-	DEBUG("Deleting file with file ID %d", file_id);
+	DEBUG("Retrieving all tag assignments");
 
-	/* prepare query */
-	query_length = strlen(query_outline) + num_digits(file_id);
-	query = malloc(query_length * sizeof(*query) + 1);
-	assert(query != NULL);
-	written = snprintf(query, query_length + 1, "DELETE FROM files WHERE file_id = \"%d\"", file_id);
-	assert(written == query_length);
+	res = db_statement(DB_ALL_FILE_TAGS);
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	while(db_step_statement(res) == SQLITE_ROW) {
+		if(count == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 1024;
+			*files = realloc(*files, capacity * sizeof(**files));
+			assert(*files != NULL);
+			*tags = realloc(*tags, capacity * sizeof(**tags));
+			assert(*tags != NULL);
+		}
 
-	rc = db_execute_statement(conn, query, &res);
+		(*files)[count] = sqlite3_column_int(res, 0);
+		(*tags)[count] = sqlite3_column_int(res, 1);
+		count++;
+	}
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&query);
+	db_reset_statement(res);
 
-	DEBUG("File with ID %d was %sdeleted successfully.", file_id, rc == 0 ? "" : "not ")
+	DEBUG("Returning %d tag assignments", count);
+	stats_record(STATS_DB_GET_ALL_FILE_TAGS, started);
 	DEBUG(EXIT);
-} /* db_delete_file */
+	return count;
+} /* db_get_all_file_tags */
 
 void db_delete_tag(int tag_id) {
-	char *query = NULL;
-	char query_outline[] = "DELETE FROM tags WHERE tag_id = \"\"";
-	int query_length = 0;
 	int rc = SQLITE_ERROR; /* return code of sqlite operation */
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
 	sqlite3_stmt *res = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
@@ -701,197 +1318,250 @@ void db_delete_tag(int tag_id) {
 
 	DEBUG("Deleting tag with tag ID %d", tag_id);
 
-	/* prepare query */
-	query_length = strlen(query_outline) + num_digits(tag_id);
-	query = malloc(query_length * sizeof(*query) + 1);
-	assert(query != NULL);
-	written = snprintf(query, query_length + 1, "DELETE FROM tags WHERE tag_id = \"%d\"", tag_id);
-	assert(written == query_length);
-
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
-
-	rc = db_execute_statement(conn, query, &res);
+	res = db_statement(DB_DELETE_TAG);
+	db_bind_int(res, 1, tag_id);
+	rc = db_step_statement(res);
+	db_reset_statement(res);
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&query);
+	if(rc == SQLITE_DONE && sqlite3_changes(db_connect()) > 0) {
+		dict_remove_tag(tag_id);
+		index_tag_names_changed();
+	}
 
-	DEBUG("File with ID %d was %sdeleted successfully.", tag_id, rc == 0 ? "" : "not ")
+	DEBUG("Tag with ID %d was %sdeleted successfully.", tag_id, rc == SQLITE_DONE ? "" : "not ");
+	stats_record(STATS_DB_DELETE_TAG, started);
 	DEBUG(EXIT);
 } /* db_delete_tag */
 
-void db_delete_empty_tags() {
-	int rc = SQLITE_ERROR; /* return code of sqlite operation */
-	sqlite3 *conn = NULL;
+int db_files_at_path(const char **tags, int num_tags, int **files) {
+	bool cached = false;
+	struct db_int_buffer buffer = { NULL, 0, 0 };
 	sqlite3_stmt *res = NULL;
-	char query[] = "DELETE FROM tags WHERE tag_name NOT IN (SELECT DISTINCT tag_name FROM all_tables)";
 
 	DEBUG(ENTRY);
-	DEBUG("Preparing to purge all empty tags from the database.");
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	assert(num_tags >= 0);
+	assert(*files == NULL);
+
+	res = db_path_statement(db_distinct_tags(tags, num_tags), false, &cached);
+	db_bind_path(res, 1, tags, num_tags);
 
-	rc = db_execute_statement(conn, query, &res);
+	db_ints_from_statement(res, db_append_int, &buffer);
+	*files = buffer.values;
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
+	if(!cached) {
+		db_finalize_statement(res);
+	}
 
-	DEBUG("Purging empty tags was %ssuccessful", rc == SQLITE_DONE ? "" : "not");
+	DEBUG("%d files carrying all %d tags found", buffer.count, num_tags);
 	DEBUG(EXIT);
-} /* db_delete_empty_tags */
+	return buffer.count;
+} /* db_files_at_path */
 
-void db_add_tag_to_file(int tag_id, int file_id) {
-	char *query = NULL;
-	char query_outline[] = "INSERT INTO file_has_tag VALUES(, )";
-	int query_length = 0;
-	int rc = SQLITE_ERROR; /* return code of sqlite operation */
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
+int db_file_id_from_path(struct path_view *path) {
+	bool cached = false;
+	int file_id = 0;
+	int i = 0;
+	int index = 2; /* of the next tag name parameter, after the file name */
+	int num_distinct = 0;
+	int num_tags = 0;
 	sqlite3_stmt *res = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	assert(tag_id >= 0);
-	assert(file_id > 0);
+	assert(path != NULL);
+	assert(path->num_tags > 0);
 
-	/* prepare query */
-	query_length = strlen(query_outline) + num_digits(tag_id) + num_digits(file_id);
-	query = malloc(query_length * sizeof(*query) + 1);
-	assert(query != NULL);
-	written = snprintf(query, query_length + 1, "INSERT INTO file_has_tag VALUES(%d, %d)", file_id, tag_id);
-	assert(written == query_length);
+	num_tags = path->num_tags - 1; /* the last element is the file name */
+	DEBUG("Looking up %s", path->path);
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	/* repeating a tag filters by it only once, so only distinct names are bound */
+	path_distinct_tags(path);
 
-	rc = db_execute_statement(conn, query, &res);
+	for(i = 0; i < num_tags; i++) {
+		num_distinct += !path->repeated[i];
+	}
+
+	res = db_path_statement(num_distinct, true, &cached);
+	db_bind_text_length(res, 1, path_tag(path, num_tags), path_tag_length(path, num_tags));
+
+	for(i = 0; i < num_tags; i++) {
+		if(!path->repeated[i]) {
+			db_bind_text_length(res, index++, path_tag(path, i), path_tag_length(path, i));
+		}
+	}
+
+	if(db_step_statement(res) == SQLITE_ROW) {
+		file_id = sqlite3_column_int(res, 0);
+	}
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&query);
+	if(cached) {
+		db_reset_statement(res);
+	} else {
+		db_finalize_statement(res);
+	}
 
-	DEBUG("Adding tag ID %d to file ID %d was %ssuccessful", tag_id, file_id, rc == SQLITE_DONE ? "" : "not ");
+	DEBUG("%s has file ID %d", path->path, file_id);
+	stats_record(STATS_DB_FILE_ID_FROM_PATH, started);
 	DEBUG(EXIT);
-} /* db_add_tag_to_file */
+	return file_id;
+} /* db_file_id_from_path */
 
-void db_remove_tag_from_file(int tag_id, int file_id) {
-	char *query = NULL;
-	char query_outline[] = "DELETE FROM file_has_tag WHERE file_id =  AND tag_id = ";
-	int query_length = 0;
+int db_file_names_from_ids(const int *files, int num_files, db_name_callback callback, void *data) {
+	int count = 0;
+	uint64_t started = stats_now();
+
+	count = db_names_from_ids(DB_FILE_NAMES, files, num_files, callback, data);
+
+	stats_record(STATS_DB_FILE_NAMES_FROM_IDS, started);
+	return count;
+} /* db_file_names_from_ids */
+
+int db_create_file(const char *file_location, const char *file_name, const char *backing_name, const int *tags, int num_tags) {
+	int file_id = 0;
+	int i = 0;
 	int rc = SQLITE_ERROR; /* return code of sqlite operation */
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
 	sqlite3_stmt *res = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	assert(tag_id >= 0);
-	assert(file_id > 0);
+	assert(file_location != NULL);
+	assert(file_name != NULL);
+	assert(backing_name != NULL);
+	assert(num_tags == 0 || tags != NULL);
 
-	DEBUG("Removing tag ID %d from file with ID %d", tag_id, file_id);
+	DEBUG("Adding %s as %s in %s with %d tags", file_name, backing_name, file_location, num_tags);
 
-	/* prepare query */
-	query_length = strlen(query_outline) + num_digits(tag_id) + num_digits(file_id);
-	query = malloc(query_length * sizeof(*query) + 1);
-	assert(query != NULL);
-	written = snprintf(query, query_length + 1, "DELETE FROM file_has_tag WHERE file_id = %d AND tag_id = %d", file_id, tag_id);
-	assert(written == query_length);
+	rc = db_run_statement(DB_BEGIN);
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	if(rc == SQLITE_DONE) {
+		res = db_statement(DB_ADD_FILE);
+		db_bind_text(res, 1, file_location);
+		db_bind_text(res, 2, file_name);
+		db_bind_text(res, 3, backing_name);
+		rc = db_step_statement(res);
+		db_reset_statement(res);
+
+		file_id = (int)sqlite3_last_insert_rowid(db_connect());
+
+		for(i = 0; i < num_tags && rc == SQLITE_DONE; i++) {
+			res = db_statement(DB_ADD_TAG_TO_FILE);
+			db_bind_int(res, 1, file_id);
+			db_bind_int(res, 2, tags[i]);
+			rc = db_step_statement(res);
+			db_reset_statement(res);
+		}
+
+		if(rc == SQLITE_DONE) {
+			rc = db_run_statement(DB_COMMIT);
+		}
 
-	rc = db_execute_statement(conn, query, &res);
+		if(rc != SQLITE_DONE) {
+			WARN("Adding %s to the database failed, rolling back", file_name);
+			db_run_statement(DB_ROLLBACK);
+		}
+	}
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&query);
+	if(rc == SQLITE_DONE) { /* the index only learns about the file once it is committed */
+		index_add_file(file_id);
 
-	DEBUG("Removing tag ID %d from file with ID %d was %ssuccessful", tag_id, file_id, rc == SQLITE_DONE ? "" : "not ");
+		for(i = 0; i < num_tags; i++) {
+			index_add_tag_to_file(tags[i], file_id);
+		}
+	} else {
+		file_id = 0;
+	}
+
+	DEBUG("%s was %sadded with file ID %d", file_name, file_id > 0 ? "" : "not ", file_id);
+	stats_record(STATS_DB_CREATE_FILE, started);
 	DEBUG(EXIT);
-} /* db_remove_tag_from_file */
+	return file_id;
+} /* db_create_file */
 
-void db_remove_file(int file_id) {
-	char *query = NULL;
-	char query_outline[] = "DELETE FROM files WHERE file_id = ";
-	int query_length = 0;
-	int rc = SQLITE_ERROR; /* return code of sqlite operation */
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
-	sqlite3_stmt *res = NULL;
+struct db_batch *db_batch_begin() {
+	struct db_batch *batch = NULL;
 
-	DEBUG(ENTRY);
+	batch = calloc(1, sizeof(*batch));
+	assert(batch != NULL);
+
+	return batch;
+} /* db_batch_begin */
 
+void db_batch_add_tag(struct db_batch *batch, int tag_id, int file_id) {
+	assert(tag_id > 0);
 	assert(file_id > 0);
 
-	DEBUG("Removing file ID %d", file_id);
+	db_batch_queue(batch, DB_BATCH_ADD_TAG, tag_id, file_id);
+} /* db_batch_add_tag */
 
-	/* prepare query */
-	query_length = strlen(query_outline) + num_digits(file_id);
-	query = malloc(query_length * sizeof(*query) + 1);
-	assert(query != NULL);
-	written = snprintf(query, query_length + 1, "DELETE FROM files WHERE file_id = %d", file_id);
-	assert(written == query_length);
+void db_batch_remove_tag(struct db_batch *batch, int tag_id, int file_id) {
+	assert(tag_id > 0);
+	assert(file_id > 0);
 
-	/* connect to database */
-	conn = db_connect();
-	assert(conn != NULL);
+	db_batch_queue(batch, DB_BATCH_REMOVE_TAG, tag_id, file_id);
+} /* db_batch_remove_tag */
 
-	rc = db_execute_statement(conn, query, &res);
+void db_batch_delete_file(struct db_batch *batch, int file_id) {
+	assert(file_id > 0);
 
-	db_finalize_statement(conn, query, res);
-	db_disconnect(conn);
-	free_single_ptr((void **)&query);
+	db_batch_queue(batch, DB_BATCH_DELETE_FILE, 0, file_id);
+} /* db_batch_delete_file */
 
-	DEBUG("Removing file ID %d was %ssuccessful", file_id, rc == SQLITE_DONE ? "" : "not ");
-	DEBUG(EXIT);
-} /* db_remove_file */
+void db_batch_delete_empty_tags(struct db_batch *batch) {
+	db_batch_queue(batch, DB_BATCH_DELETE_EMPTY_TAGS, 0, 0);
+} /* db_batch_delete_empty_tags */
 
-int db_tag_id_from_tag_name(char *tag_name) {
-	char *query = NULL;
-	int tag_id = -1;
-	char query_outline[] = "SELECT tag_id FROM tags WHERE tag_name = \"\"";
-	int query_length = 0;
-	int written = 0; /* number of characters written */
-	sqlite3 *conn = NULL;
-	sqlite3_stmt *res = NULL;
+bool db_batch_commit(struct db_batch **batch) {
+	int i = 0;
+	int num_changes = 0;
+	int rc = SQLITE_DONE; /* return code of sqlite operation */
+	struct db_batch_entry *entries = NULL;
+	uint64_t started = stats_now();
 
 	DEBUG(ENTRY);
 
-	assert(tag_name != NULL);
+	assert(batch != NULL);
+	assert(*batch != NULL);
 
-	DEBUG("Retrieving tag name for tag ID %s", tag_name);
+	entries = (*batch)->entries;
 
-	if(strcmp(tag_name, "/") == 0) {
-		tag_id = 0;
-	} else {
-		/* prepare query */
-		query_length = strlen(query_outline) + strlen(tag_name);
-		query = malloc(query_length * sizeof(*query) + 1);
-		assert(query != NULL);
-		written = snprintf(query, query_length + 1, "SELECT tag_id FROM tags WHERE tag_name = \"%s\"", tag_name);
-		assert(written == query_length);
+	for(i = 0; i < (*batch)->num_entries; i++) {
+		if(entries[i].op != DB_BATCH_NONE) {
+			num_changes++;
+		}
+	}
 
-		/* connect to database */
-		conn = db_connect();
-		assert(conn != NULL);
+	DEBUG("Committing %d changes", num_changes);
 
-		db_execute_statement(conn, query, &res);
+	if(num_changes > 0) {
+		rc = db_run_statement(DB_BEGIN);
 
-		/* get name corresponding to tag_id */
-		tag_id = sqlite3_column_int(res, 0);
+		for(i = 0; i < (*batch)->num_entries && rc == SQLITE_DONE; i++) {
+			rc = db_batch_step(&entries[i]);
+		}
 
-		db_finalize_statement(conn, query, res);
-		db_disconnect(conn);
-		free_single_ptr((void **)&query);
+		if(rc == SQLITE_DONE) {
+			rc = db_run_statement(DB_COMMIT);
+		}
+
+		if(rc != SQLITE_DONE) {
+			WARN("Committing %d changes failed, rolling back", num_changes);
+			db_run_statement(DB_ROLLBACK);
+		}
 	}
 
-	DEBUG("Tag %s corresponds to tag ID %d", tag_name, tag_id);
+	if(rc == SQLITE_DONE) { /* the index only learns about the changes once they are committed */
+		for(i = 0; i < (*batch)->num_entries; i++) {
+			db_batch_apply(&entries[i]);
+		}
+	}
+
+	free(entries);
+	free_single_ptr((void **)batch);
+
+	stats_record(STATS_DB_BATCH_COMMIT, started);
 	DEBUG(EXIT);
-	return tag_id;
-} /* db_tag_id_from_tag_name */
+	return rc == SQLITE_DONE;
+} /* db_batch_commit */
@@ -9,51 +9,55 @@
 #ifndef TAGFS_DB_H
 #define TAGFS_DB_H
 
+#include <stdbool.h>
+
+struct db_batch;
+struct path_view;
+
 /**
- * Returns a physical file system location corresponding to a location in the 
- * TagFS.
+ * Receives one name from a batched name lookup. The name is only valid until
+ * the callback returns.
  *
- * @param file_id The file ID for which to return the full physical path.
- * @return The path to the physical location in the file system corresponding 
- * to the file ID in the TagFS.
+ * @param data The data passed along with the callback.
+ * @param id The ID of the file or tag.
+ * @param name The name of the file or tag.
+ * @return 0 to continue with the next name. Anything else stops the lookup.
  */
-char *db_get_file_location(int file_id);
+typedef int (*db_name_callback)(void *data, int id, const char *name);
 
 /**
- * Retrieve a set of unique tags associated with a collection of file IDs
- *
- * @param files Array of file IDs.
- * @param num_files Number of file IDs in the array.
- * @param folders The collection of tags associated with the file IDs.
- * @return The number of unique tags associated with the file IDs.
+ * Start the database connection manager. Must be called once from tagfs_init,
+ * after the database path has been set. Opens the first database handle, so a 
+ * missing or unreadable database is reported at mount time. Every thread is 
+ * then given its own long-lived handle the first time it runs a db_* function.
  */
-int db_tags_from_files(int *files, int num_files, int **folders);
+void db_init();
 
 /**
- * Return the number of rows returned from the specified query.
- *
- * @param query The query which will be run to count the results.
- * @return The number of rows returned by the query.
+ * Close every database handle opened by the connection manager. Must be called 
+ * once from tagfs_destroy.
  */
-int db_count_from_query(char *query);
+void db_destroy();
 
 /**
- * Converts a tag ID into its corresponding tag name.
+ * Returns a physical file system location corresponding to a location in the 
+ * TagFS.
  *
- * @param tag_id The tag ID to match to its corresponding tag name.
- * @return The tag name corresponding to the specified tag ID.
+ * @param file_id The file ID for which to return the full physical path.
+ * @return The path to the physical location in the file system corresponding 
+ * to the file ID in the TagFS, or NULL if there is no such file.
  */
-char *db_tag_name_from_tag_id(int tag_id);
+char *db_get_file_location(int file_id);
 
 /**
- * Returns an integer array representing a column in the database where the results correspond to those returned from a query.
+ * Returns the location of the backing file TagFS created for a file, see
+ * tagfs_create. Files which were added to the database by hand keep their own
+ * location, and are never returned.
  *
- * @param desired_column_name The name of the column to pull results from.
- * @param result_query The query to run against the database.
- * @param result_array The array with which to store results from the column returned from result_query matching the name desired_column_name.
- * @return The number of results returned from the query.
+ * @param file_id The ID of the file.
+ * @return The path to the backing file, which must be free'd by the caller, or NULL if TagFS did not create it.
  */
-int db_int_array_from_query(char *desired_column_name, char *result_query, int **result_array);
+char *db_get_backing_file(int file_id);
 
 /**
  * Returns an array of all tags.
@@ -63,6 +67,16 @@ int db_int_array_from_query(char *desired_column_name, char *result_query, int *
  */
 int db_get_all_tags(int **tags);
 
+/**
+ * Stream the ID and name of every tag into a callback. Used to load the tag
+ * dictionary, see tagfs_dict.h.
+ *
+ * @param callback Called once per tag, in no particular order.
+ * @param data Passed to the callback.
+ * @return The number of tags handed to the callback.
+ */
+int db_each_tag_name(db_name_callback callback, void *data);
+
 /**
  * Returns an array of all files.
  *
@@ -72,69 +86,125 @@ int db_get_all_tags(int **tags);
 int db_get_all_files(int **files);
 
 /**
- * Returns files associated with a tag ID.
+ * Returns every row of the file_has_tag table, sorted by tag ID and then by file
+ * ID. Both returned arrays must be free'd by the caller.
+ *
+ * @param files OUT: The file ID of each row. Left as NULL if the table is empty.
+ * @param tags OUT: The tag ID of each row. Left as NULL if the table is empty.
+ * @return The number of rows.
+ */
+int db_get_all_file_tags(int **files, int **tags);
+
+/**
+ * Delete a tag from the TagFS by its corresponding tag ID.
  *
- * @param tag_id The tag ID to use when checking for files.
- * @param file_array OUT: The files which match the tag ID.
- * @return The number of files matching the tag ID.
+ * @param tag_id The ID of the tag to delete.
  */
-int db_files_from_tag_id(int tag_id, int **file_array);
+void db_delete_tag(int tag_id);
 
 /**
- * Retrieve the tag ID from a tag name.
+ * Returns the files at a tag path, found by a single SQL statement. This is the
+ * database counterpart of files_at_location(), and does not use the in-memory
+ * tag index. An empty path returns the untagged files.
+ *
+ * The mount never calls this; paths are always resolved through the index. It
+ * is kept as a reference implementation for tagfs_bench, which times it
+ * against the index.
  *
- * @param tag_name The tag to match to its corresponding tag ID.
- * @return The tag ID which matches the tag name.
+ * @param tags The tag names in the path. Names which appear more than once are only filtered by once.
+ * @param num_tags The number of tag names.
+ * @param files OUT: The files carrying every tag, sorted by file ID. Left as NULL if there are none.
+ * @return The number of files at the path.
  */
-int db_tag_id_from_tag_name(char *tag_name);
+int db_files_at_path(const char **tags, int num_tags, int **files);
 
 /**
- * Delete a file from the TagFS by its corresponding file ID.
+ * Returns the file a path names, found by a single SQL statement. The tags are
+ * bound straight from the view, without copying them.
  *
- * @param file_id The ID of the file to delete.
+ * @param path The view of the path. Its last element is the file name, the rest are the tags of its directory. Tags which appear more than once are only filtered by once, and a path without tags looks among the untagged files.
+ * @return The ID of the file, or 0 if no file of that name carries every tag.
  */
-void db_delete_file(int file_id);
+int db_file_id_from_path(struct path_view *path);
 
 /**
- * Delete a tag from the TagFS by its corresponding tag ID.
+ * Look up the names of a set of files with one query per few hundred files,
+ * instead of one query per file, and stream them into a callback.
  *
- * @param tag_id The ID of the tag to delete.
+ * @param files The file IDs.
+ * @param num_files The number of file IDs.
+ * @param callback Called once per file found, in no particular order.
+ * @param data Passed to the callback.
+ * @return The number of names handed to the callback.
  */
-void db_delete_tag(int tag_id);
+int db_file_names_from_ids(const int *files, int num_files, db_name_callback callback, void *data);
 
 /**
- * Deletes all tags from the database which are not associated with files.
+ * Add a file to the database along with its tags, in a single transaction. 
+ * Either the file and all of its tags are added, or nothing is.
+ *
+ * @param file_location The directory of the backing file.
+ * @param file_name The name of the file, as it is listed in the filesystem.
+ * @param backing_name The name of the backing file in file_location.
+ * @param tags The IDs of the tags to put on the file.
+ * @param num_tags The number of tag IDs.
+ * @return The ID of the new file, or 0 if it could not be added.
  */
-void db_delete_empty_tags();
+int db_create_file(const char *file_location, const char *file_name, const char *backing_name, const int *tags, int num_tags);
 
 /**
- * Adds an existing tag to a file.
+ * Start a batch of changes to the tags of files. The changes are only queued;
+ * db_batch_commit() writes all of them in one transaction and then applies
+ * them to the index, so every filesystem operation changes the database
+ * atomically and syncs it once. Must be used while holding tag_write_lock().
  *
- * @param tag_id The ID of the tag to add to the file.
- * @param file_id The ID of the file to add the tag to.
+ * @return An empty batch, to be handed to db_batch_commit().
  */
-void db_add_tag_to_file(int tag_id, int file_id);
+struct db_batch *db_batch_begin();
 
 /**
- * Removes a tag from a file.
+ * Queue adding an existing tag to a file.
  *
+ * @param batch The batch.
  * @param tag_id The ID of the tag to add to the file.
  * @param file_id The ID of the file to add the tag to.
  */
-void db_remove_tag_from_file(int tag_id, int file_id);
+void db_batch_add_tag(struct db_batch *batch, int tag_id, int file_id);
+
+/**
+ * Queue removing a tag from a file.
+ *
+ * @param batch The batch.
+ * @param tag_id The ID of the tag to remove from the file.
+ * @param file_id The ID of the file to remove the tag from.
+ */
+void db_batch_remove_tag(struct db_batch *batch, int tag_id, int file_id);
+
+/**
+ * Queue deleting a file, along with its tags.
+ *
+ * @param batch The batch.
+ * @param file_id The ID of the file to delete.
+ */
+void db_batch_delete_file(struct db_batch *batch, int file_id);
 
 /**
- * Remove a file from the filesystem.
+ * Queue deleting every tag which no longer has any files, after the changes
+ * queued before it.
  *
- * @param file_id The ID of the file to be removed from the filesystem.
+ * @param batch The batch.
  */
-void db_remove_file(int file_id);
+void db_batch_delete_empty_tags(struct db_batch *batch);
 
 /**
- * Retrieve the tag ID from a tag name.
+ * Write the changes of a batch to the database in one transaction, in the
+ * order they were queued, then apply them to the index. If any change fails,
+ * the transaction is rolled back and neither the database nor the index
+ * change. The batch is free'd either way.
  *
- * @param tag_name The tag name.
+ * @param batch The batch. Set to NULL.
+ * @return True, if the changes were committed. False, otherwise.
  */
-int db_tag_id_from_tag_name(char *tag_name);
+bool db_batch_commit(struct db_batch **batch);
 
 #endif
@@ -1,39 +1,226 @@
 #include "tagfs_debug.h"
 
 #include <assert.h>
-#include <semaphore.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
-sem_t debug_sem;
+/**
+ * One message in the ring. The sequence number tells whose turn the slot is:
+ * equal to a position, the slot is free for the producer claiming that
+ * position; one past it, the message is ready for the writer.
+ */
+struct debug_slot {
+	atomic_size_t sequence;
+	int level;
+	struct timespec time;
+	char message[TAGFS_LOG_MESSAGE_SIZE];
+};
 
-void log_timestamp() {
-	char *buf = NULL;
-	const char *format = "mm/dd/yy hh/mm/ss";
-	int length = 0;
-	struct tm *timeinfo;
-	time_t rawtime;
+int debug_level = TAGFS_LOG_DEBUG;
+
+static const char *debug_level_names[] = {
+	[TAGFS_LOG_DEBUG] = "debug",
+	[TAGFS_LOG_INFO] = "info",
+	[TAGFS_LOG_WARN] = "warning",
+	[TAGFS_LOG_ERROR] = "error"
+};
+
+static const char *debug_level_tags[] = {
+	[TAGFS_LOG_DEBUG] = "DEBUG",
+	[TAGFS_LOG_INFO] = "INFO",
+	[TAGFS_LOG_WARN] = "WARNING",
+	[TAGFS_LOG_ERROR] = "ERROR"
+};
+
+static struct debug_slot debug_ring[TAGFS_LOG_SLOTS];
+static atomic_size_t debug_enqueue_pos; /* next position a producer claims */
+static size_t debug_dequeue_pos; /* next position the writer reads, only touched by the writer */
+static atomic_ulong debug_dropped; /* messages lost to a full ring since the writer last looked */
+static atomic_bool debug_running;
+static bool debug_started; /* debug_start() ran, so the writer drains the ring */
+static pthread_t debug_writer;
+static FILE *debug_file;
+
+/**
+ * Writes every message that is ready to a file, in the order the positions
+ * were claimed. Must only be called by one thread at a time.
+ *
+ * @param file The file to write to.
+ * @return The number of messages written.
+ */
+static int debug_drain(FILE *file) {
+	static char buf[sizeof("mm/dd/yy hh:mm:ss")];
+	static time_t buf_time = -1; /* second formatted into buf */
+	int count = 0;
+	struct debug_slot *slot = NULL;
+	struct tm timeinfo;
+	unsigned long dropped = 0;
+
+	flockfile(file); /* once for the whole batch instead of once per fprintf() */
+
+	for(;;) {
+		slot = &debug_ring[debug_dequeue_pos % TAGFS_LOG_SLOTS];
+
+		if(atomic_load_explicit(&slot->sequence, memory_order_acquire) != debug_dequeue_pos + 1) {
+			break; /* empty, or the producer is still writing the message */
+		}
+
+		if(slot->time.tv_sec != buf_time) { /* localtime_r() takes a lock, so only once per second */
+			localtime_r(&slot->time.tv_sec, &timeinfo);
+			strftime(buf, sizeof(buf), "%x %X", &timeinfo);
+			buf_time = slot->time.tv_sec;
+		}
 
-	length = strlen(format);
-	buf = malloc(length * sizeof(*buf) + 1);
-	assert(buf != NULL);
+		if(slot->level >= TAGFS_LOG_WARN) {
+			fprintf(file, "%s: %s\n", buf, slot->message); /* carries the source location */
+		} else {
+			fprintf(file, "%s: [%s] %s\n", buf, debug_level_tags[slot->level], slot->message);
+		}
 
-	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+		atomic_store_explicit(&slot->sequence, debug_dequeue_pos + TAGFS_LOG_SLOTS, memory_order_release);
+		debug_dequeue_pos++;
+		count++;
+	}
 
-	strftime(buf, length + 1, "%x %X", timeinfo);
+	dropped = atomic_exchange(&debug_dropped, 0);
 
-	fprintf(TAGFS_DATA->log_file, "%s", buf);
+	if(dropped > 0) {
+		fprintf(file, "[WARNING] Log ring buffer full, %lu messages dropped\n", dropped);
+	}
 
-	free(buf);
-} /* log_timestamp */
+	if(count > 0 || dropped > 0) {
+		fflush(file);
+	}
+
+	funlockfile(file);
+
+	return count;
+} /* debug_drain */
+
+/**
+ * Writer thread. Drains the ring until debug_stop(), sleeping while it is
+ * empty, and drains it once more on the way out.
+ *
+ * @param data Unused.
+ * @return NULL.
+ */
+static void *debug_write(void *data) {
+	while(atomic_load(&debug_running)) {
+		if(debug_drain(debug_file) == 0) {
+			usleep(TAGFS_LOG_IDLE_USEC);
+		}
+	}
+
+	debug_drain(debug_file);
+
+	return NULL;
+} /* debug_write */
 
 void debug_init() {
-	sem_init(&debug_sem, 0, 1);
-}
-
-void debug_wait() {
-	sem_wait(&debug_sem);
-}
-void debug_post() {
-	sem_post(&debug_sem);
-}
+	size_t i = 0;
+
+	for(i = 0; i < TAGFS_LOG_SLOTS; i++) {
+		atomic_init(&debug_ring[i].sequence, i);
+	}
+
+	atomic_init(&debug_enqueue_pos, 0);
+	atomic_init(&debug_dropped, 0);
+	atomic_init(&debug_running, false);
+	debug_started = false;
+	debug_dequeue_pos = 0;
+} /* debug_init */
+
+void debug_start(FILE *log_file) {
+	assert(log_file != NULL);
+	assert(!atomic_load(&debug_running));
+
+	debug_file = log_file;
+	atomic_store(&debug_running, true);
+
+	if(pthread_create(&debug_writer, NULL, debug_write, NULL) != 0) {
+		atomic_store(&debug_running, false);
+		fprintf(stderr, "Unable to start the log writer thread\n");
+		return;
+	}
+
+	debug_started = true;
+} /* debug_start */
+
+void debug_stop() {
+	if(atomic_exchange(&debug_running, false)) {
+		pthread_join(debug_writer, NULL);
+	} else if(!debug_started) {
+		debug_drain(stderr);
+	}
+} /* debug_stop */
+
+void debug_set_level(int level) {
+	assert(level >= TAGFS_LOG_DEBUG && level <= TAGFS_LOG_ERROR);
+
+	debug_level = level;
+} /* debug_set_level */
+
+int debug_level_from_name(const char *name) {
+	int level = 0;
+
+	assert(name != NULL);
+
+	for(level = TAGFS_LOG_DEBUG; level <= TAGFS_LOG_ERROR; level++) {
+		if(strcasecmp(name, debug_level_names[level]) == 0) {
+			return level;
+		}
+	}
+
+	return -1;
+} /* debug_level_from_name */
+
+void debug_log(int level, const char *file, int line, const char *format, ...) {
+	int length = 0;
+	intptr_t diff = 0;
+	size_t pos = 0;
+	size_t sequence = 0;
+	struct debug_slot *slot = NULL;
+	va_list args;
+
+	/* claim a slot, or give up if the ring is full */
+	pos = atomic_load_explicit(&debug_enqueue_pos, memory_order_relaxed);
+
+	for(;;) {
+		slot = &debug_ring[pos % TAGFS_LOG_SLOTS];
+		sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if(diff == 0) {
+			if(atomic_compare_exchange_weak_explicit(&debug_enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if(diff < 0) {
+			atomic_fetch_add(&debug_dropped, 1);
+			return;
+		} else {
+			pos = atomic_load_explicit(&debug_enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	slot->level = level;
+	clock_gettime(CLOCK_REALTIME, &slot->time);
+
+	if(file != NULL) {
+		length = snprintf(slot->message, sizeof(slot->message), "%s(%d): [%s] ", file, line, debug_level_tags[level]);
+	}
+
+	if(length >= 0 && length < (int)sizeof(slot->message)) {
+		va_start(args, format);
+		vsnprintf(slot->message + length, sizeof(slot->message) - length, format, args);
+		va_end(args);
+	}
+
+	atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+} /* debug_log */
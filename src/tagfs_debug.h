@@ -1,6 +1,13 @@
 /**
  * Debug related functions and macros.
  *
+ * Messages are formatted on the calling thread into a fixed-size ring buffer,
+ * and written to the log file by a background writer thread, so a request
+ * thread never waits on a lock or on the log file. If the ring is full, the
+ * message is dropped and the writer reports how many were lost. Messages below
+ * the level set with debug_set_level() cost a single branch. Building with
+ * -DTAGFS_NO_DEBUG removes DEBUG messages altogether.
+ *
  * @file tagfs_debug.h
  * @author Keith Woelke
  * @date 10/14/2010
@@ -9,73 +16,105 @@
 #ifndef TAGFS_DEBUG_H
 #define TAGFS_DEBUG_H
 
-#include "tagfs_debug.h"
 #include "tagfs_params.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
-#define INFO(...) \
-debug_wait(); \
-log_timestamp(); \
-fprintf(TAGFS_DATA->log_file, ": [INFO] "); \
-fprintf(TAGFS_DATA->log_file, __VA_ARGS__); \
-fprintf(TAGFS_DATA->log_file, "\n"); \
-fflush(TAGFS_DATA->log_file); \
-debug_post();
+/**
+ * Log levels, from the most to the least verbose.
+ */
+enum debug_level {
+	TAGFS_LOG_DEBUG,
+	TAGFS_LOG_INFO,
+	TAGFS_LOG_WARN,
+	TAGFS_LOG_ERROR
+};
+
+/**
+ * Lowest level written to the log. Only changed by debug_set_level().
+ */
+extern int debug_level;
 
+#define TAGFS_LOG(level, file, line, ...) \
+do { \
+	if((level) >= debug_level) { \
+		debug_log((level), (file), (line), __VA_ARGS__); \
+	} \
+} while(0)
+
+#define INFO(...) TAGFS_LOG(TAGFS_LOG_INFO, NULL, 0, __VA_ARGS__)
+
+#ifdef TAGFS_NO_DEBUG
+/* still type checks the arguments, but the compiler drops the call */
 #define DEBUG(...) \
-debug_wait(); \
-log_timestamp(); \
-fprintf(TAGFS_DATA->log_file, ": [DEBUG] "); \
-fprintf(TAGFS_DATA->log_file, __VA_ARGS__); \
-fprintf(TAGFS_DATA->log_file, "\n"); \
-fflush(TAGFS_DATA->log_file); \
-debug_post();
-
-#define WARN(...) \
-debug_wait(); \
-log_timestamp(); \
-fprintf(TAGFS_DATA->log_file, ": "); \
-fprintf(TAGFS_DATA->log_file, "%s(%d): [WARNING] ", __FILE__, __LINE__); \
-fprintf(TAGFS_DATA->log_file, __VA_ARGS__); \
-fprintf(TAGFS_DATA->log_file, "\n"); \
-fflush(TAGFS_DATA->log_file); \
-debug_post();
+do { \
+	if(0) { \
+		debug_log(TAGFS_LOG_DEBUG, NULL, 0, __VA_ARGS__); \
+	} \
+} while(0)
+#else
+#define DEBUG(...) TAGFS_LOG(TAGFS_LOG_DEBUG, NULL, 0, __VA_ARGS__)
+#endif
+
+#define WARN(...) TAGFS_LOG(TAGFS_LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
 
 #define ERROR(...) \
-debug_wait(); \
-log_timestamp(); \
-fprintf(TAGFS_DATA->log_file, ": "); \
-fprintf(TAGFS_DATA->log_file, "%s(%d): [ERROR] ", __FILE__, __LINE__); \
-fprintf(TAGFS_DATA->log_file, __VA_ARGS__); \
-fprintf(TAGFS_DATA->log_file, "\n"); \
-fflush(TAGFS_DATA->log_file); \
-debug_post(); \
-exit(EXIT_FAILURE)
+do { \
+	debug_log(TAGFS_LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__); \
+	debug_stop(); \
+	exit(EXIT_FAILURE); \
+} while(0)
 
 #define ENTRY "---> %s", __FUNCTION__
 
 #define EXIT "<--- %s", __FUNCTION__
 
 /**
- * Prints the current date and time to the log.
+ * Initializes the ring buffer. Must be called once from main, before any
+ * message is logged.
+ */
+void debug_init();
+
+/**
+ * Starts the writer thread. Messages logged before it starts wait in the ring.
+ * Must be called once from tagfs_init, since the thread would not survive
+ * fuse_main() putting the filesystem in the background.
+ *
+ * @param log_file The file the writer thread writes to. Must stay open until debug_stop().
  */
-void log_timestamp();
+void debug_start(FILE *log_file);
 
 /**
- * Initializes the debug semaphore.
+ * Writes out every message still in the ring and stops the writer thread.
+ * Messages logged afterwards are not written. If the writer thread never
+ * started, the messages go to stderr instead.
  */
-void debug_init();
+void debug_stop();
 
 /**
- * Sets the debug semaphore.
+ * Sets the lowest level written to the log.
+ *
+ * @param level One of debug_level.
  */
-void debug_wait();
+void debug_set_level(int level);
 
 /**
- * Unsets the debug semaphore.
+ * Returns the level with a given name.
+ *
+ * @param name debug, info, warning or error, in any case.
+ * @return One of debug_level, or -1 if there is no such level.
+ */
+int debug_level_from_name(const char *name);
+
+/**
+ * Queues a message for the writer thread. Use the macros instead.
+ *
+ * @param level One of debug_level.
+ * @param file The source file to name in the message, or NULL.
+ * @param line The line in the source file.
+ * @param format printf style format of the message. Messages longer than TAGFS_LOG_MESSAGE_SIZE are cut short.
  */
-void debug_post();
+void debug_log(int level, const char *file, int line, const char *format, ...) __attribute__((format(printf, 4, 5)));
 
 #endif
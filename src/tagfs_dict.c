@@ -0,0 +1,349 @@
+#include "tagfs_common.h"
+#include "tagfs_debug.h"
+#include "tagfs_dict.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DICT_BLOCK_SIZE 65536 /* bytes of names per arena block, unless a name is longer */
+#define DICT_EMPTY 0 /* slot never used, ends a probe */
+#define DICT_DELETED -1 /* slot of a deleted tag, skipped by a probe */
+
+/**
+ * Block of the string arena. Names are appended until the block is full, and
+ * never moved or free'd before dict_destroy().
+ */
+struct dict_block {
+	struct dict_block *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+/**
+ * Slot of the name hash table. The name itself is looked up through names, so
+ * a slot stays small and a probe only compares strings on a full hash match.
+ */
+struct dict_slot {
+	uint32_t hash;
+	int tag_id; /* or DICT_EMPTY, or DICT_DELETED */
+};
+
+struct tag_dict {
+	pthread_rwlock_t lock; /* readers look up, writers remove tags */
+	struct dict_block *arena; /* newest block first */
+	const char **names; /* tag ID -> name, NULL if there is no such tag */
+	int num_names;
+	struct dict_slot *slots; /* open addressing with linear probing */
+	int capacity; /* power of two, at least twice the number of used slots */
+	int used; /* slots holding a tag or a deleted tag */
+};
+
+/**
+ * FNV-1a hash of a tag name.
+ *
+ * @param name The name.
+ * @param length The length of the name.
+ * @return The hash.
+ */
+static uint32_t dict_hash(const char *name, int length) {
+	int i = 0;
+	uint32_t hash = 2166136261u;
+
+	for(i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+} /* dict_hash */
+
+/**
+ * Copy a name into the arena.
+ *
+ * @param dict The dictionary.
+ * @param name The name to copy.
+ * @return The copy, valid until dict_destroy().
+ */
+static const char *dict_intern(struct tag_dict *dict, const char *name) {
+	char *copy = NULL;
+	size_t length = strlen(name) + 1;
+	size_t size = 0;
+	struct dict_block *block = dict->arena;
+
+	if(block == NULL || block->size - block->used < length) {
+		size = length > DICT_BLOCK_SIZE ? length : DICT_BLOCK_SIZE;
+		block = malloc(sizeof(*block) + size);
+		assert(block != NULL);
+		block->next = dict->arena;
+		block->used = 0;
+		block->size = size;
+		dict->arena = block;
+	}
+
+	copy = block->data + block->used;
+	memcpy(copy, name, length);
+	block->used += length;
+
+	return copy;
+} /* dict_intern */
+
+/**
+ * Put a tag in the hash table, which must have a free slot.
+ *
+ * @param dict The dictionary.
+ * @param hash The hash of the tag name.
+ * @param tag_id The ID of the tag.
+ */
+static void dict_place(struct tag_dict *dict, uint32_t hash, int tag_id) {
+	int mask = dict->capacity - 1;
+	int slot = hash & mask;
+
+	while(dict->slots[slot].tag_id != DICT_EMPTY) {
+		slot = (slot + 1) & mask;
+	}
+
+	dict->slots[slot].hash = hash;
+	dict->slots[slot].tag_id = tag_id;
+	dict->used++;
+} /* dict_place */
+
+/**
+ * Double the hash table, leaving deleted slots behind.
+ *
+ * @param dict The dictionary.
+ */
+static void dict_grow(struct tag_dict *dict) {
+	int capacity = dict->capacity;
+	int i = 0;
+	struct dict_slot *slots = dict->slots;
+
+	dict->capacity = capacity > 0 ? capacity * 2 : 64;
+	dict->slots = calloc(dict->capacity, sizeof(*dict->slots));
+	assert(dict->slots != NULL);
+	dict->used = 0;
+
+	for(i = 0; i < capacity; i++) {
+		if(slots[i].tag_id > 0) {
+			dict_place(dict, slots[i].hash, slots[i].tag_id);
+		}
+	}
+
+	free(slots);
+} /* dict_grow */
+
+/**
+ * Add a tag read from the database. Receives the rows of db_each_tag_name().
+ *
+ * @param data The dictionary.
+ * @param tag_id The ID of the tag.
+ * @param tag_name The name of the tag.
+ * @return 0, to read every tag.
+ */
+static int dict_load_tag(void *data, int tag_id, const char *tag_name) {
+	int num_names = 0;
+	struct tag_dict *dict = data;
+
+	assert(tag_id > 0);
+
+	if(tag_id >= dict->num_names) {
+		num_names = dict->num_names > 0 ? dict->num_names : 64;
+
+		while(num_names <= tag_id) {
+			num_names *= 2;
+		}
+
+		dict->names = realloc(dict->names, num_names * sizeof(*dict->names));
+		assert(dict->names != NULL);
+		memset(dict->names + dict->num_names, 0, (num_names - dict->num_names) * sizeof(*dict->names));
+		dict->num_names = num_names;
+	}
+
+	if((dict->used + 1) * 2 > dict->capacity) {
+		dict_grow(dict);
+	}
+
+	dict->names[tag_id] = dict_intern(dict, tag_name);
+	dict_place(dict, dict_hash(tag_name, strlen(tag_name)), tag_id);
+
+	return 0;
+} /* dict_load_tag */
+
+void dict_init() {
+	int count = 0;
+	int rc = 0; /* return code of pthread operation */
+	struct tag_dict *dict = NULL;
+
+	DEBUG(ENTRY);
+	INFO("Loading tag dictionary");
+
+	dict = calloc(1, sizeof(*dict));
+	assert(dict != NULL);
+
+	rc = pthread_rwlock_init(&dict->lock, NULL);
+	assert(rc == 0);
+
+	dict_grow(dict);
+	count = db_each_tag_name(dict_load_tag, dict);
+	TAGFS_DATA->tag_dict = dict;
+
+	INFO("Tag dictionary holds %d tags", count);
+	DEBUG(EXIT);
+} /* dict_init */
+
+void dict_destroy() {
+	struct dict_block *next = NULL;
+	struct tag_dict *dict = TAGFS_DATA->tag_dict;
+
+	DEBUG(ENTRY);
+
+	assert(dict != NULL);
+
+	while(dict->arena != NULL) {
+		next = dict->arena->next;
+		free(dict->arena);
+		dict->arena = next;
+	}
+
+	free(dict->names);
+	free(dict->slots);
+	pthread_rwlock_destroy(&dict->lock);
+	free_single_ptr((void **)&TAGFS_DATA->tag_dict);
+
+	DEBUG(EXIT);
+} /* dict_destroy */
+
+int dict_tag_id(const char *tag_name) {
+	assert(tag_name != NULL);
+
+	if(strcmp(tag_name, "/") == 0) {
+		return 0;
+	}
+
+	return dict_tag_id_slice(tag_name, strlen(tag_name));
+} /* dict_tag_id */
+
+int dict_tag_id_slice(const char *tag_name, int length) {
+	const char *name = NULL;
+	int mask = 0;
+	int slot = 0;
+	int tag_id = -1;
+	struct dict_slot *entry = NULL;
+	struct tag_dict *dict = TAGFS_DATA->tag_dict;
+	uint32_t hash = 0;
+
+	assert(tag_name != NULL);
+	assert(length >= 0);
+
+	hash = dict_hash(tag_name, length);
+
+	pthread_rwlock_rdlock(&dict->lock);
+
+	mask = dict->capacity - 1;
+
+	for(slot = hash & mask; dict->slots[slot].tag_id != DICT_EMPTY; slot = (slot + 1) & mask) {
+		entry = &dict->slots[slot];
+
+		if(entry->tag_id <= 0 || entry->hash != hash) {
+			continue;
+		}
+
+		name = dict->names[entry->tag_id];
+
+		if(strncmp(name, tag_name, length) == 0 && name[length] == '\0') {
+			tag_id = entry->tag_id;
+			break;
+		}
+	}
+
+	pthread_rwlock_unlock(&dict->lock);
+
+	DEBUG("Tag %.*s corresponds to tag ID %d", length, tag_name, tag_id);
+	return tag_id;
+} /* dict_tag_id_slice */
+
+const char *dict_tag_name(int tag_id) {
+	const char *tag_name = NULL;
+	struct tag_dict *dict = TAGFS_DATA->tag_dict;
+
+	pthread_rwlock_rdlock(&dict->lock);
+
+	if(tag_id > 0 && tag_id < dict->num_names) {
+		tag_name = dict->names[tag_id];
+	}
+
+	pthread_rwlock_unlock(&dict->lock);
+
+	DEBUG("Tag ID %d corresponds to tag %s", tag_id, tag_name != NULL ? tag_name : "(none)");
+	return tag_name;
+} /* dict_tag_name */
+
+int dict_tag_names_from_ids(const int *tags, int num_tags, db_name_callback callback, void *data) {
+	const char *tag_name = NULL;
+	int count = 0;
+	int i = 0;
+	struct tag_dict *dict = TAGFS_DATA->tag_dict;
+
+	DEBUG(ENTRY);
+
+	assert(num_tags == 0 || tags != NULL);
+	assert(callback != NULL);
+
+	for(i = 0; i < num_tags; i++) {
+		pthread_rwlock_rdlock(&dict->lock);
+		tag_name = tags[i] > 0 && tags[i] < dict->num_names ? dict->names[tags[i]] : NULL;
+		pthread_rwlock_unlock(&dict->lock);
+
+		if(tag_name != NULL) { /* the callback runs unlocked, the name stays valid anyway */
+			count++;
+
+			if(callback(data, tags[i], tag_name) != 0) {
+				break;
+			}
+		}
+	}
+
+	DEBUG("Read %d names for %d IDs", count, num_tags);
+	DEBUG(EXIT);
+	return count;
+} /* dict_tag_names_from_ids */
+
+int dict_tag_id_limit() {
+	int limit = 0;
+	struct tag_dict *dict = TAGFS_DATA->tag_dict;
+
+	pthread_rwlock_rdlock(&dict->lock);
+	limit = dict->num_names;
+	pthread_rwlock_unlock(&dict->lock);
+
+	return limit;
+} /* dict_tag_id_limit */
+
+void dict_remove_tag(int tag_id) {
+	int mask = 0;
+	int slot = 0;
+	struct tag_dict *dict = TAGFS_DATA->tag_dict;
+
+	DEBUG(ENTRY);
+
+	pthread_rwlock_wrlock(&dict->lock);
+
+	if(tag_id > 0 && tag_id < dict->num_names && dict->names[tag_id] != NULL) {
+		mask = dict->capacity - 1;
+
+		for(slot = dict_hash(dict->names[tag_id], strlen(dict->names[tag_id])) & mask; dict->slots[slot].tag_id != tag_id; slot = (slot + 1) & mask) {
+			assert(dict->slots[slot].tag_id != DICT_EMPTY);
+		}
+
+		dict->slots[slot].tag_id = DICT_DELETED; /* keeps the probe chains through it intact */
+		dict->names[tag_id] = NULL;
+
+		DEBUG("Removed tag ID %d from the dictionary", tag_id);
+	}
+
+	pthread_rwlock_unlock(&dict->lock);
+
+	DEBUG(EXIT);
+} /* dict_remove_tag */
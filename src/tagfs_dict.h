@@ -0,0 +1,89 @@
+/**
+ * Interned tag dictionary. Every tag name is loaded from the database when the
+ * filesystem is mounted and copied once into a string arena. Names are found by
+ * an open-addressing hash table, and IDs by a dense array indexed by tag ID, so
+ * neither direction asks the database.
+ *
+ * The arena is only released when the filesystem is unmounted, so a returned
+ * name stays valid even after its tag is deleted. Names are borrowed and must
+ * not be free'd.
+ *
+ * The dictionary has its own lock, since tags are purged under
+ * tag_read_lock() as well as under tag_write_lock().
+ *
+ * @file tagfs_dict.h
+ * @author Keith Woelke
+ * @date 10/18/2026
+ */
+
+#ifndef TAGFS_DICT_H
+#define TAGFS_DICT_H
+
+#include "tagfs_db.h"
+
+/**
+ * Load every tag from the database. Must be called once from tagfs_init,
+ * after db_init().
+ */
+void dict_init();
+
+/**
+ * Free the dictionary and every name it handed out. Must be called once from
+ * tagfs_destroy, before db_destroy().
+ */
+void dict_destroy();
+
+/**
+ * Returns the ID of a tag.
+ *
+ * @param tag_name The name of the tag. "/" stands for the root.
+ * @return The ID of the tag, 0 for the root, or -1 if there is no such tag.
+ */
+int dict_tag_id(const char *tag_name);
+
+/**
+ * Returns the ID of a tag whose name is not NUL-terminated, like a tag of a
+ * path view (see tagfs_path.h).
+ *
+ * @param tag_name The first character of the name of the tag.
+ * @param length The length of the name.
+ * @return The ID of the tag, or -1 if there is no such tag.
+ */
+int dict_tag_id_slice(const char *tag_name, int length);
+
+/**
+ * Returns the name of a tag. The name is owned by the dictionary.
+ *
+ * @param tag_id The ID of the tag.
+ * @return The name of the tag, or NULL if there is no such tag.
+ */
+const char *dict_tag_name(int tag_id);
+
+/**
+ * Looks up the names of a collection of tags, in the order of the IDs. IDs
+ * without a tag are skipped.
+ *
+ * @param tags The tag IDs.
+ * @param num_tags The number of tag IDs.
+ * @param callback Called with each ID and its name. Returning non-zero stops the lookup.
+ * @param data Passed along to the callback.
+ * @return The number of names handed to the callback.
+ */
+int dict_tag_names_from_ids(const int *tags, int num_tags, db_name_callback callback, void *data);
+
+/**
+ * Returns one more than the largest tag ID the dictionary holds.
+ *
+ * @return The limit of tag IDs.
+ */
+int dict_tag_id_limit();
+
+/**
+ * Forget a tag which was deleted from the database. Its name stays valid until
+ * the filesystem is unmounted.
+ *
+ * @param tag_id The ID of the deleted tag.
+ */
+void dict_remove_tag(int tag_id);
+
+#endif
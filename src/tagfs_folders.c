@@ -0,0 +1,510 @@
+#include "tagfs_bitmap.h"
+#include "tagfs_common.h"
+#include "tagfs_cooccur.h"
+#include "tagfs_debug.h"
+#include "tagfs_folders.h"
+#include "tagfs_index.h"
+
+#include <assert.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * The folders at one location, along with what is needed to recompute them.
+ */
+struct folder_entry {
+	int num_tags;
+	int *tags; /* canonical tag set of the location, sorted and unique */
+	struct bitmap *files; /* files at the location */
+	int num_counts;
+	int *counts; /* tag ID -> files at the location carrying the tag */
+	int num_folders;
+	int *folders; /* the cover, in the order it was picked */
+	bool stale; /* counters changed since the cover was computed */
+};
+
+struct folder_cache {
+	pthread_mutex_t lock; /* readers share the tag lock, so the table needs its own */
+	GHashTable *entries; /* canonical tag set -> struct folder_entry */
+};
+
+/**
+ * A candidate folder in the max-heap used by the greedy cover. The count is an
+ * upper bound of the uncovered files carrying the tag.
+ */
+struct heap_node {
+	int count;
+	int tag_id;
+};
+
+/**
+ * Compare two integers. Used to sort tag IDs with qsort().
+ */
+static int compare_ids(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+} /* compare_ids */
+
+/**
+ * Checks if a heap node belongs above another one. Ties go to the lower tag ID,
+ * so a location always lists the same folders.
+ */
+static bool heap_above(const struct heap_node *a, const struct heap_node *b) {
+	return a->count > b->count || (a->count == b->count && a->tag_id < b->tag_id);
+} /* heap_above */
+
+/**
+ * Move a node down the heap until both of its children are below it.
+ *
+ * @param heap The heap.
+ * @param size The number of nodes in the heap.
+ * @param i The index of the node to move.
+ */
+static void heap_sift_down(struct heap_node *heap, int size, int i) {
+	struct heap_node node = heap[i];
+	int child = 0;
+
+	while((child = 2 * i + 1) < size) {
+		if(child + 1 < size && heap_above(&heap[child + 1], &heap[child])) {
+			child++;
+		}
+
+		if(!heap_above(&heap[child], &node)) {
+			break;
+		}
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = node;
+} /* heap_sift_down */
+
+/**
+ * Add a node to the heap. The heap must have room for it.
+ *
+ * @param heap The heap.
+ * @param size IN/OUT: The number of nodes in the heap.
+ * @param node The node to add.
+ */
+static void heap_push(struct heap_node *heap, int *size, struct heap_node node) {
+	int i = (*size)++;
+
+	while(i > 0 && heap_above(&node, &heap[(i - 1) / 2])) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+
+	heap[i] = node;
+} /* heap_push */
+
+/**
+ * Remove the top node of a non-empty heap.
+ *
+ * @param heap The heap.
+ * @param size IN/OUT: The number of nodes in the heap.
+ * @return The node removed.
+ */
+static struct heap_node heap_pop(struct heap_node *heap, int *size) {
+	struct heap_node top = heap[0];
+
+	heap[0] = heap[--(*size)];
+	heap_sift_down(heap, *size, 0);
+
+	return top;
+} /* heap_pop */
+
+/**
+ * Checks if a sorted tag set contains a tag.
+ */
+static bool tag_set_contains(const int *tags, int num_tags, int tag_id) {
+	return bsearch(&tag_id, tags, num_tags, sizeof(*tags), compare_ids) != NULL;
+} /* tag_set_contains */
+
+/**
+ * Build the key of a canonical tag set, e.g. "3,17,42". The returned string
+ * must be free'd by the caller.
+ *
+ * @param tags The sorted, unique tag IDs.
+ * @param num_tags The number of tag IDs.
+ * @return The key.
+ */
+static char *folder_key(const int *tags, int num_tags) {
+	char *key = NULL;
+	int i = 0;
+	int length = 0;
+	int size = 1;
+
+	for(i = 0; i < num_tags; i++) {
+		size += num_digits(tags[i]) + 1;
+	}
+
+	key = malloc(size);
+	assert(key != NULL);
+	key[0] = '\0';
+
+	for(i = 0; i < num_tags; i++) {
+		length += sprintf(&key[length], i > 0 ? ",%d" : "%d", tags[i]);
+	}
+
+	return key;
+} /* folder_key */
+
+/**
+ * Free a cache entry. Used as the value destructor of the hash table.
+ *
+ * @param data The entry to free.
+ */
+static void folder_entry_free(gpointer data) {
+	struct folder_entry *entry = data;
+
+	bitmap_free(&entry->files);
+	free(entry->tags);
+	free(entry->counts);
+	free(entry->folders);
+	free(entry);
+} /* folder_entry_free */
+
+/**
+ * Collect the files at a location and count the tags on them. This is the only
+ * place the folder cache counts tags from the index, and locations of a single
+ * tag take their counters from the co-occurrence matrix instead.
+ *
+ * @param tags The canonical tag set of the location.
+ * @param num_tags The number of tags in the set.
+ * @return The new entry, with its cover still to be computed.
+ */
+static struct folder_entry *folder_entry_new(const int *tags, int num_tags) {
+	const struct bitmap *tag_files = NULL;
+	int *all_files = NULL;
+	int i = 0;
+	int num_files = 0;
+	struct folder_entry *entry = NULL;
+
+	entry = calloc(1, sizeof(*entry));
+	assert(entry != NULL);
+
+	entry->num_tags = num_tags;
+	entry->tags = malloc((num_tags > 0 ? num_tags : 1) * sizeof(*entry->tags));
+	assert(entry->tags != NULL);
+	memcpy(entry->tags, tags, num_tags * sizeof(*entry->tags));
+
+	if(num_tags == 0) { /* the root covers every file */
+		num_files = index_all_files(&all_files);
+		entry->files = bitmap_from_array(all_files, num_files);
+
+		if(all_files != NULL) {
+			free_single_ptr((void **)&all_files);
+		}
+	} else {
+		tag_files = index_files_bitmap(tags[0]);
+		entry->files = tag_files != NULL ? bitmap_copy(tag_files) : bitmap_new();
+
+		for(i = 1; i < num_tags && bitmap_cardinality(entry->files) > 0; i++) {
+			tag_files = index_files_bitmap(tags[i]);
+
+			if(tag_files != NULL) {
+				bitmap_and_inplace(entry->files, tag_files);
+			} else {
+				bitmap_free(&entry->files);
+				entry->files = bitmap_new();
+			}
+		}
+	}
+
+	entry->num_counts = index_tag_id_limit();
+	entry->counts = calloc(entry->num_counts > 0 ? entry->num_counts : 1, sizeof(*entry->counts));
+	assert(entry->counts != NULL);
+
+	/* one level below the root, the co-occurrence matrix has the counters ready */
+	if(num_tags == 1 && cooccur_counts(tags[0], entry->counts, entry->num_counts)) {
+		DEBUG("Counted tags at {%d} from the co-occurrence matrix", tags[0]);
+	} else {
+		for(i = 1; i < entry->num_counts; i++) {
+			tag_files = index_files_bitmap(i);
+			entry->counts[i] = num_tags == 0 ? bitmap_cardinality(tag_files) : bitmap_and_cardinality(entry->files, tag_files);
+		}
+	}
+
+	entry->stale = true;
+
+	return entry;
+} /* folder_entry_new */
+
+/**
+ * Compute the greedy cover of an entry from its counters. Counters only ever
+ * shrink as files get covered, so a popped tag whose counter is out of date is
+ * recounted against the uncovered files and pushed back; a tag whose counter
+ * is still exact is the best remaining folder.
+ *
+ * @param entry The entry to compute the cover of.
+ */
+static void folder_entry_cover(struct folder_entry *entry) {
+	const struct bitmap *tag_files = NULL;
+	struct bitmap *uncovered = NULL;
+	struct heap_node *heap = NULL;
+	struct heap_node node;
+	int count = 0;
+	int i = 0;
+	int size = 0;
+
+	DEBUG(ENTRY);
+
+	free(entry->folders);
+	entry->folders = NULL;
+	entry->num_folders = 0;
+
+	heap = malloc((entry->num_counts > 0 ? entry->num_counts : 1) * sizeof(*heap));
+	assert(heap != NULL);
+
+	/* tags already in the path are not folders */
+	for(i = 1; i < entry->num_counts; i++) {
+		if(entry->counts[i] > 0 && !tag_set_contains(entry->tags, entry->num_tags, i)) {
+			heap[size].count = entry->counts[i];
+			heap[size].tag_id = i;
+			size++;
+		}
+	}
+
+	for(i = size / 2 - 1; i >= 0; i--) {
+		heap_sift_down(heap, size, i);
+	}
+
+	entry->folders = malloc((size > 0 ? size : 1) * sizeof(*entry->folders));
+	assert(entry->folders != NULL);
+
+	uncovered = bitmap_copy(entry->files);
+
+	while(size > 0 && bitmap_cardinality(uncovered) > 0) {
+		node = heap_pop(heap, &size);
+		tag_files = index_files_bitmap(node.tag_id);
+		count = bitmap_and_cardinality(uncovered, tag_files);
+
+		if(count == 0) {
+			continue;
+		}
+
+		if(count < node.count) {
+			node.count = count;
+			heap_push(heap, &size, node);
+			continue;
+		}
+
+		entry->folders[entry->num_folders++] = node.tag_id;
+		bitmap_andnot_inplace(uncovered, tag_files);
+	}
+
+	bitmap_free(&uncovered);
+	free(heap);
+
+	entry->stale = false;
+
+	DEBUG("Picked %d folders for %d files", entry->num_folders, bitmap_cardinality(entry->files));
+	DEBUG(EXIT);
+} /* folder_entry_cover */
+
+/**
+ * Checks if a file with the given tags is at the location of an entry.
+ */
+static bool folder_entry_has_file(const struct folder_entry *entry, const int *tags, int num_tags) {
+	int i = 0;
+	int j = 0;
+
+	for(i = 0; i < entry->num_tags; i++) {
+		for(j = 0; j < num_tags && tags[j] != entry->tags[i]; j++);
+
+		if(j == num_tags) {
+			return false;
+		}
+	}
+
+	return true;
+} /* folder_entry_has_file */
+
+/**
+ * Add a file to, or remove it from, every entry whose location it is at.
+ *
+ * @param file_id The ID of the file.
+ * @param tags The tags on the file.
+ * @param num_tags The number of tags on the file.
+ * @param delta 1 to add the file, -1 to remove it.
+ */
+static void folder_cache_update(int file_id, const int *tags, int num_tags, int delta) {
+	GHashTableIter iter;
+	gpointer value = NULL;
+	int i = 0;
+	int num_counts = 0;
+	struct folder_cache *cache = TAGFS_DATA->folder_cache;
+	struct folder_entry *entry = NULL;
+
+	pthread_mutex_lock(&cache->lock);
+
+	g_hash_table_iter_init(&iter, cache->entries);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		entry = value;
+
+		if(!folder_entry_has_file(entry, tags, num_tags)) {
+			continue;
+		}
+
+		if(delta > 0) {
+			bitmap_add(entry->files, file_id);
+		} else {
+			bitmap_remove(entry->files, file_id);
+		}
+
+		for(i = 0; i < num_tags; i++) {
+			if(tags[i] >= entry->num_counts) { /* a tag created after the entry */
+				num_counts = entry->num_counts;
+				entry->num_counts = index_tag_id_limit();
+				entry->counts = realloc(entry->counts, entry->num_counts * sizeof(*entry->counts));
+				assert(entry->counts != NULL);
+				memset(&entry->counts[num_counts], 0, (entry->num_counts - num_counts) * sizeof(*entry->counts));
+			}
+
+			entry->counts[tags[i]] += delta;
+		}
+
+		entry->stale = true;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+} /* folder_cache_update */
+
+void folder_cache_init() {
+	struct folder_cache *cache = NULL;
+	int rc = 0; /* return code of pthread operation */
+
+	DEBUG(ENTRY);
+
+	cache = malloc(sizeof(*cache));
+	assert(cache != NULL);
+
+	rc = pthread_mutex_init(&cache->lock, NULL);
+	assert(rc == 0);
+	cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, free, folder_entry_free);
+
+	TAGFS_DATA->folder_cache = cache;
+
+	DEBUG(EXIT);
+} /* folder_cache_init */
+
+void folder_cache_destroy() {
+	struct folder_cache *cache = TAGFS_DATA->folder_cache;
+
+	DEBUG(ENTRY);
+
+	assert(cache != NULL);
+
+	g_hash_table_destroy(cache->entries);
+	pthread_mutex_destroy(&cache->lock);
+	free_single_ptr((void **)&TAGFS_DATA->folder_cache);
+
+	DEBUG(EXIT);
+} /* folder_cache_destroy */
+
+int folder_cache_folders(const int *tags, int num_tags, int **folders) {
+	char *key = NULL;
+	int *tag_set = NULL;
+	int i = 0;
+	int num_folders = 0;
+	int set_size = 0;
+	struct folder_cache *cache = TAGFS_DATA->folder_cache;
+	struct folder_entry *built = NULL;
+	struct folder_entry *entry = NULL;
+
+	DEBUG(ENTRY);
+
+	assert(*folders == NULL);
+
+	/* canonicalize, so /a/b and /b/a share an entry */
+	tag_set = malloc((num_tags > 0 ? num_tags : 1) * sizeof(*tag_set));
+	assert(tag_set != NULL);
+	memcpy(tag_set, tags, num_tags * sizeof(*tag_set));
+	qsort(tag_set, num_tags, sizeof(*tag_set), compare_ids);
+
+	for(i = 0; i < num_tags; i++) {
+		if(set_size == 0 || tag_set[set_size - 1] != tag_set[i]) {
+			tag_set[set_size++] = tag_set[i];
+		}
+	}
+
+	key = folder_key(tag_set, set_size);
+
+	pthread_mutex_lock(&cache->lock);
+
+	entry = g_hash_table_lookup(cache->entries, key);
+
+	if(entry == NULL) {
+		pthread_mutex_unlock(&cache->lock);
+
+		DEBUG("Folder cache miss for {%s}", key);
+
+		/* the tag lock keeps the index still, so other readers keep using the cache meanwhile */
+		built = folder_entry_new(tag_set, set_size);
+		folder_entry_cover(built);
+
+		pthread_mutex_lock(&cache->lock);
+
+		entry = g_hash_table_lookup(cache->entries, key);
+
+		if(entry == NULL) {
+			if(g_hash_table_size(cache->entries) >= TAGFS_FOLDER_CACHE_SIZE) {
+				DEBUG("Folder cache is full, clearing %d entries", g_hash_table_size(cache->entries));
+				g_hash_table_remove_all(cache->entries);
+			}
+
+			entry = built;
+			built = NULL;
+			g_hash_table_insert(cache->entries, key, entry);
+			key = NULL; /* owned by the table */
+		} else {
+			DEBUG("Another thread cached {%s} first", key);
+		}
+	}
+
+	if(entry->stale) {
+		folder_entry_cover(entry);
+	}
+
+	num_folders = entry->num_folders;
+
+	if(num_folders > 0) {
+		*folders = malloc(num_folders * sizeof(**folders));
+		assert(*folders != NULL);
+		memcpy(*folders, entry->folders, num_folders * sizeof(**folders));
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	if(built != NULL) {
+		folder_entry_free(built);
+	}
+
+	if(key != NULL) {
+		free_single_ptr((void **)&key);
+	}
+
+	free_single_ptr((void **)&tag_set);
+
+	DEBUG("Returning %d folders", num_folders);
+	DEBUG(EXIT);
+	return num_folders;
+} /* folder_cache_folders */
+
+void folder_cache_remove_file(int file_id, const int *tags, int num_tags) {
+	DEBUG(ENTRY);
+
+	folder_cache_update(file_id, tags, num_tags, -1);
+
+	DEBUG(EXIT);
+} /* folder_cache_remove_file */
+
+void folder_cache_add_file(int file_id, const int *tags, int num_tags) {
+	DEBUG(ENTRY);
+
+	folder_cache_update(file_id, tags, num_tags, 1);
+
+	DEBUG(EXIT);
+} /* folder_cache_add_file */
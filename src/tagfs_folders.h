@@ -0,0 +1,69 @@
+/**
+ * Cache of the smart folders shown by readdir. The folders at a location are a
+ * greedy cover of the files there: the tag carried by the most files is picked
+ * first, then the tag carried by the most files not yet covered, and so on.
+ *
+ * Entries are keyed by the canonical (sorted, duplicate free) set of tag IDs in
+ * the path, and hold the files at the location along with a counter per tag of
+ * how many of those files carry it. The index reports every change to the tags
+ * of a file through folder_cache_remove_file() and folder_cache_add_file(),
+ * which adjust the counters of the affected entries instead of dropping them.
+ * The cover itself is then recomputed from the counters with a max-heap, without
+ * visiting the files again.
+ *
+ * The cache must be used while holding the tag lock.
+ *
+ * @file tagfs_folders.h
+ * @author Keith Woelke
+ * @date 10/17/2026
+ */
+
+#ifndef TAGFS_FOLDERS_H
+#define TAGFS_FOLDERS_H
+
+/**
+ * Create the folder cache. Must be called once from tagfs_init, before
+ * index_init(), since the index reports every change to it.
+ */
+void folder_cache_init();
+
+/**
+ * Free the folder cache. Must be called once from tagfs_destroy, after
+ * index_destroy().
+ */
+void folder_cache_destroy();
+
+/**
+ * Returns the smart folders at the location named by a set of tags. The
+ * returned array must be free'd by the caller.
+ *
+ * @param tags The IDs of the tags in the path. Need not be sorted or unique. Every ID must exist.
+ * @param num_tags The number of tag IDs. 0 for the root, which covers every file.
+ * @param folders OUT: The tag IDs of the folders, in the order they were picked. Left as NULL if there are none.
+ * @return The number of folders.
+ */
+int folder_cache_folders(const int *tags, int num_tags, int **folders);
+
+/**
+ * Record that a file is about to lose its current set of tags, either because
+ * its tags change or because it is removed. Called by the index, with the tags
+ * the file carries before the change.
+ *
+ * @param file_id The ID of the file.
+ * @param tags The tags on the file.
+ * @param num_tags The number of tags on the file.
+ */
+void folder_cache_remove_file(int file_id, const int *tags, int num_tags);
+
+/**
+ * Record that a file now carries a set of tags, either because its tags
+ * changed or because it is new. Called by the index, with the tags the file
+ * carries after the change.
+ *
+ * @param file_id The ID of the file.
+ * @param tags The tags on the file.
+ * @param num_tags The number of tags on the file.
+ */
+void folder_cache_add_file(int file_id, const int *tags, int num_tags);
+
+#endif
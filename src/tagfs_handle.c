@@ -0,0 +1,251 @@
+#include "tagfs_common.h"
+#include "tagfs_debug.h"
+#include "tagfs_handle.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Flags which make an open unsuitable for sharing a descriptor with other
+ * opens, either because they change the file or because they change how the
+ * descriptor behaves.
+ */
+#define HANDLE_UNSHARED_FLAGS (O_TRUNC | O_APPEND | O_CREAT | O_EXCL | O_SYNC)
+
+struct handle_table {
+	pthread_mutex_t lock;
+	GHashTable *shared; /* file ID -> struct file_handle, read-only opens only */
+	int num_open; /* handles open, shared ones counted once */
+};
+
+/**
+ * Wrap an open descriptor in a new handle. Must be called with the table lock
+ * held.
+ *
+ * @param fd The descriptor.
+ * @param file_id The ID of the file, 0 if it has none.
+ * @param flags The flags the descriptor was opened with.
+ * @return The new handle.
+ */
+static struct file_handle *handle_wrap(int fd, int file_id, int flags) {
+	struct file_handle *handle = NULL;
+
+	handle = malloc(sizeof(*handle));
+	assert(handle != NULL);
+	handle->fd = fd;
+	handle->file_id = file_id;
+	handle->flags = flags;
+	handle->refcount = 1;
+	handle->shared = false;
+
+	TAGFS_DATA->handles->num_open++;
+
+	return handle;
+} /* handle_wrap */
+
+/**
+ * Open a backing file and wrap it in a new handle.
+ *
+ * @param file_id The ID of the file to open.
+ * @param file_location The physical location of the file.
+ * @param flags The open flags.
+ * @param mode The permissions of the file, if flags create it.
+ * @param handle OUT: The new handle.
+ * @return 0 on success, or a negated errno value.
+ */
+static int handle_new(int file_id, const char *file_location, int flags, mode_t mode, struct file_handle **handle) {
+	int fd = 0;
+	int retstat = 0;
+
+	fd = open(file_location, flags, mode);
+
+	if(fd < 0) {
+		retstat = -errno;
+		WARN("Opening file %s failed", file_location);
+		return retstat;
+	}
+
+	*handle = handle_wrap(fd, file_id, flags);
+
+	return 0;
+} /* handle_new */
+
+/**
+ * Close a backing file and free its handle. Must be called with the table lock
+ * held.
+ *
+ * @param handle The handle to close.
+ * @return 0 on success, or a negated errno value.
+ */
+static int handle_close(struct file_handle *handle) {
+	int retstat = 0;
+
+	if(close(handle->fd) < 0) {
+		retstat = -errno;
+		WARN("Closing file ID %d failed", handle->file_id);
+	}
+
+	TAGFS_DATA->handles->num_open--;
+	free(handle);
+
+	return retstat;
+} /* handle_close */
+
+void handle_table_init() {
+	struct handle_table *table = NULL;
+	int rc = 0; /* return code of pthread operation */
+
+	DEBUG(ENTRY);
+
+	table = malloc(sizeof(*table));
+	assert(table != NULL);
+
+	rc = pthread_mutex_init(&table->lock, NULL);
+	assert(rc == 0);
+	table->shared = g_hash_table_new(NULL, NULL);
+	table->num_open = 0;
+
+	TAGFS_DATA->handles = table;
+
+	DEBUG(EXIT);
+} /* handle_table_init */
+
+void handle_table_destroy() {
+	GHashTableIter iter;
+	gpointer value = NULL;
+	struct handle_table *table = TAGFS_DATA->handles;
+
+	DEBUG(ENTRY);
+
+	assert(table != NULL);
+
+	/* the kernel releases every open file before unmounting, so anything left was leaked */
+	if(g_hash_table_size(table->shared) > 0) {
+		WARN("%d shared file handles still open at unmount", g_hash_table_size(table->shared));
+	}
+
+	g_hash_table_iter_init(&iter, table->shared);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		handle_close(value);
+	}
+
+	g_hash_table_destroy(table->shared);
+	pthread_mutex_destroy(&table->lock);
+	free_single_ptr((void **)&TAGFS_DATA->handles);
+
+	DEBUG(EXIT);
+} /* handle_table_destroy */
+
+int handle_open(int file_id, const char *file_location, int flags, struct file_handle **handle) {
+	bool shareable = false;
+	int retstat = 0;
+	struct handle_table *table = TAGFS_DATA->handles;
+
+	DEBUG(ENTRY);
+
+	assert(file_id > 0);
+	assert(file_location != NULL);
+
+	shareable = (flags & O_ACCMODE) == O_RDONLY && (flags & HANDLE_UNSHARED_FLAGS) == 0;
+
+	pthread_mutex_lock(&table->lock);
+
+	*handle = shareable ? g_hash_table_lookup(table->shared, GINT_TO_POINTER(file_id)) : NULL;
+
+	if(*handle != NULL) {
+		(*handle)->refcount++;
+		DEBUG("Sharing handle of file ID %d, now used by %d opens", file_id, (*handle)->refcount);
+	} else {
+		retstat = handle_new(file_id, file_location, flags, 0, handle);
+
+		if(retstat == 0 && shareable) {
+			(*handle)->shared = true;
+			g_hash_table_insert(table->shared, GINT_TO_POINTER(file_id), *handle);
+		}
+	}
+
+	pthread_mutex_unlock(&table->lock);
+
+	DEBUG("Opening file ID %d %s with result %d", file_id, shareable ? "shared" : "private", retstat);
+	DEBUG(EXIT);
+	return retstat;
+} /* handle_open */
+
+int handle_create(char *file_location, int flags, mode_t mode, struct file_handle **handle) {
+	int fd = -1;
+	int retstat = 0;
+	struct handle_table *table = TAGFS_DATA->handles;
+
+	DEBUG(ENTRY);
+
+	assert(file_location != NULL);
+
+	/* mkstemp opens with O_RDWR | O_CREAT | O_EXCL and mode 0600, the rest is applied after */
+	fd = mkstemp(file_location);
+
+	if(fd < 0) {
+		retstat = -errno;
+		WARN("Creating a file at %s failed", file_location);
+	} else if(fchmod(fd, mode & 07777) < 0 || ((flags & O_APPEND) && fcntl(fd, F_SETFL, O_APPEND) < 0)) {
+		retstat = -errno;
+		WARN("Setting up new file %s failed", file_location);
+		close(fd);
+		unlink(file_location);
+	} else {
+		pthread_mutex_lock(&table->lock);
+		*handle = handle_wrap(fd, 0, O_RDWR | (flags & O_APPEND));
+		pthread_mutex_unlock(&table->lock);
+	}
+
+	DEBUG("Creating %s finished with result %d", file_location, retstat);
+	DEBUG(EXIT);
+	return retstat;
+} /* handle_create */
+
+int handle_adopt(int fd, int flags, struct file_handle **handle) {
+	struct handle_table *table = TAGFS_DATA->handles;
+
+	DEBUG(ENTRY);
+
+	assert(fd >= 0);
+
+	pthread_mutex_lock(&table->lock);
+	*handle = handle_wrap(fd, 0, flags);
+	pthread_mutex_unlock(&table->lock);
+
+	DEBUG(EXIT);
+	return 0;
+} /* handle_adopt */
+
+int handle_release(struct file_handle *handle) {
+	int retstat = 0;
+	struct handle_table *table = TAGFS_DATA->handles;
+
+	DEBUG(ENTRY);
+
+	assert(handle != NULL);
+
+	pthread_mutex_lock(&table->lock);
+
+	assert(handle->refcount > 0);
+
+	if(--handle->refcount == 0) {
+		if(handle->shared) {
+			g_hash_table_remove(table->shared, GINT_TO_POINTER(handle->file_id));
+		}
+
+		DEBUG("Closing file ID %d, %d handles remain open", handle->file_id, table->num_open - 1);
+		retstat = handle_close(handle);
+	}
+
+	pthread_mutex_unlock(&table->lock);
+
+	DEBUG(EXIT);
+	return retstat;
+} /* handle_release */
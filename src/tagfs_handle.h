@@ -0,0 +1,94 @@
+/**
+ * Table of open file handles. tagfs_open resolves a path once and stores the
+ * resulting handle in fi->fh, so read, write, fgetattr, flush, fsync and
+ * release work off the backing file descriptor without resolving the path
+ * again. Read-only opens of the same file share one descriptor, which is
+ * closed when the last of them is released.
+ *
+ * @file tagfs_handle.h
+ * @author Keith Woelke
+ * @date 10/17/2026
+ */
+
+#ifndef TAGFS_HANDLE_H
+#define TAGFS_HANDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * An open backing file.
+ */
+struct file_handle {
+	int fd;
+	int file_id;
+	int flags; /* flags the backing file was opened with */
+	int refcount; /* opens sharing this handle */
+	bool shared; /* listed in the table of shared read-only handles */
+};
+
+/**
+ * Create the handle table. Must be called once from tagfs_init.
+ */
+void handle_table_init();
+
+/**
+ * Close any handles still open and free the handle table. Must be called once
+ * from tagfs_destroy.
+ */
+void handle_table_destroy();
+
+/**
+ * Open a backing file, or take another reference to a shared read-only handle
+ * of the same file. The handle must be given back with handle_release().
+ *
+ * @param file_id The ID of the file to open.
+ * @param file_location The physical location of the file.
+ * @param flags The open flags requested by the caller.
+ * @param handle OUT: The handle of the open file.
+ * @return 0 on success, or a negated errno value.
+ */
+int handle_open(int file_id, const char *file_location, int flags, struct file_handle **handle);
+
+/**
+ * Create a backing file under a name no other file has, and open it with a
+ * private handle. The caller sets the file ID of the handle once the file is
+ * in the database. The handle must be given back with handle_release().
+ *
+ * @param file_location IN: The physical location of the new file, ending in XXXXXX. OUT: The location it was created at, with XXXXXX replaced to make it unique (see mkstemp(3)).
+ * @param flags The open flags requested by the caller. The file is always opened for reading and writing.
+ * @param mode The permissions of the new file.
+ * @param handle OUT: The handle of the new file.
+ * @return 0 on success, or a negated errno value.
+ */
+int handle_create(char *file_location, int flags, mode_t mode, struct file_handle **handle);
+
+/**
+ * Wrap a descriptor which is not a backing file, such as the snapshot of a
+ * virtual file, in a private handle. The descriptor is closed when the handle
+ * is given back with handle_release().
+ *
+ * @param fd The open descriptor.
+ * @param flags The flags the descriptor was opened with.
+ * @param handle OUT: The new handle.
+ * @return 0 on success, or a negated errno value.
+ */
+int handle_adopt(int fd, int flags, struct file_handle **handle);
+
+/**
+ * Give back a handle returned by handle_open() or handle_create(). The backing file is closed once
+ * no open refers to it anymore.
+ *
+ * @param handle The handle to release.
+ * @return 0 on success, or a negated errno value if closing the file failed.
+ */
+int handle_release(struct file_handle *handle);
+
+/**
+ * Convert between a handle and the fi->fh value of a FUSE call.
+ */
+#define HANDLE_TO_FH(handle) ((uint64_t)(uintptr_t)(handle))
+#define HANDLE_FROM_FH(fh) ((struct file_handle *)(uintptr_t)(fh))
+
+#endif
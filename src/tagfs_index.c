@@ -0,0 +1,580 @@
+#include "tagfs_bitmap.h"
+#include "tagfs_common.h"
+#include "tagfs_cooccur.h"
+#include "tagfs_db.h"
+#include "tagfs_debug.h"
+#include "tagfs_folders.h"
+#include "tagfs_index.h"
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * Row of the file to tags adjacency. The tags of a file are the count entries
+ * of tag_index.adjacency starting at start. A row which outgrows its capacity
+ * is moved to the end of the adjacency array, leaving its old slots unused
+ * until the next compaction.
+ */
+struct file_row {
+	int start;
+	int count;
+	int capacity; /* -1 if no file has this ID */
+};
+
+/**
+ * The tag/file index. Both directions are indexed densely by ID, since tag and
+ * file IDs are small, autoincremented integers.
+ */
+struct tag_index {
+	struct bitmap **postings; /* tag ID -> files. Entry 0 holds the untagged files. */
+	unsigned int *generations; /* tag ID -> number of changes to its posting list */
+	int num_postings;
+	struct file_row *rows; /* file ID -> tags */
+	int num_rows;
+	int *adjacency; /* tags of every file, row after row */
+	int adjacency_length; /* slots in use, including abandoned ones */
+	int adjacency_capacity;
+	int adjacency_unused; /* abandoned slots, reclaimed by compaction */
+	int num_files;
+	unsigned int tag_names_generation; /* number of times tags were deleted, changed atomically */
+};
+
+/**
+ * Make sure a tag ID has a posting list.
+ *
+ * @param index The index.
+ * @param tag_id The tag ID which must be addressable.
+ */
+static void grow_postings(struct tag_index *index, int tag_id) {
+	int i = 0;
+	int num_postings = 0;
+
+	assert(tag_id >= 0);
+
+	if(tag_id < index->num_postings) {
+		return;
+	}
+
+	num_postings = index->num_postings > 0 ? index->num_postings : 64;
+	while(num_postings <= tag_id) {
+		num_postings *= 2;
+	}
+
+	index->postings = realloc(index->postings, num_postings * sizeof(*index->postings));
+	assert(index->postings != NULL);
+	index->generations = realloc(index->generations, num_postings * sizeof(*index->generations));
+	assert(index->generations != NULL);
+	memset(&index->generations[index->num_postings], 0, (num_postings - index->num_postings) * sizeof(*index->generations));
+
+	for(i = index->num_postings; i < num_postings; i++) {
+		index->postings[i] = bitmap_new();
+	}
+
+	index->num_postings = num_postings;
+} /* grow_postings */
+
+/**
+ * Record that the files carrying a tag changed.
+ *
+ * @param index The index.
+ * @param tag_id The tag whose posting list changed. 0 for the untagged files.
+ */
+static void touch_tag(struct tag_index *index, int tag_id) {
+	grow_postings(index, tag_id);
+	index->generations[tag_id]++;
+} /* touch_tag */
+
+/**
+ * Make sure a file ID has a row in the adjacency.
+ *
+ * @param index The index.
+ * @param file_id The file ID which must be addressable.
+ */
+static void grow_rows(struct tag_index *index, int file_id) {
+	int i = 0;
+	int num_rows = 0;
+
+	assert(file_id > 0);
+
+	if(file_id < index->num_rows) {
+		return;
+	}
+
+	num_rows = index->num_rows > 0 ? index->num_rows : 64;
+	while(num_rows <= file_id) {
+		num_rows *= 2;
+	}
+
+	index->rows = realloc(index->rows, num_rows * sizeof(*index->rows));
+	assert(index->rows != NULL);
+
+	for(i = index->num_rows; i < num_rows; i++) {
+		index->rows[i].start = 0;
+		index->rows[i].count = 0;
+		index->rows[i].capacity = -1;
+	}
+
+	index->num_rows = num_rows;
+} /* grow_rows */
+
+/**
+ * Rewrite the adjacency array without the slots abandoned by moved rows.
+ *
+ * @param index The index.
+ */
+static void compact_adjacency(struct tag_index *index) {
+	int *adjacency = NULL;
+	int file_id = 0;
+	int length = 0;
+	struct file_row *row = NULL;
+
+	DEBUG(ENTRY);
+	DEBUG("Compacting adjacency of %d slots, %d unused", index->adjacency_length, index->adjacency_unused);
+
+	adjacency = malloc((index->adjacency_capacity > 0 ? index->adjacency_capacity : 1) * sizeof(*adjacency));
+	assert(adjacency != NULL);
+
+	for(file_id = 1; file_id < index->num_rows; file_id++) {
+		row = &index->rows[file_id];
+
+		if(row->capacity > 0) {
+			memcpy(&adjacency[length], &index->adjacency[row->start], row->count * sizeof(*adjacency));
+			row->start = length;
+			length += row->capacity;
+		}
+	}
+
+	free(index->adjacency);
+	index->adjacency = adjacency;
+	index->adjacency_length = length;
+	index->adjacency_unused = 0;
+
+	DEBUG(EXIT);
+} /* compact_adjacency */
+
+/**
+ * Give a row room for one more tag, moving it to the end of the adjacency array
+ * if it is full.
+ *
+ * @param index The index.
+ * @param row The row which needs room.
+ */
+static void reserve_row(struct tag_index *index, struct file_row *row) {
+	int capacity = 0;
+
+	if(row->count < row->capacity) {
+		return;
+	}
+
+	capacity = row->capacity > 0 ? row->capacity * 2 : 4;
+
+	if(index->adjacency_length + capacity > index->adjacency_capacity) {
+		if(index->adjacency_unused > index->adjacency_length / 2) {
+			compact_adjacency(index);
+		}
+
+		while(index->adjacency_length + capacity > index->adjacency_capacity) {
+			index->adjacency_capacity = index->adjacency_capacity > 0 ? index->adjacency_capacity * 2 : 256;
+		}
+
+		index->adjacency = realloc(index->adjacency, index->adjacency_capacity * sizeof(*index->adjacency));
+		assert(index->adjacency != NULL);
+	}
+
+	memcpy(&index->adjacency[index->adjacency_length], &index->adjacency[row->start], row->count * sizeof(*index->adjacency));
+	index->adjacency_unused += row->capacity;
+	row->start = index->adjacency_length;
+	row->capacity = capacity;
+	index->adjacency_length += capacity;
+} /* reserve_row */
+
+/**
+ * Copy an array of IDs into a new array.
+ *
+ * @param source The IDs to copy.
+ * @param count The number of IDs.
+ * @param copy OUT: The copy. Left as NULL if count is 0.
+ * @return The number of IDs copied.
+ */
+static int copy_ids(const int *source, int count, int **copy) {
+	assert(*copy == NULL);
+
+	if(count > 0) {
+		*copy = malloc(count * sizeof(**copy));
+		assert(*copy != NULL);
+		memcpy(*copy, source, count * sizeof(**copy));
+	}
+
+	return count;
+} /* copy_ids */
+
+void index_init() {
+	int *files = NULL;
+	int *pair_files = NULL;
+	int *pair_tags = NULL;
+	int i = 0;
+	int num_files = 0;
+	int num_pairs = 0;
+	struct file_row *row = NULL;
+	struct tag_index *index = NULL;
+
+	DEBUG(ENTRY);
+	INFO("Building tag index");
+
+	index = calloc(1, sizeof(*index));
+	assert(index != NULL);
+	TAGFS_DATA->index = index;
+
+	num_files = db_get_all_files(&files);
+	num_pairs = db_get_all_file_tags(&pair_files, &pair_tags); /* sorted by tag, then file */
+
+	for(i = 0; i < num_files; i++) {
+		grow_rows(index, files[i]);
+		index->rows[files[i]].capacity = 0;
+	}
+
+	/* size every row of the adjacency */
+	for(i = 0; i < num_pairs; i++) {
+		grow_rows(index, pair_files[i]);
+		index->rows[pair_files[i]].capacity++;
+	}
+
+	for(i = 1; i < index->num_rows; i++) {
+		row = &index->rows[i];
+
+		if(row->capacity >= 0) {
+			row->start = index->adjacency_length;
+			index->adjacency_length += row->capacity;
+			index->num_files++;
+		}
+	}
+
+	index->adjacency_capacity = index->adjacency_length > 0 ? index->adjacency_length : 256;
+	index->adjacency = malloc(index->adjacency_capacity * sizeof(*index->adjacency));
+	assert(index->adjacency != NULL);
+
+	/* fill both directions */
+	for(i = 0; i < num_pairs; i++) {
+		row = &index->rows[pair_files[i]];
+		index->adjacency[row->start + row->count++] = pair_tags[i];
+
+		grow_postings(index, pair_tags[i]);
+		bitmap_add(index->postings[pair_tags[i]], pair_files[i]);
+	}
+
+	/* untagged files are listed under tag 0 */
+	grow_postings(index, 0);
+	for(i = 1; i < index->num_rows; i++) {
+		if(index->rows[i].capacity == 0) {
+			bitmap_add(index->postings[0], i);
+		}
+	}
+
+	if(files != NULL) {
+		free_single_ptr((void **)&files);
+	}
+
+	if(pair_files != NULL) {
+		free_single_ptr((void **)&pair_files);
+		free_single_ptr((void **)&pair_tags);
+	}
+
+	INFO("Tag index holds %d files and %d tag assignments", index->num_files, num_pairs);
+	DEBUG(EXIT);
+} /* index_init */
+
+void index_destroy() {
+	int i = 0;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+
+	assert(index != NULL);
+
+	for(i = 0; i < index->num_postings; i++) {
+		bitmap_free(&index->postings[i]);
+	}
+
+	free(index->postings);
+	free(index->generations);
+	free(index->rows);
+	free(index->adjacency);
+	free_single_ptr((void **)&TAGFS_DATA->index);
+
+	DEBUG(EXIT);
+} /* index_destroy */
+
+int index_count_files_with_tag(int tag_id) {
+	struct tag_index *index = TAGFS_DATA->index;
+
+	if(tag_id < 0 || tag_id >= index->num_postings) {
+		return 0;
+	}
+
+	return bitmap_cardinality(index->postings[tag_id]);
+} /* index_count_files_with_tag */
+
+int index_tag_id_limit() {
+	return TAGFS_DATA->index->num_postings;
+} /* index_tag_id_limit */
+
+const struct bitmap *index_files_bitmap(int tag_id) {
+	struct tag_index *index = TAGFS_DATA->index;
+
+	if(tag_id < 0 || tag_id >= index->num_postings) {
+		return NULL;
+	}
+
+	return index->postings[tag_id];
+} /* index_files_bitmap */
+
+int index_tags_from_file(int file_id, int **tags) {
+	int count = 0;
+	struct file_row *row = NULL;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+
+	assert(*tags == NULL);
+
+	if(file_id > 0 && file_id < index->num_rows) {
+		row = &index->rows[file_id];
+		count = copy_ids(&index->adjacency[row->start], row->count, tags);
+	}
+
+	DEBUG("File ID %d has %d tags", file_id, count);
+	DEBUG(EXIT);
+	return count;
+} /* index_tags_from_file */
+
+int index_tags_from_files(int *files, int num_files, int **tags) {
+	bool *seen = NULL;
+	int count = 0;
+	int i = 0;
+	int j = 0;
+	int tag_id = 0;
+	struct file_row *row = NULL;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+
+	assert(*tags == NULL);
+
+	seen = calloc(index->num_postings > 0 ? index->num_postings : 1, sizeof(*seen));
+	assert(seen != NULL);
+	*tags = malloc((index->num_postings > 0 ? index->num_postings : 1) * sizeof(**tags));
+	assert(*tags != NULL);
+
+	for(i = 0; i < num_files; i++) {
+		if(files[i] <= 0 || files[i] >= index->num_rows) {
+			continue;
+		}
+
+		row = &index->rows[files[i]];
+
+		for(j = 0; j < row->count; j++) {
+			tag_id = index->adjacency[row->start + j];
+
+			if(!seen[tag_id]) {
+				seen[tag_id] = true;
+				(*tags)[count++] = tag_id;
+			}
+		}
+	}
+
+	free(seen);
+
+	if(count == 0) {
+		free_single_ptr((void **)tags);
+	}
+
+	DEBUG("%d files have %d unique tags", num_files, count);
+	DEBUG(EXIT);
+	return count;
+} /* index_tags_from_files */
+
+int index_all_files(int **files) {
+	int count = 0;
+	int file_id = 0;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+
+	assert(*files == NULL);
+
+	if(index->num_files > 0) {
+		*files = malloc(index->num_files * sizeof(**files));
+		assert(*files != NULL);
+
+		for(file_id = 1; file_id < index->num_rows; file_id++) {
+			if(index->rows[file_id].capacity >= 0) {
+				(*files)[count++] = file_id;
+			}
+		}
+	}
+
+	DEBUG(EXIT);
+	return count;
+} /* index_all_files */
+
+bool index_file_has_tag(int tag_id, int file_id) {
+	int i = 0;
+	struct file_row *row = NULL;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	if(file_id <= 0 || file_id >= index->num_rows) {
+		return false;
+	}
+
+	row = &index->rows[file_id];
+
+	for(i = 0; i < row->count; i++) { /* files carry a handful of tags, so a scan beats a search */
+		if(index->adjacency[row->start + i] == tag_id) {
+			return true;
+		}
+	}
+
+	return false;
+} /* index_file_has_tag */
+
+void index_add_file(int file_id) {
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+
+	assert(file_id > 0);
+
+	grow_rows(index, file_id);
+
+	if(index->rows[file_id].capacity < 0) {
+		index->rows[file_id].start = 0;
+		index->rows[file_id].count = 0;
+		index->rows[file_id].capacity = 0;
+		index->num_files++;
+
+		touch_tag(index, 0);
+		bitmap_add(index->postings[0], file_id);
+		folder_cache_add_file(file_id, NULL, 0);
+	}
+
+	DEBUG(EXIT);
+} /* index_add_file */
+
+void index_add_tag_to_file(int tag_id, int file_id) {
+	struct file_row *row = NULL;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+	DEBUG("Indexing tag ID %d on file ID %d", tag_id, file_id);
+
+	assert(tag_id > 0);
+	assert(file_id > 0);
+
+	index_add_file(file_id);
+
+	if(!index_file_has_tag(tag_id, file_id)) {
+		row = &index->rows[file_id];
+		folder_cache_remove_file(file_id, &index->adjacency[row->start], row->count);
+
+		if(row->count == 0) {
+			touch_tag(index, 0);
+			bitmap_remove(index->postings[0], file_id);
+		}
+
+		cooccur_add_tag(tag_id, &index->adjacency[row->start], row->count);
+		reserve_row(index, row);
+		index->adjacency[row->start + row->count++] = tag_id;
+
+		touch_tag(index, tag_id);
+		bitmap_add(index->postings[tag_id], file_id);
+		folder_cache_add_file(file_id, &index->adjacency[row->start], row->count);
+	}
+
+	DEBUG(EXIT);
+} /* index_add_tag_to_file */
+
+void index_remove_tag_from_file(int tag_id, int file_id) {
+	int i = 0;
+	struct file_row *row = NULL;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+	DEBUG("Removing tag ID %d on file ID %d from index", tag_id, file_id);
+
+	if(index_file_has_tag(tag_id, file_id)) {
+		row = &index->rows[file_id];
+		folder_cache_remove_file(file_id, &index->adjacency[row->start], row->count);
+
+		for(i = 0; index->adjacency[row->start + i] != tag_id; i++);
+		index->adjacency[row->start + i] = index->adjacency[row->start + row->count - 1];
+		row->count--;
+		cooccur_remove_tag(tag_id, &index->adjacency[row->start], row->count);
+
+		touch_tag(index, tag_id);
+		bitmap_remove(index->postings[tag_id], file_id);
+
+		if(row->count == 0) {
+			touch_tag(index, 0);
+			bitmap_add(index->postings[0], file_id);
+		}
+
+		folder_cache_add_file(file_id, &index->adjacency[row->start], row->count);
+	}
+
+	DEBUG(EXIT);
+} /* index_remove_tag_from_file */
+
+void index_remove_file(int file_id) {
+	int i = 0;
+	struct file_row *row = NULL;
+	struct tag_index *index = TAGFS_DATA->index;
+
+	DEBUG(ENTRY);
+	DEBUG("Removing file ID %d from index", file_id);
+
+	if(file_id > 0 && file_id < index->num_rows && index->rows[file_id].capacity >= 0) {
+		row = &index->rows[file_id];
+		folder_cache_remove_file(file_id, &index->adjacency[row->start], row->count);
+
+		for(i = 0; i < row->count; i++) {
+			cooccur_remove_tag(index->adjacency[row->start + i], &index->adjacency[row->start + i + 1], row->count - i - 1);
+			touch_tag(index, index->adjacency[row->start + i]);
+			bitmap_remove(index->postings[index->adjacency[row->start + i]], file_id);
+		}
+
+		if(row->count == 0) {
+			touch_tag(index, 0);
+			bitmap_remove(index->postings[0], file_id);
+		}
+
+		index->adjacency_unused += row->capacity;
+		row->start = 0;
+		row->count = 0;
+		row->capacity = -1;
+		index->num_files--;
+	}
+
+	DEBUG(EXIT);
+} /* index_remove_file */
+
+void index_tag_names_changed() {
+	DEBUG(ENTRY);
+
+	__atomic_add_fetch(&TAGFS_DATA->index->tag_names_generation, 1, __ATOMIC_RELAXED); /* stale tags are purged under the read lock too */
+
+	DEBUG(EXIT);
+} /* index_tag_names_changed */
+
+unsigned int index_tag_generation(int tag_id) {
+	struct tag_index *index = TAGFS_DATA->index;
+
+	if(tag_id < 0) {
+		return __atomic_load_n(&index->tag_names_generation, __ATOMIC_RELAXED);
+	}
+
+	if(tag_id >= index->num_postings) {
+		return 0;
+	}
+
+	return index->generations[tag_id];
+} /* index_tag_generation */
@@ -0,0 +1,141 @@
+/**
+ * In-memory index of which tags are on which files. Built from the file_has_tag
+ * table when the filesystem is mounted and kept up to date by the db_*
+ * functions which change tags, so path resolution and folder computation never
+ * have to ask the database which files carry a tag or which tags a file has.
+ *
+ * The index is read under tag_read_lock() and changed under tag_write_lock().
+ *
+ * @file tagfs_index.h
+ * @author Keith Woelke
+ * @date 10/17/2026
+ */
+
+#ifndef TAGFS_INDEX_H
+#define TAGFS_INDEX_H
+
+#include <stdbool.h>
+
+struct bitmap;
+
+/**
+ * Build the index from the database. Must be called once from tagfs_init,
+ * after db_init().
+ */
+void index_init();
+
+/**
+ * Free the index. Must be called once from tagfs_destroy.
+ */
+void index_destroy();
+
+/**
+ * Returns the number of files carrying a tag, without copying them.
+ *
+ * @param tag_id The tag ID to count files for. 0 counts untagged files.
+ * @return The number of files matching the tag ID.
+ */
+int index_count_files_with_tag(int tag_id);
+
+/**
+ * Returns one more than the largest tag ID the index can hold. Every tag ID
+ * below it has a posting list, even if no file carries the tag.
+ *
+ * @return The limit of tag IDs.
+ */
+int index_tag_id_limit();
+
+/**
+ * Returns the files carrying a tag as a bitmap owned by the index. The bitmap
+ * must not be changed or free'd, and is only valid while the tag lock is held.
+ *
+ * @param tag_id The tag ID to look up. 0 returns the untagged files.
+ * @return The files carrying the tag, or NULL if the tag ID was never indexed.
+ */
+const struct bitmap *index_files_bitmap(int tag_id);
+
+/**
+ * Returns the tags on a file. The returned array must be free'd by the caller.
+ *
+ * @param file_id The ID of the file.
+ * @param tags OUT: The tags on the file. Left as NULL if there are none.
+ * @return The number of tags on the file.
+ */
+int index_tags_from_file(int file_id, int **tags);
+
+/**
+ * Returns the unique tags on a collection of files. The returned array must be
+ * free'd by the caller.
+ *
+ * @param files Array of file IDs.
+ * @param num_files Number of file IDs in the array.
+ * @param tags OUT: The tags on the files. Left as NULL if there are none.
+ * @return The number of unique tags on the files.
+ */
+int index_tags_from_files(int *files, int num_files, int **tags);
+
+/**
+ * Returns every file in the filesystem, sorted by file ID. The returned array
+ * must be free'd by the caller.
+ *
+ * @param files OUT: All files. Left as NULL if there are none.
+ * @return The number of files.
+ */
+int index_all_files(int **files);
+
+/**
+ * Checks whether a file carries a tag.
+ *
+ * @param tag_id The ID of the tag.
+ * @param file_id The ID of the file.
+ * @return True, if the file carries the tag. False, otherwise.
+ */
+bool index_file_has_tag(int tag_id, int file_id);
+
+/**
+ * Record a new, untagged file.
+ *
+ * @param file_id The ID of the new file.
+ */
+void index_add_file(int file_id);
+
+/**
+ * Record that a tag was added to a file.
+ *
+ * @param tag_id The ID of the tag added to the file.
+ * @param file_id The ID of the file.
+ */
+void index_add_tag_to_file(int tag_id, int file_id);
+
+/**
+ * Record that a tag was removed from a file.
+ *
+ * @param tag_id The ID of the tag removed from the file.
+ * @param file_id The ID of the file.
+ */
+void index_remove_tag_from_file(int tag_id, int file_id);
+
+/**
+ * Record that a file, and with it all of its tags, was removed.
+ *
+ * @param file_id The ID of the removed file.
+ */
+void index_remove_file(int file_id);
+
+/**
+ * Record that tags were deleted from the database, so a tag name may now
+ * resolve differently.
+ */
+void index_tag_names_changed();
+
+/**
+ * Returns a counter which changes whenever the files carrying a tag change.
+ * Callers which cache results derived from a tag remember the counter and
+ * compare it before using the cached result.
+ *
+ * @param tag_id The tag ID. 0 for the untagged files. A negative ID returns the counter of index_tag_names_changed(), for results derived from a tag name which did not resolve.
+ * @return The current generation of the tag.
+ */
+unsigned int index_tag_generation(int tag_id);
+
+#endif
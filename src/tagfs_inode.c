@@ -0,0 +1,271 @@
+#include "tagfs_arena.h"
+#include "tagfs_common.h"
+#include "tagfs_debug.h"
+#include "tagfs_dict.h"
+#include "tagfs_inode.h"
+#include "tagfs_path.h"
+
+#include <assert.h>
+#include <glib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A folder the kernel looked up.
+ */
+struct inode_folder {
+	uint64_t ino; /* the key of the folder in the table */
+	uint64_t nlookup; /* lookups the kernel has not forgotten yet */
+	int num_tags;
+	int tags[]; /* distinct, in the order of the path the folder was first looked up by */
+};
+
+struct inode_table {
+	pthread_mutex_t lock;
+	GHashTable *folders; /* inode number -> struct inode_folder */
+};
+
+/**
+ * Mix a tag ID into 64 well spread bits (the splitmix64 finalizer). Folder keys
+ * add these up, so the key of a tag set does not depend on the order of the
+ * tags.
+ *
+ * @param tag_id The ID of the tag.
+ * @return The mixed bits, never 0 for a tag.
+ */
+static uint64_t inode_tag_bits(int tag_id) {
+	uint64_t bits = (uint64_t)tag_id + 0x9e3779b97f4a7c15ull;
+
+	bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ull;
+	bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebull;
+	bits ^= bits >> 31;
+
+	return bits != 0 ? bits : 1;
+} /* inode_tag_bits */
+
+void inode_table_init() {
+	struct inode_table *table = NULL;
+	int rc = 0; /* return code of pthread operation */
+
+	DEBUG(ENTRY);
+
+	table = malloc(sizeof(*table));
+	assert(table != NULL);
+
+	rc = pthread_mutex_init(&table->lock, NULL);
+	assert(rc == 0);
+	table->folders = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+
+	TAGFS_DATA->inodes = table;
+
+	DEBUG(EXIT);
+} /* inode_table_init */
+
+void inode_table_destroy() {
+	struct inode_table *table = TAGFS_DATA->inodes;
+
+	DEBUG(ENTRY);
+
+	assert(table != NULL);
+
+	DEBUG("%d folders still known to the kernel at unmount", g_hash_table_size(table->folders));
+
+	g_hash_table_destroy(table->folders);
+	pthread_mutex_destroy(&table->lock);
+	free_single_ptr((void **)&TAGFS_DATA->inodes);
+
+	DEBUG(EXIT);
+} /* inode_table_destroy */
+
+ino_t inode_of_file(int file_id) {
+	assert(file_id > 0);
+
+	return (ino_t)file_id << 1;
+} /* inode_of_file */
+
+int inode_file_id(ino_t ino) {
+	if((ino & 1) != 0 || ino == INODE_STATS_FILE || (ino >> 1) > INT_MAX) {
+		return 0;
+	}
+
+	return (int)(ino >> 1);
+} /* inode_file_id */
+
+uint64_t inode_folder_key(const char *path) {
+	int i = 0;
+	int num_tags = 0;
+	int tag_id = 0;
+	struct path_view view;
+	uint64_t key = 0;
+
+	assert(path != NULL);
+
+	num_tags = path_split(path, &view);
+	path_distinct_tags(&view);
+
+	for(i = 0; i < num_tags; i++) {
+		if(!view.repeated[i]) {
+			tag_id = dict_tag_id_slice(path_tag(&view, i), path_tag_length(&view, i));
+			key = inode_folder_key_add(key, tag_id);
+		}
+	}
+
+	DEBUG("Folder %s has key %llx", path, (unsigned long long)key);
+	return key;
+} /* inode_folder_key */
+
+uint64_t inode_folder_key_add(uint64_t key, int tag_id) {
+	assert(tag_id > 0);
+
+	return key + inode_tag_bits(tag_id);
+} /* inode_folder_key_add */
+
+ino_t inode_of_folder(uint64_t key) {
+	ino_t ino = (ino_t)(key << 1) | 1;
+
+	if(key != 0 && ino == INODE_ROOT) { /* a tag set whose key wrapped around to 0 */
+		ino = (ino_t)3;
+	}
+
+	return ino;
+} /* inode_of_folder */
+
+ino_t inode_folder_lookup(const char *path) {
+	int i = 0;
+	int num_tags = 0;
+	int tag_id = 0;
+	int *tags = NULL;
+	struct inode_folder *folder = NULL;
+	struct inode_table *table = TAGFS_DATA->inodes;
+	struct path_view view;
+	uint64_t key = 0;
+	uint64_t ino = 0;
+
+	DEBUG(ENTRY);
+
+	assert(path != NULL);
+
+	path_split(path, &view);
+	tags = arena_alloc((path_distinct_tags(&view) + 1) * sizeof(*tags));
+
+	for(i = 0; i < view.num_tags; i++) {
+		if(!view.repeated[i]) {
+			tag_id = dict_tag_id_slice(path_tag(&view, i), path_tag_length(&view, i));
+			key = inode_folder_key_add(key, tag_id);
+			tags[num_tags++] = tag_id;
+		}
+	}
+
+	ino = inode_of_folder(key);
+
+	if(ino != INODE_ROOT) { /* the root is never forgotten, so it is not counted */
+		pthread_mutex_lock(&table->lock);
+
+		folder = g_hash_table_lookup(table->folders, &ino);
+
+		if(folder == NULL) {
+			folder = malloc(sizeof(*folder) + num_tags * sizeof(*folder->tags));
+			assert(folder != NULL);
+			folder->ino = ino;
+			folder->nlookup = 0;
+			folder->num_tags = num_tags;
+			memcpy(folder->tags, tags, num_tags * sizeof(*tags));
+			g_hash_table_insert(table->folders, &folder->ino, folder);
+		}
+
+		folder->nlookup++;
+
+		pthread_mutex_unlock(&table->lock);
+	}
+
+	DEBUG("Folder %s is inode %llu", path, (unsigned long long)ino);
+	DEBUG(EXIT);
+	return (ino_t)ino;
+} /* inode_folder_lookup */
+
+char *inode_folder_path(ino_t ino) {
+	char *path = NULL;
+	const char **names = NULL;
+	int i = 0;
+	int length = 0;
+	int num_tags = 0;
+	int *tags = NULL;
+	struct inode_folder *folder = NULL;
+	struct inode_table *table = TAGFS_DATA->inodes;
+	uint64_t key = ino;
+
+	DEBUG(ENTRY);
+
+	if(ino == INODE_ROOT) {
+		DEBUG(EXIT);
+		return arena_strdup("/");
+	}
+
+	/* copy the tags out, so the lock is not held while their names are looked up */
+	pthread_mutex_lock(&table->lock);
+
+	folder = g_hash_table_lookup(table->folders, &key);
+
+	if(folder != NULL) {
+		num_tags = folder->num_tags;
+		tags = arena_alloc(num_tags * sizeof(*tags));
+		memcpy(tags, folder->tags, num_tags * sizeof(*tags));
+	}
+
+	pthread_mutex_unlock(&table->lock);
+
+	if(tags != NULL) {
+		names = arena_alloc(num_tags * sizeof(*names));
+
+		for(i = 0; i < num_tags; i++) {
+			names[i] = dict_tag_name(tags[i]);
+
+			if(names[i] == NULL) { /* the tag lost its last file and was deleted */
+				break;
+			}
+
+			length += strlen("/") + strlen(names[i]);
+		}
+
+		if(i == num_tags) {
+			path = arena_alloc(length + 1);
+			length = 0;
+
+			for(i = 0; i < num_tags; i++) {
+				length += sprintf(path + length, "/%s", names[i]);
+			}
+		}
+	}
+
+	DEBUG("Inode %llu is folder %s", (unsigned long long)ino, path != NULL ? path : "(unknown)");
+	DEBUG(EXIT);
+	return path;
+} /* inode_folder_path */
+
+void inode_forget(ino_t ino, uint64_t nlookup) {
+	struct inode_folder *folder = NULL;
+	struct inode_table *table = TAGFS_DATA->inodes;
+	uint64_t key = ino;
+
+	if((ino & 1) == 0 || ino == INODE_ROOT) { /* files and the root are not counted */
+		return;
+	}
+
+	pthread_mutex_lock(&table->lock);
+
+	folder = g_hash_table_lookup(table->folders, &key);
+
+	if(folder != NULL) {
+		assert(folder->nlookup >= nlookup);
+		folder->nlookup -= nlookup;
+
+		if(folder->nlookup == 0) {
+			g_hash_table_remove(table->folders, &key);
+		}
+	}
+
+	pthread_mutex_unlock(&table->lock);
+} /* inode_forget */
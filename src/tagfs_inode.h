@@ -0,0 +1,115 @@
+/**
+ * Inode numbers. TagFS is served through the low-level FUSE API, so the kernel
+ * addresses files and folders by these numbers, and they are the st_ino that
+ * tools like find and rsync see. A file has the same inode number under every
+ * path that reaches it, and across mounts, since it is derived from its file
+ * ID. A folder is identified by its set of tags, so /Audio/ogg and /ogg/Audio
+ * share an inode number, and the number is derived from the IDs of those tags.
+ *
+ * Files get even numbers and folders odd ones, so the two never collide. The
+ * root, with no tags, is 1.
+ *
+ * A file is found from its inode number alone. A folder's tags cannot be
+ * recovered from its number, so the inode table remembers the tags of every
+ * folder the kernel looked up, until the kernel forgets it again.
+ *
+ * @file tagfs_inode.h
+ * @author Keith Woelke
+ * @date 10/18/2026
+ */
+
+#ifndef TAGFS_INODE_H
+#define TAGFS_INODE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define INODE_ROOT ((ino_t)1)
+#define INODE_STATS_DIR ((ino_t)-1) /* odd like a folder, out of reach of the folder hashes in practice */
+#define INODE_STATS_FILE ((ino_t)-2) /* even like a file, beyond any file ID */
+
+/**
+ * Create the inode table. Must be called once from tagfs_init.
+ */
+void inode_table_init();
+
+/**
+ * Free the inode table. Must be called once from tagfs_destroy.
+ */
+void inode_table_destroy();
+
+/**
+ * Returns the inode number of a file.
+ *
+ * @param file_id The ID of the file.
+ * @return The inode number.
+ */
+ino_t inode_of_file(int file_id);
+
+/**
+ * Returns the file an inode number belongs to.
+ *
+ * @param ino The inode number.
+ * @return The ID of the file, or 0 if the number is not the number of a file.
+ */
+int inode_file_id(ino_t ino);
+
+/**
+ * Returns the key of the folder at a path: an order-independent hash of its
+ * distinct tags, 0 for the root. Tags repeated in the path count once. Must be
+ * called with the tag lock held, on a valid path to a folder.
+ *
+ * @param path A string representing a path in the filesystem.
+ * @return The key of the folder.
+ */
+uint64_t inode_folder_key(const char *path);
+
+/**
+ * Returns the key of a folder one level below another, without looking at its
+ * path.
+ *
+ * @param key The key of the parent folder.
+ * @param tag_id The tag of the subfolder, which must not be a tag of the parent.
+ * @return The key of the subfolder.
+ */
+uint64_t inode_folder_key_add(uint64_t key, int tag_id);
+
+/**
+ * Returns the inode number of a folder.
+ *
+ * @param key The key of the folder, see inode_folder_key().
+ * @return The inode number.
+ */
+ino_t inode_of_folder(uint64_t key);
+
+/**
+ * Count one lookup of the folder at a path by the kernel, and remember its tags
+ * until the kernel forgets the folder again, see inode_forget(). Must be
+ * called with the tag lock held, on a valid path to a folder.
+ *
+ * @param path A string representing a path in the filesystem.
+ * @return The inode number of the folder.
+ */
+ino_t inode_folder_lookup(const char *path);
+
+/**
+ * Returns the path of a folder the kernel looked up, built from the names of
+ * its tags. The path is allocated from the request arena. Must be called with
+ * the tag lock held.
+ *
+ * @param ino The inode number of the folder.
+ * @return The path of the folder, "/" for the root. NULL if the kernel did not look the folder up, or one of its tags was deleted since.
+ */
+char *inode_folder_path(ino_t ino);
+
+/**
+ * Take back lookups of an inode number, once the kernel dropped it from its
+ * caches. A folder is removed from the inode table when its last lookup is
+ * taken back. Files are not counted, so forgetting one does nothing.
+ *
+ * @param ino The inode number.
+ * @param nlookup The number of lookups to take back.
+ */
+void inode_forget(ino_t ino, uint64_t nlookup);
+
+#endif
@@ -11,11 +11,25 @@
 
 #define FUSE_USE_VERSION 26
 
-#include <fuse.h>
+#include <fuse_lowlevel.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include <stdbool.h>
 #include <stdio.h>
 
+/**
+ * SQLite settings applied to every database connection when it is opened. Set
+ * from the mount options of the same names, see main() and the README. Values
+ * are passed to the PRAGMA of the same name as they are.
+ */
+struct tagfs_db_options {
+	char *journal_mode;
+	char *synchronous;
+	char *temp_store;
+	long long mmap_size; /* bytes of the database file to map, 0 to read through the page cache */
+	int cache_size; /* pages if positive, KiB if negative */
+};
+
 /**
  * Maintain tagfs state.
  */
@@ -23,8 +37,103 @@ struct tagfs_state {
 	FILE *log_file;
 	const char *exec_dir;
 	const char *db_path;
+	const char *files_dir; /* directory new files are created in */
+	struct tagfs_db_options db_options;
+	char *log_level; /* name of the lowest level written to the log */
+	pthread_key_t db_key; /* database handle owned by the calling thread */
+	pthread_mutex_t db_lock; /* guards db_handles */
+	struct db_handle *db_handles; /* every database handle opened since tagfs_init */
+	pthread_rwlock_t tag_lock; /* readers resolve paths, writers change tags */
+	struct tag_dict *tag_dict; /* tag names and IDs, see tagfs_dict.h */
+	struct tag_index *index; /* in-memory copy of file_has_tag, see tagfs_index.h */
+	struct path_cache *path_cache; /* resolved paths, see tagfs_cache.h */
+	struct folder_cache *folder_cache; /* smart folders by location, see tagfs_folders.h */
+	struct cooccur_matrix *cooccur; /* files shared by each pair of tags, see tagfs_cooccur.h */
+	struct handle_table *handles; /* open backing files, see tagfs_handle.h */
+	struct inode_table *inodes; /* folders the kernel looked up, see tagfs_inode.h */
+	double entry_timeout; /* seconds the kernel may keep a name it looked up */
+	double attr_timeout; /* seconds the kernel may keep the attributes of a file or folder */
+	double negative_timeout; /* seconds the kernel may remember that a name does not exist */
 };
 
-#define TAGFS_DATA ((struct tagfs_state *)fuse_get_context()->private_data)
+/**
+ * Milliseconds a connection waits for another connection's write transaction 
+ * before giving up with SQLITE_BUSY.
+ */
+#define TAGFS_DB_BUSY_TIMEOUT 5000
+
+/**
+ * Defaults of the database mount options, tuned for browsing: lookups vastly
+ * outnumber tag changes. The README has the measurements behind them.
+ */
+#define TAGFS_DB_JOURNAL_MODE "WAL" /* readers never wait for a writer, and a commit appends to the log instead of rewriting pages */
+#define TAGFS_DB_SYNCHRONOUS "NORMAL" /* with WAL, a crash may lose the last commits but never corrupts the database */
+#define TAGFS_DB_TEMP_STORE "MEMORY" /* GROUP BY and DISTINCT of the path statements sort in memory */
+#define TAGFS_DB_MMAP_SIZE (256LL * 1024 * 1024)
+#define TAGFS_DB_CACHE_SIZE (-8192) /* 8 MiB per connection */
+
+/**
+ * Maximum number of resolved paths kept in the path cache. The cache is cleared
+ * when it fills up.
+ */
+#define TAGFS_PATH_CACHE_SIZE 16384
+
+/**
+ * Maximum number of locations kept in the folder cache. Each one holds a counter
+ * for every tag, and every tag change visits all of them, so this is kept small.
+ * The cache is cleared when it fills up.
+ */
+#define TAGFS_FOLDER_CACHE_SIZE 64
+
+/**
+ * Maximum number of bytes the tag co-occurrence matrix may use. A row costs 24
+ * bytes per tag ID and 8 bytes per tag sharing a file with it, so 100000 tags
+ * which share files with 80 others each take 2.3 MiB of rows and 61 MiB of
+ * pairs. Past the limit the matrix is dropped.
+ */
+#define TAGFS_COOCCUR_MAX_MEMORY (128L * 1024 * 1024)
+
+/**
+ * Number of messages the log ring buffer holds, a power of two, and the longest
+ * message it keeps. Messages logged while the ring is full are dropped, so the
+ * ring covers bursts of ENTRY/EXIT messages while the writer thread catches up.
+ */
+#define TAGFS_LOG_SLOTS 16384
+#define TAGFS_LOG_MESSAGE_SIZE 256
+
+/**
+ * Microseconds the log writer thread sleeps when the ring is empty.
+ */
+#define TAGFS_LOG_IDLE_USEC 2000
+
+/**
+ * Name of the backing file of a file created through the filesystem, in the
+ * files directory. The XXXXXX is replaced by mkstemp(3) to make it unique. The
+ * name the file was created under is only kept in the database.
+ */
+#define TAGFS_BACKING_TEMPLATE "tagfs-XXXXXX"
+
+/**
+ * Defaults of the entry_timeout, attr_timeout and negative_timeout mount
+ * options, in seconds. They let the kernel answer repeated lookups and stats
+ * (and lookups of missing names) from its own caches. A change made through
+ * one path may take that long to show through another path to the same file.
+ */
+#define TAGFS_ENTRY_TIMEOUT 1.0
+#define TAGFS_ATTR_TIMEOUT 1.0
+#define TAGFS_NEGATIVE_TIMEOUT 1.0
+
+/**
+ * Default of the log_level mount option.
+ */
+#define TAGFS_LOG_LEVEL "info"
+
+/**
+ * The state of the mounted filesystem, set by tagfs_init. The low-level API
+ * has no fuse_get_context(), so every module reaches the state through here.
+ */
+extern struct tagfs_state *tagfs_data;
+
+#define TAGFS_DATA tagfs_data
 
 #endif
@@ -0,0 +1,187 @@
+#include "tagfs_arena.h"
+#include "tagfs_debug.h"
+#include "tagfs_path.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PATH_HASH_SLOTS (2 * PATH_VIEW_TAGS) /* hash table size for views without arena memory */
+
+/**
+ * FNV-1a hash of a tag.
+ *
+ * @param tag The first character of the tag.
+ * @param length The length of the tag.
+ * @return The hash.
+ */
+static uint32_t path_hash(const char *tag, int length) {
+	int i = 0;
+	uint32_t hash = 2166136261u;
+
+	for(i = 0; i < length; i++) {
+		hash ^= (unsigned char)tag[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+} /* path_hash */
+
+/**
+ * Make room for one more tag in a view, moving its tags into the arena once
+ * the inline arrays are full.
+ *
+ * @param view The view.
+ * @param capacity The number of tags the view has room for.
+ * @return The new number of tags the view has room for.
+ */
+static int path_grow(struct path_view *view, int capacity) {
+	struct path_slice *tags = NULL;
+
+	tags = arena_alloc(2 * capacity * sizeof(*tags));
+	memcpy(tags, view->tags, view->num_tags * sizeof(*tags));
+	view->tags = tags;
+
+	return 2 * capacity;
+} /* path_grow */
+
+int path_split(const char *path, struct path_view *view) {
+	int capacity = PATH_VIEW_TAGS;
+	int i = 0;
+	int start = -1; /* of the tag being read, or -1 between tags */
+
+	assert(path != NULL);
+	assert(view != NULL);
+
+	view->path = path;
+	view->num_tags = 0;
+	view->num_distinct = -1;
+	view->tags = view->inline_tags;
+	view->repeated = view->inline_repeated;
+
+	for(i = 0; ; i++) {
+		if(path[i] != '/' && path[i] != '\0') {
+			start = start < 0 ? i : start;
+		} else if(start >= 0) {
+			if(view->num_tags == capacity) {
+				capacity = path_grow(view, capacity);
+			}
+
+			view->tags[view->num_tags].offset = start;
+			view->tags[view->num_tags].length = i - start;
+			view->num_tags++;
+			start = -1;
+		}
+
+		if(path[i] == '\0') {
+			break;
+		}
+	}
+
+	DEBUG("%s split into %d tags", path, view->num_tags);
+	return view->num_tags;
+} /* path_split */
+
+const char *path_tag(const struct path_view *view, int index) {
+	assert(index >= 0 && index < view->num_tags);
+
+	return view->path + view->tags[index].offset;
+} /* path_tag */
+
+int path_tag_length(const struct path_view *view, int index) {
+	assert(index >= 0 && index < view->num_tags);
+
+	return view->tags[index].length;
+} /* path_tag_length */
+
+int path_distinct_tags(struct path_view *view) {
+	int i = 0;
+	int inline_slots[PATH_HASH_SLOTS];
+	int mask = 0;
+	int num_slots = PATH_HASH_SLOTS; /* power of two, at least twice the number of tags */
+	int other = 0;
+	int slot = 0;
+	int *slots = inline_slots; /* index of a tag plus 1, or 0 if empty */
+
+	assert(view != NULL);
+
+	if(view->num_distinct >= 0) {
+		return view->num_distinct;
+	}
+
+	if(view->num_tags > PATH_VIEW_TAGS) {
+		while(num_slots < 2 * view->num_tags) {
+			num_slots *= 2;
+		}
+
+		slots = arena_alloc(num_slots * sizeof(*slots));
+		view->repeated = arena_alloc(view->num_tags * sizeof(*view->repeated));
+	}
+
+	memset(slots, 0, num_slots * sizeof(*slots));
+	mask = num_slots - 1;
+	view->num_distinct = 0;
+
+	for(i = 0; i < view->num_tags; i++) {
+		view->repeated[i] = false;
+
+		for(slot = path_hash(path_tag(view, i), view->tags[i].length) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+			other = slots[slot] - 1;
+
+			if(view->tags[other].length == view->tags[i].length && memcmp(path_tag(view, other), path_tag(view, i), view->tags[i].length) == 0) {
+				view->repeated[i] = true;
+				break;
+			}
+		}
+
+		if(!view->repeated[i]) {
+			slots[slot] = i + 1;
+			view->num_distinct++;
+		}
+	}
+
+	DEBUG("%d of %d tags in %s are distinct", view->num_distinct, view->num_tags, view->path);
+	return view->num_distinct;
+} /* path_distinct_tags */
+
+struct path_slice path_dirname(const char *path) {
+	const char *slash = NULL;
+	struct path_slice dir = { 0, 1 }; /* the root */
+
+	assert(path != NULL);
+	assert(path[0] == '/');
+
+	slash = strrchr(path, '/');
+
+	if(slash != path) {
+		dir.length = slash - path;
+	}
+
+	return dir;
+} /* path_dirname */
+
+struct path_slice path_basename(const char *path) {
+	const char *slash = NULL;
+	struct path_slice base = { 0, 0 };
+
+	assert(path != NULL);
+
+	slash = strrchr(path, '/');
+	base.offset = slash != NULL ? slash - path + 1 : 0;
+	base.length = strlen(path + base.offset);
+
+	return base;
+} /* path_basename */
+
+char *path_slice_strdup(const char *path, struct path_slice slice) {
+	char *copy = NULL;
+
+	assert(path != NULL);
+	assert(slice.offset >= 0 && slice.length >= 0);
+
+	copy = arena_alloc(slice.length + 1);
+	memcpy(copy, path + slice.offset, slice.length);
+	copy[slice.length] = '\0';
+
+	return copy;
+} /* path_slice_strdup */
@@ -0,0 +1,111 @@
+/**
+ * Path views. A view splits a path into its tags without copying it: every tag
+ * is a slice (offset and length) of the original string, found in a single
+ * pass over it. Slices are not NUL-terminated, so they are handed to functions
+ * which take a length, like dict_tag_id_slice(), or copied into the request
+ * arena with path_slice_strdup() where a C string is unavoidable.
+ *
+ * A view borrows the path, which must outlive it. Views of up to
+ * PATH_VIEW_TAGS tags live entirely on the stack; longer ones spill into the
+ * request arena (see tagfs_arena.h). A view points into itself, so it must not
+ * be copied.
+ *
+ * @file tagfs_path.h
+ * @author Keith Woelke
+ * @date 10/18/2026
+ */
+
+#ifndef TAGFS_PATH_H
+#define TAGFS_PATH_H
+
+#include <stdbool.h>
+
+#define PATH_VIEW_TAGS 32 /* tags a view holds without the arena, far more than any real path */
+
+/**
+ * Part of a path.
+ */
+struct path_slice {
+	int offset; /* of the first character, from the start of the path */
+	int length; /* in characters */
+};
+
+/**
+ * A path split into its tags.
+ */
+struct path_view {
+	const char *path;
+	int num_tags;
+	int num_distinct; /* -1 until counted by path_distinct_tags() */
+	struct path_slice *tags; /* inline_tags, or arena memory for long paths */
+	bool *repeated; /* repeated[i] if tag i equals an earlier tag, filled in by path_distinct_tags() */
+	struct path_slice inline_tags[PATH_VIEW_TAGS];
+	bool inline_repeated[PATH_VIEW_TAGS];
+};
+
+/**
+ * Split a path into its tags, which are the runs of characters other than
+ * '/'. Any number of leading, trailing, or repeated slashes is allowed.
+ *
+ * @param path A string representing a path in the filesystem.
+ * @param view OUT: The view of the path.
+ * @return The number of tags in the path. 0 for the root.
+ */
+int path_split(const char *path, struct path_view *view);
+
+/**
+ * Returns the start of a tag of a view. The tag is not NUL-terminated.
+ *
+ * @param view The view.
+ * @param index The index of the tag.
+ * @return The first character of the tag, inside the path of the view.
+ */
+const char *path_tag(const struct path_view *view, int index);
+
+/**
+ * Returns the length of a tag of a view.
+ *
+ * @param view The view.
+ * @param index The index of the tag.
+ * @return The length of the tag.
+ */
+int path_tag_length(const struct path_view *view, int index);
+
+/**
+ * Counts the distinct tags of a view, marking every tag which repeats an
+ * earlier one in view->repeated. Tags are compared through a hash table, so
+ * long paths are not compared pairwise. The count is kept in the view, so
+ * calling this again is free.
+ *
+ * @param view The view.
+ * @return The number of distinct tags.
+ */
+int path_distinct_tags(struct path_view *view);
+
+/**
+ * Returns the directory of a path: everything before its last '/', or "/"
+ * if that is nothing.
+ *
+ * @param path A string representing a path in the filesystem.
+ * @return The slice of path holding the directory.
+ */
+struct path_slice path_dirname(const char *path);
+
+/**
+ * Returns the base name of a path: everything after its last '/'.
+ *
+ * @param path A string representing a path in the filesystem.
+ * @return The slice of path holding the base name.
+ */
+struct path_slice path_basename(const char *path);
+
+/**
+ * Copy a slice into the request arena, NUL-terminated.
+ *
+ * @param path The string the slice was taken from.
+ * @param slice The slice to copy.
+ * @return The copy.
+ */
+char *path_slice_strdup(const char *path, struct path_slice slice);
+
+#endif
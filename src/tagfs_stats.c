@@ -0,0 +1,325 @@
+#include "tagfs_common.h"
+#include "tagfs_cooccur.h"
+#include "tagfs_debug.h"
+#include "tagfs_stats.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Buckets per power of two, and the number of powers of two covered. Latencies
+ * from 2^STATS_MAX_EXPONENT nanoseconds (about 36 minutes) up land in the last
+ * bucket.
+ */
+#define STATS_SUB_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXPONENT 41
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+/**
+ * Counters of one thread. Only the owning thread writes them, the reader only
+ * loads them, so every access is a relaxed atomic which compiles to a plain
+ * load or store.
+ */
+struct stats_counters {
+	atomic_uint_least64_t count[STATS_OP_COUNT];
+	atomic_uint_least64_t total[STATS_OP_COUNT]; /* nanoseconds */
+	atomic_uint_least64_t max[STATS_OP_COUNT]; /* nanoseconds */
+	atomic_uint_least64_t buckets[STATS_OP_COUNT][STATS_BUCKETS];
+	bool in_use; /* owned by a live thread, guarded by stats_lock */
+	struct stats_counters *next;
+};
+
+static const char *stats_op_names[STATS_OP_COUNT] = {
+	[STATS_LOOKUP] = "lookup",
+	[STATS_FORGET] = "forget",
+	[STATS_GETATTR] = "getattr",
+	[STATS_SETATTR] = "setattr",
+	[STATS_UNLINK] = "unlink",
+	[STATS_RENAME] = "rename",
+	[STATS_OPEN] = "open",
+	[STATS_READ] = "read",
+	[STATS_WRITE] = "write",
+	[STATS_FLUSH] = "flush",
+	[STATS_RELEASE] = "release",
+	[STATS_FSYNC] = "fsync",
+	[STATS_OPENDIR] = "opendir",
+	[STATS_READDIR] = "readdir",
+	[STATS_RELEASEDIR] = "releasedir",
+	[STATS_CREATE] = "create",
+	[STATS_DB_GET_FILE_LOCATION] = "db_get_file_location",
+	[STATS_DB_GET_ALL_TAGS] = "db_get_all_tags",
+	[STATS_DB_EACH_TAG_NAME] = "db_each_tag_name",
+	[STATS_DB_GET_ALL_FILES] = "db_get_all_files",
+	[STATS_DB_GET_ALL_FILE_TAGS] = "db_get_all_file_tags",
+	[STATS_DB_DELETE_TAG] = "db_delete_tag",
+	[STATS_DB_FILE_ID_FROM_PATH] = "db_file_id_from_path",
+	[STATS_DB_FILE_NAMES_FROM_IDS] = "db_file_names_from_ids",
+	[STATS_DB_CREATE_FILE] = "db_create_file",
+	[STATS_DB_BATCH_COMMIT] = "db_batch_commit"
+};
+
+static pthread_key_t stats_key; /* struct stats_counters of the calling thread */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER; /* guards stats_threads */
+static struct stats_counters *stats_threads; /* every set of counters, in use or not */
+
+/**
+ * Returns the bucket a latency falls in. Values below 2 * STATS_SUB_BUCKETS
+ * get a bucket each; above that, each power of two is split in
+ * STATS_SUB_BUCKETS.
+ *
+ * @param value The latency in nanoseconds.
+ * @return The bucket index.
+ */
+static int stats_bucket(uint64_t value) {
+	int exponent = 0;
+
+	if(value < 2 * STATS_SUB_BUCKETS) {
+		return (int)value;
+	}
+
+	exponent = 63 - __builtin_clzll(value);
+
+	if(exponent >= STATS_MAX_EXPONENT) {
+		return STATS_BUCKETS - 1;
+	}
+
+	return (exponent - STATS_SUB_BITS) * STATS_SUB_BUCKETS + (int)(value >> (exponent - STATS_SUB_BITS));
+} /* stats_bucket */
+
+/**
+ * Returns the middle of the range of latencies a bucket holds.
+ *
+ * @param bucket The bucket index.
+ * @return The latency in nanoseconds.
+ */
+static uint64_t stats_bucket_value(int bucket) {
+	int exponent = 0;
+	uint64_t mantissa = 0;
+
+	if(bucket < 2 * STATS_SUB_BUCKETS) {
+		return bucket;
+	}
+
+	exponent = bucket / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+	mantissa = bucket % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS;
+
+	return (mantissa << (exponent - STATS_SUB_BITS)) + (1ULL << (exponent - STATS_SUB_BITS)) / 2;
+} /* stats_bucket_value */
+
+/**
+ * Hand the counters of an exiting thread to the next thread that starts, so
+ * threads coming and going do not grow the list. The counts stay.
+ *
+ * @param data The struct stats_counters of the thread.
+ */
+static void stats_release_thread(void *data) {
+	struct stats_counters *counters = data;
+
+	pthread_mutex_lock(&stats_lock);
+	counters->in_use = false;
+	pthread_mutex_unlock(&stats_lock);
+} /* stats_release_thread */
+
+/**
+ * Returns the counters of the calling thread, taking a set the first time the
+ * thread records an operation.
+ *
+ * @return The counters.
+ */
+static struct stats_counters *stats_thread_counters() {
+	struct stats_counters *counters = NULL;
+
+	counters = pthread_getspecific(stats_key);
+
+	if(counters != NULL) {
+		return counters;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+
+	for(counters = stats_threads; counters != NULL && counters->in_use; counters = counters->next);
+
+	if(counters == NULL) {
+		counters = calloc(1, sizeof(*counters));
+		assert(counters != NULL);
+		counters->next = stats_threads;
+		stats_threads = counters;
+	}
+
+	counters->in_use = true;
+	pthread_mutex_unlock(&stats_lock);
+
+	pthread_setspecific(stats_key, counters);
+	return counters;
+} /* stats_thread_counters */
+
+/**
+ * Increment a counter owned by the calling thread.
+ *
+ * @param counter The counter.
+ * @param value The amount to add.
+ */
+static void stats_add(atomic_uint_least64_t *counter, uint64_t value) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+} /* stats_add */
+
+void stats_init() {
+	DEBUG(ENTRY);
+
+	if(pthread_key_create(&stats_key, stats_release_thread) != 0) {
+		ERROR("Unable to create the statistics thread key");
+	}
+
+	DEBUG(EXIT);
+} /* stats_init */
+
+void stats_destroy() {
+	struct stats_counters *next = NULL;
+
+	DEBUG(ENTRY);
+
+	pthread_key_delete(stats_key);
+
+	pthread_mutex_lock(&stats_lock);
+
+	while(stats_threads != NULL) {
+		next = stats_threads->next;
+		free(stats_threads);
+		stats_threads = next;
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+
+	DEBUG(EXIT);
+} /* stats_destroy */
+
+uint64_t stats_now() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+} /* stats_now */
+
+void stats_record(enum stats_op op, uint64_t started) {
+	struct stats_counters *counters = stats_thread_counters();
+	uint64_t elapsed = stats_now() - started;
+
+	assert(op >= 0 && op < STATS_OP_COUNT);
+
+	stats_add(&counters->count[op], 1);
+	stats_add(&counters->total[op], elapsed);
+	stats_add(&counters->buckets[op][stats_bucket(elapsed)], 1);
+
+	if(elapsed > atomic_load_explicit(&counters->max[op], memory_order_relaxed)) {
+		atomic_store_explicit(&counters->max[op], elapsed, memory_order_relaxed);
+	}
+} /* stats_record */
+
+/**
+ * Returns a percentile of a merged histogram.
+ *
+ * @param buckets The histogram.
+ * @param count The number of latencies in the histogram.
+ * @param max The largest latency recorded, which caps the result.
+ * @param fraction The percentile, between 0 and 1.
+ * @return The latency in nanoseconds.
+ */
+static uint64_t stats_percentile(const uint64_t *buckets, uint64_t count, uint64_t max, double fraction) {
+	int i = 0;
+	uint64_t rank = 0;
+	uint64_t seen = 0;
+	uint64_t value = 0;
+
+	rank = (uint64_t)(fraction * count + 0.5);
+	rank = rank > 0 ? rank : 1;
+
+	for(i = 0; i < STATS_BUCKETS; i++) {
+		seen += buckets[i];
+
+		if(seen >= rank) {
+			value = stats_bucket_value(i);
+			break;
+		}
+	}
+
+	return value < max ? value : max;
+} /* stats_percentile */
+
+int stats_render(char **text) {
+	FILE *out = NULL;
+	int i = 0;
+	int op = 0;
+	long cooccur_memory = 0;
+	size_t length = 0;
+	struct stats_counters *counters = NULL;
+	uint64_t buckets[STATS_BUCKETS];
+	uint64_t count = 0;
+	uint64_t max = 0;
+	uint64_t total = 0;
+	uint64_t value = 0;
+
+	DEBUG(ENTRY);
+
+	out = open_memstream(text, &length);
+	assert(out != NULL);
+
+	fprintf(out, "%-24s %12s %12s %10s %10s %10s %10s %10s\n", "operation", "count", "total_ms", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+
+	pthread_mutex_lock(&stats_lock);
+
+	for(op = 0; op < STATS_OP_COUNT; op++) {
+		memset(buckets, 0, sizeof(buckets));
+		count = 0;
+		max = 0;
+		total = 0;
+
+		/* merge every thread's counters, including those of threads which exited */
+		for(counters = stats_threads; counters != NULL; counters = counters->next) {
+			count += atomic_load_explicit(&counters->count[op], memory_order_relaxed);
+			total += atomic_load_explicit(&counters->total[op], memory_order_relaxed);
+			value = atomic_load_explicit(&counters->max[op], memory_order_relaxed);
+			max = value > max ? value : max;
+
+			for(i = 0; i < STATS_BUCKETS; i++) {
+				buckets[i] += atomic_load_explicit(&counters->buckets[op][i], memory_order_relaxed);
+			}
+		}
+
+		if(count == 0) {
+			continue;
+		}
+
+		fprintf(out, "%-24s %12llu %12.3f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stats_op_names[op], (unsigned long long)count,
+				total / 1e6, total / 1e3 / count,
+				stats_percentile(buckets, count, max, 0.5) / 1e3,
+				stats_percentile(buckets, count, max, 0.99) / 1e3,
+				stats_percentile(buckets, count, max, 0.999) / 1e3,
+				max / 1e3);
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+
+	/* outside stats_lock, threads holding the tag lock may be registering their counters */
+	tag_read_lock();
+	cooccur_memory = cooccur_memory_usage();
+	tag_unlock();
+
+	fprintf(out, "\n%-24s %12ld\n", "cooccur_bytes", cooccur_memory);
+
+	fclose(out);
+
+	DEBUG(EXIT);
+	return (int)length;
+} /* stats_render */
+
+bool stats_path(const char *path) {
+	size_t length = strlen(STATS_DIR);
+
+	return strncmp(path, STATS_DIR, length) == 0 && (path[length] == '\0' || path[length] == '/');
+} /* stats_path */
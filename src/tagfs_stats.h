@@ -0,0 +1,112 @@
+/**
+ * Operation counters and latency histograms. Every FUSE callback and every
+ * database function that talks to SQLite records how long it took. Each thread
+ * counts into its own set of histograms, so recording takes no lock and shares
+ * no cache line; the sets are only merged when the statistics are read.
+ *
+ * The histograms are log-linear, in the spirit of HdrHistogram: every power of
+ * two of nanoseconds is split into STATS_SUB_BUCKETS buckets, so a percentile
+ * is reported within 1/STATS_SUB_BUCKETS of the true latency.
+ *
+ * The statistics are read through the virtual file /.tagfs/stats, which is
+ * served without touching the database.
+ *
+ * @file tagfs_stats.h
+ * @author Keith Woelke
+ * @date 10/18/2026
+ */
+
+#ifndef TAGFS_STATS_H
+#define TAGFS_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Reserved directory holding the virtual files, and the statistics file in it.
+ */
+#define STATS_DIR "/.tagfs"
+#define STATS_DIR_NAME ".tagfs"
+#define STATS_FILE "/.tagfs/stats"
+#define STATS_FILE_NAME "stats"
+
+/**
+ * Operations with a histogram each.
+ */
+enum stats_op {
+	STATS_LOOKUP,
+	STATS_FORGET,
+	STATS_GETATTR,
+	STATS_SETATTR,
+	STATS_UNLINK,
+	STATS_RENAME,
+	STATS_OPEN,
+	STATS_READ,
+	STATS_WRITE,
+	STATS_FLUSH,
+	STATS_RELEASE,
+	STATS_FSYNC,
+	STATS_OPENDIR,
+	STATS_READDIR,
+	STATS_RELEASEDIR,
+	STATS_CREATE,
+	STATS_DB_GET_FILE_LOCATION,
+	STATS_DB_GET_ALL_TAGS,
+	STATS_DB_EACH_TAG_NAME,
+	STATS_DB_GET_ALL_FILES,
+	STATS_DB_GET_ALL_FILE_TAGS,
+	STATS_DB_DELETE_TAG,
+	STATS_DB_FILE_ID_FROM_PATH,
+	STATS_DB_FILE_NAMES_FROM_IDS,
+	STATS_DB_CREATE_FILE,
+	STATS_DB_BATCH_COMMIT,
+	STATS_OP_COUNT
+};
+
+/**
+ * Set up the per-thread counters. Must be called once from tagfs_init, before
+ * any operation is recorded.
+ */
+void stats_init();
+
+/**
+ * Free every thread's counters. Must be called once from tagfs_destroy, after
+ * the last operation is recorded.
+ */
+void stats_destroy();
+
+/**
+ * Returns the current time, to be handed to stats_record() when the operation
+ * is done.
+ *
+ * @return Nanoseconds on the monotonic clock.
+ */
+uint64_t stats_now();
+
+/**
+ * Count one operation of the calling thread.
+ *
+ * @param op The operation.
+ * @param started The value of stats_now() when the operation started.
+ */
+void stats_record(enum stats_op op, uint64_t started);
+
+/**
+ * Write out the merged statistics of every thread as a table, one line per
+ * operation which ran at least once, followed by the memory held by the tag
+ * co-occurrence matrix (0 if it was dropped).
+ *
+ * @param text OUT: The table, NUL terminated. Must be free'd by the caller.
+ * @return The length of the table.
+ */
+int stats_render(char **text);
+
+/**
+ * Checks whether a path is in the reserved directory, or is the directory.
+ *
+ * @param path The path to check.
+ * @return True, if the path is served by the statistics module.
+ */
+bool stats_path(const char *path);
+
+#endif